@@ -62,6 +62,49 @@ static int parse_config_file(nexterm_config_t* cfg) {
             snprintf(cfg->ca_cert_path, sizeof(cfg->ca_cert_path), "%s", value);
         } else if (strcmp(key, "tls_skip_verify") == 0) {
             cfg->tls_skip_verify = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0);
+        } else if (strcmp(key, "tls_offload") == 0) {
+            cfg->tls_offload = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0);
+        } else if (strcmp(key, "reactor_threads") == 0) {
+            char* endptr;
+            long threads = strtol(value, &endptr, 10);
+            if (*endptr == '\0' && threads >= 0 && threads <= 64)
+                cfg->reactor_threads = (int)threads;
+        } else if (strcmp(key, "data_pool_size") == 0) {
+            char* endptr;
+            long size = strtol(value, &endptr, 10);
+            if (*endptr == '\0' && size >= 0 && size <= 16)
+                cfg->data_pool_size = (int)size;
+        } else if (strcmp(key, "chained_output") == 0) {
+            cfg->chained_output = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0);
+        } else if (strcmp(key, "broadcast_queue_kb") == 0) {
+            char* endptr;
+            long size = strtol(value, &endptr, 10);
+            if (*endptr == '\0' && size >= 0 && size <= 1048576)
+                cfg->broadcast_queue_kb = (int)size;
+        } else if (strcmp(key, "encoder_threads") == 0) {
+            char* endptr;
+            long threads = strtol(value, &endptr, 10);
+            if (*endptr == '\0' && threads >= 0 && threads <= 256)
+                cfg->encoder_threads = (int)threads;
+        } else if (strcmp(key, "encoder_threads_per_session") == 0) {
+            char* endptr;
+            long threads = strtol(value, &endptr, 10);
+            if (*endptr == '\0' && threads >= 0 && threads <= 256)
+                cfg->encoder_threads_per_session = (int)threads;
+        } else if (strcmp(key, "encoder_pin_threads") == 0) {
+            cfg->encoder_pin_threads = (strcmp(value, "true") == 0 || strcmp(value, "1") == 0);
+        } else if (strcmp(key, "thumb_cache_mb") == 0) {
+            char* endptr;
+            long size = strtol(value, &endptr, 10);
+            if (*endptr == '\0' && size >= 0 && size <= 4096)
+                cfg->thumb_cache_mb = (int)size;
+        } else if (strcmp(key, "thumb_cache_dir") == 0) {
+            snprintf(cfg->thumb_cache_dir, sizeof(cfg->thumb_cache_dir), "%s", value);
+        } else if (strcmp(key, "thumb_cache_disk_mb") == 0) {
+            char* endptr;
+            long size = strtol(value, &endptr, 10);
+            if (*endptr == '\0' && size >= 0 && size <= 1048576)
+                cfg->thumb_cache_disk_mb = (int)size;
         }
     }
 
@@ -99,6 +142,16 @@ int nexterm_config_load(nexterm_config_t* cfg) {
     cfg->registration_token[0] = '\0';
     cfg->ca_cert_path[0] = '\0';
     cfg->tls_skip_verify = false;
+    cfg->tls_offload = false;
+    cfg->data_pool_size = 2;
+    cfg->chained_output = true;
+    cfg->broadcast_queue_kb = 4096;
+    cfg->encoder_threads = 0;
+    cfg->encoder_threads_per_session = 0;
+    cfg->encoder_pin_threads = false;
+    cfg->thumb_cache_mb = 32;
+    cfg->thumb_cache_dir[0] = '\0';
+    cfg->thumb_cache_disk_mb = 256;
 
     if (parse_config_file(cfg) != 0) {
         LOG_INFO("No config file found, creating default %s", CONFIG_FILE);
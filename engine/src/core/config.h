@@ -11,6 +11,17 @@ typedef struct nexterm_config {
     bool tls;
     char ca_cert_path[512];
     bool tls_skip_verify;
+    bool tls_offload;
+    int reactor_threads;
+    int data_pool_size;
+    bool chained_output;
+    int broadcast_queue_kb;
+    int encoder_threads;
+    int encoder_threads_per_session;
+    bool encoder_pin_threads;
+    int thumb_cache_mb;
+    char thumb_cache_dir[512];
+    int thumb_cache_disk_mb;
 } nexterm_config_t;
 
 int nexterm_config_load(nexterm_config_t* cfg);
@@ -1,5 +1,6 @@
 #include "io.h"
 #include "log.h"
+#include "reactor.h"
 
 #include <arpa/inet.h>
 #include <netdb.h>
@@ -10,9 +11,9 @@
 #include <string.h>
 #include <sys/socket.h>
 #include <unistd.h>
-#include <poll.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <openssl/bio.h>
 #include <openssl/err.h>
 
 int nexterm_read_exact(int fd, uint8_t* buf, size_t len) {
@@ -35,6 +36,25 @@ int nexterm_write_exact(int fd, const uint8_t* buf, size_t len) {
     return 0;
 }
 
+int nexterm_writev_exact(int fd, struct iovec* iov, int iovcnt) {
+    while (iovcnt > 0) {
+        ssize_t n = writev(fd, iov, iovcnt);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= (ssize_t)iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (uint8_t*)iov->iov_base + n;
+            iov->iov_len -= (size_t)n;
+        }
+    }
+    return 0;
+}
+
 int nexterm_tcp_connect(const char* host, uint16_t port) {
     struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
 
@@ -136,6 +156,30 @@ SSL* nexterm_tls_handshake(SSL_CTX* ctx, int fd) {
     return ssl;
 }
 
+bool nexterm_tls_enable_offload(SSL_CTX* ctx) {
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+    SSL_CTX_set_max_proto_version(ctx, TLS1_2_VERSION);
+    return true;
+#else
+    (void)ctx;
+    return false;
+#endif
+}
+
+bool nexterm_tls_offloaded(SSL* ssl) {
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+    return BIO_get_ktls_send(SSL_get_wbio(ssl)) && BIO_get_ktls_recv(SSL_get_rbio(ssl));
+#else
+    (void)ssl;
+    return false;
+#endif
+}
+
+void nexterm_tls_detach(SSL* ssl) {
+    SSL_free(ssl);
+}
+
 void nexterm_tls_cleanup(SSL* ssl) {
     if (!ssl) return;
     SSL_shutdown(ssl);
@@ -171,9 +215,18 @@ int nexterm_send_frame_s(int fd, SSL* ssl, const uint8_t* data, size_t len,
     uint32_t header = htonl((uint32_t)len);
 
     if (mutex) pthread_mutex_lock(mutex);
-    int ret = nexterm_write_exact_s(fd, ssl, (uint8_t*)&header, FRAME_HEADER_SIZE);
-    if (ret == 0)
-        ret = nexterm_write_exact_s(fd, ssl, data, len);
+    int ret;
+    if (!ssl) {
+        struct iovec iov[2] = {
+            { .iov_base = &header,        .iov_len = FRAME_HEADER_SIZE },
+            { .iov_base = (void*)data,    .iov_len = len },
+        };
+        ret = nexterm_writev_exact(fd, iov, 2);
+    } else {
+        ret = nexterm_write_exact_s(fd, ssl, (uint8_t*)&header, FRAME_HEADER_SIZE);
+        if (ret == 0)
+            ret = nexterm_write_exact_s(fd, ssl, data, len);
+    }
     if (mutex) pthread_mutex_unlock(mutex);
 
     return ret;
@@ -208,86 +261,123 @@ uint8_t* nexterm_read_frame_s(int fd, SSL* ssl, uint32_t max_size, uint32_t* out
     return buf;
 }
 
+#define TLS_PROXY_BUF_SIZE (64 * 1024)
+#define TLS_PROXY_MAX_ROUNDS 32
+
 typedef struct {
     SSL* ssl;
     int plain_fd;
     int tls_fd;
-} tls_proxy_args_t;
-
-#define TLS_PROXY_BUF_SIZE (256 * 1024)
+    uint32_t tls_want;
+    char up[TLS_PROXY_BUF_SIZE];
+    size_t up_len, up_off;
+    char down[TLS_PROXY_BUF_SIZE];
+    size_t down_len, down_off;
+} tls_proxy_t;
+
+static bool tls_proxy_would_block(ssize_t n) {
+    return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+}
 
-static void* tls_proxy_thread(void* arg) {
-    tls_proxy_args_t* a = (tls_proxy_args_t*)arg;
-    char* buf = malloc(TLS_PROXY_BUF_SIZE);
-    if (!buf) {
-        close(a->plain_fd);
-        SSL_shutdown(a->ssl);
-        SSL_free(a->ssl);
-        close(a->tls_fd);
-        free(a);
-        return NULL;
+static int tls_proxy_ssl_error(tls_proxy_t* p, int ret) {
+    int err = SSL_get_error(p->ssl, ret);
+    if (err == SSL_ERROR_WANT_READ) {
+        p->tls_want |= NEXTERM_EV_READ;
+        return 0;
+    }
+    if (err == SSL_ERROR_WANT_WRITE) {
+        p->tls_want |= NEXTERM_EV_WRITE;
+        return 0;
     }
+    return -1;
+}
 
-    int flags = fcntl(a->tls_fd, F_GETFL, 0);
-    if (flags >= 0)
-        fcntl(a->tls_fd, F_SETFL, flags | O_NONBLOCK);
-
-    struct pollfd fds[2] = {
-        { .fd = a->plain_fd, .events = POLLIN },
-        { .fd = a->tls_fd,   .events = POLLIN },
-    };
-
-    for (;;) {
-        int has_pending = SSL_pending(a->ssl) > 0;
-        int timeout = has_pending ? 0 : 200;
-
-        int ret = poll(fds, 2, timeout);
-        if (ret < 0 && errno != EINTR) break;
-
-        if (fds[0].revents & POLLIN) {
-            ssize_t n = read(a->plain_fd, buf, TLS_PROXY_BUF_SIZE);
-            if (n <= 0) break;
-            size_t total = 0;
-            while (total < (size_t)n) {
-                int w = SSL_write(a->ssl, buf + total, (int)((size_t)n - total));
-                if (w > 0) {
-                    total += (size_t)w;
-                } else {
-                    int err = SSL_get_error(a->ssl, w);
-                    if (err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ) {
-                        struct pollfd wpfd = { .fd = a->tls_fd, .events = POLLOUT };
-                        poll(&wpfd, 1, 200);
-                        continue;
-                    }
-                    goto done;
-                }
+static int tls_proxy_event(nexterm_reactor_source_t* src,
+                           const nexterm_reactor_events_t* ev, void* data) {
+    tls_proxy_t* p = (tls_proxy_t*)data;
+    bool progress = true;
+    int round = 0;
+
+    for (; progress && round < TLS_PROXY_MAX_ROUNDS; round++) {
+        progress = false;
+        p->tls_want = 0;
+
+        if (p->up_len == 0) {
+            ssize_t n = read(p->plain_fd, p->up, sizeof(p->up));
+            if (n == 0 || (n < 0 && !tls_proxy_would_block(n)))
+                return NEXTERM_REACTOR_CLOSE;
+            if (n > 0) {
+                p->up_len = (size_t)n;
+                p->up_off = 0;
+                progress = true;
             }
         }
 
-        if ((fds[1].revents & POLLIN) || has_pending) {
-            int n = SSL_read(a->ssl, buf, TLS_PROXY_BUF_SIZE);
-            if (n <= 0) {
-                int err = SSL_get_error(a->ssl, n);
-                if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE)
-                    continue;
-                break;
+        if (p->up_len > 0) {
+            int w = SSL_write(p->ssl, p->up + p->up_off, (int)(p->up_len - p->up_off));
+            if (w > 0) {
+                p->up_off += (size_t)w;
+                if (p->up_off == p->up_len)
+                    p->up_len = p->up_off = 0;
+                progress = true;
+            } else if (tls_proxy_ssl_error(p, w) != 0) {
+                return NEXTERM_REACTOR_CLOSE;
             }
-            if (nexterm_write_exact(a->plain_fd, (const uint8_t*)buf, (size_t)n) != 0)
-                break;
         }
 
-        if (fds[0].revents & (POLLERR | POLLHUP)) break;
-        if (fds[1].revents & (POLLERR | POLLHUP)) break;
+        if (p->down_len == 0) {
+            int n = SSL_read(p->ssl, p->down, (int)sizeof(p->down));
+            if (n > 0) {
+                p->down_len = (size_t)n;
+                p->down_off = 0;
+                progress = true;
+            } else if (tls_proxy_ssl_error(p, n) != 0) {
+                return NEXTERM_REACTOR_CLOSE;
+            }
+        }
+
+        if (p->down_len > 0) {
+            ssize_t w = write(p->plain_fd, p->down + p->down_off, p->down_len - p->down_off);
+            if (w < 0 && !tls_proxy_would_block(w))
+                return NEXTERM_REACTOR_CLOSE;
+            if (w > 0) {
+                p->down_off += (size_t)w;
+                if (p->down_off == p->down_len)
+                    p->down_len = p->down_off = 0;
+                progress = true;
+            }
+        }
     }
-done:
-
-    free(buf);
-    close(a->plain_fd);
-    SSL_shutdown(a->ssl);
-    SSL_free(a->ssl);
-    close(a->tls_fd);
-    free(a);
-    return NULL;
+
+    if (!progress && (ev->revents[0] & NEXTERM_EV_HUP) && p->up_len == 0)
+        return NEXTERM_REACTOR_CLOSE;
+    if (!progress && (ev->revents[1] & NEXTERM_EV_HUP) && p->down_len == 0)
+        return NEXTERM_REACTOR_CLOSE;
+
+    uint32_t plain_events = 0;
+    if (p->up_len == 0) plain_events |= NEXTERM_EV_READ;
+    if (p->down_len > 0) plain_events |= NEXTERM_EV_WRITE;
+
+    uint32_t tls_events = p->tls_want;
+    if (p->down_len == 0) tls_events |= NEXTERM_EV_READ;
+
+    nexterm_reactor_watch(src, 0, plain_events);
+    nexterm_reactor_watch(src, 1, tls_events);
+
+    if (progress)
+        nexterm_reactor_notify(src);
+
+    return NEXTERM_REACTOR_CONTINUE;
+}
+
+static void tls_proxy_close(nexterm_reactor_source_t* src, void* data) {
+    (void)src;
+    tls_proxy_t* p = (tls_proxy_t*)data;
+    close(p->plain_fd);
+    SSL_shutdown(p->ssl);
+    SSL_free(p->ssl);
+    close(p->tls_fd);
+    free(p);
 }
 
 int nexterm_tls_proxy_start(SSL* ssl, int tls_fd) {
@@ -297,26 +387,40 @@ int nexterm_tls_proxy_start(SSL* ssl, int tls_fd) {
         return -1;
     }
 
-    tls_proxy_args_t* args = malloc(sizeof(tls_proxy_args_t));
-    if (!args) {
+    tls_proxy_t* p = malloc(sizeof(tls_proxy_t));
+    if (!p) {
         close(sv[0]);
         close(sv[1]);
         return -1;
     }
 
-    args->ssl = ssl;
-    args->plain_fd = sv[0];
-    args->tls_fd = tls_fd;
+    p->ssl = ssl;
+    p->plain_fd = sv[0];
+    p->tls_fd = tls_fd;
+    p->tls_want = 0;
+    p->up_len = p->up_off = 0;
+    p->down_len = p->down_off = 0;
 
-    pthread_t thread;
-    if (pthread_create(&thread, NULL, tls_proxy_thread, args) != 0) {
-        LOG_ERROR("Failed to start TLS proxy thread: %s", strerror(errno));
-        free(args);
+    int flags = fcntl(tls_fd, F_GETFL, 0);
+    if (flags >= 0)
+        fcntl(tls_fd, F_SETFL, flags | O_NONBLOCK);
+    flags = fcntl(sv[0], F_GETFL, 0);
+    if (flags >= 0)
+        fcntl(sv[0], F_SETFL, flags | O_NONBLOCK);
+
+    int fds[2] = { sv[0], tls_fd };
+    uint32_t events[2] = { NEXTERM_EV_READ, NEXTERM_EV_READ };
+    nexterm_reactor_source_t* src = nexterm_reactor_add(fds, events, 2,
+            tls_proxy_event, tls_proxy_close, p);
+    if (!src) {
+        LOG_ERROR("Failed to register TLS proxy with reactor");
+        free(p);
         close(sv[0]);
         close(sv[1]);
         return -1;
     }
-    pthread_detach(thread);
+    nexterm_reactor_notify(src);
+    nexterm_reactor_release(src);
 
     return sv[1];
 }
@@ -5,11 +5,13 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <openssl/ssl.h>
+#include <sys/uio.h>
 
 #define FRAME_HEADER_SIZE 4
 
 int nexterm_read_exact(int fd, uint8_t* buf, size_t len);
 int nexterm_write_exact(int fd, const uint8_t* buf, size_t len);
+int nexterm_writev_exact(int fd, struct iovec* iov, int iovcnt);
 
 int nexterm_tcp_connect(const char* host, uint16_t port);
 
@@ -17,6 +19,10 @@ SSL_CTX* nexterm_tls_client_ctx_create(const char* ca_cert_path, bool skip_verif
 SSL* nexterm_tls_handshake(SSL_CTX* ctx, int fd);
 void nexterm_tls_cleanup(SSL* ssl);
 
+bool nexterm_tls_enable_offload(SSL_CTX* ctx);
+bool nexterm_tls_offloaded(SSL* ssl);
+void nexterm_tls_detach(SSL* ssl);
+
 int nexterm_read_exact_s(int fd, SSL* ssl, uint8_t* buf, size_t len);
 int nexterm_write_exact_s(int fd, SSL* ssl, const uint8_t* buf, size_t len);
 int nexterm_send_frame_s(int fd, SSL* ssl, const uint8_t* data, size_t len,
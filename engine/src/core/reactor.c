@@ -0,0 +1,494 @@
+#include "reactor.h"
+#include "log.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#define REACTOR_MAX_WORKERS 16
+#define REACTOR_BATCH       16
+#define REACTOR_WAKE_TOKEN  UINT64_MAX
+#define REACTOR_GEN_MASK    0xFFFFFFu
+
+struct nexterm_reactor_source {
+    int fds[NEXTERM_REACTOR_MAX_FDS];
+    uint32_t interest[NEXTERM_REACTOR_MAX_FDS];
+    bool armed[NEXTERM_REACTOR_MAX_FDS];
+    int nfds;
+
+    uint32_t index;
+    uint32_t generation;
+
+    nexterm_reactor_cb on_event;
+    nexterm_reactor_close_cb on_close;
+    void* data;
+
+    pthread_mutex_t lock;
+    pthread_cond_t idle;
+    bool running;
+    bool closed;
+    bool has_pending;
+    nexterm_reactor_events_t pending;
+
+    bool wake_queued;
+    nexterm_reactor_source_t* wake_next;
+
+    atomic_int refs;
+};
+
+typedef struct {
+    nexterm_reactor_source_t* src;
+    uint32_t generation;
+} reactor_entry_t;
+
+static struct {
+    int epfd;
+    int wake_fd;
+    pthread_t workers[REACTOR_MAX_WORKERS];
+    int worker_count;
+    atomic_bool running;
+
+    pthread_mutex_t table_lock;
+    reactor_entry_t* table;
+    uint32_t table_cap;
+    uint32_t* free_slots;
+    uint32_t free_count;
+
+    pthread_mutex_t wake_lock;
+    nexterm_reactor_source_t* wake_head;
+    nexterm_reactor_source_t* wake_tail;
+} g_reactor = { .epfd = -1, .wake_fd = -1 };
+
+static uint64_t reactor_token(const nexterm_reactor_source_t* src, int slot) {
+    return ((uint64_t)src->index << 32)
+         | ((uint64_t)(src->generation & REACTOR_GEN_MASK) << 8)
+         | (uint64_t)(slot & 0xFF);
+}
+
+static void reactor_unref(nexterm_reactor_source_t* src) {
+    if (atomic_fetch_sub(&src->refs, 1) != 1) return;
+    pthread_mutex_destroy(&src->lock);
+    pthread_cond_destroy(&src->idle);
+    free(src);
+}
+
+static int reactor_table_insert(nexterm_reactor_source_t* src) {
+    pthread_mutex_lock(&g_reactor.table_lock);
+
+    if (g_reactor.free_count == 0) {
+        uint32_t old_cap = g_reactor.table_cap;
+        uint32_t new_cap = old_cap ? old_cap * 2 : 256;
+        reactor_entry_t* table = realloc(g_reactor.table, new_cap * sizeof(reactor_entry_t));
+        if (!table) {
+            pthread_mutex_unlock(&g_reactor.table_lock);
+            return -1;
+        }
+        g_reactor.table = table;
+        uint32_t* free_slots = realloc(g_reactor.free_slots, new_cap * sizeof(uint32_t));
+        if (!free_slots) {
+            pthread_mutex_unlock(&g_reactor.table_lock);
+            return -1;
+        }
+        g_reactor.free_slots = free_slots;
+        for (uint32_t i = new_cap; i > old_cap; i--) {
+            g_reactor.table[i - 1].src = NULL;
+            g_reactor.table[i - 1].generation = 0;
+            g_reactor.free_slots[g_reactor.free_count++] = i - 1;
+        }
+        g_reactor.table_cap = new_cap;
+    }
+
+    uint32_t idx = g_reactor.free_slots[--g_reactor.free_count];
+    reactor_entry_t* e = &g_reactor.table[idx];
+    e->generation = (e->generation + 1) & REACTOR_GEN_MASK;
+    e->src = src;
+    src->index = idx;
+    src->generation = e->generation;
+
+    pthread_mutex_unlock(&g_reactor.table_lock);
+    return 0;
+}
+
+static void reactor_table_erase(const nexterm_reactor_source_t* src) {
+    pthread_mutex_lock(&g_reactor.table_lock);
+    reactor_entry_t* e = &g_reactor.table[src->index];
+    if (e->src == src) {
+        e->src = NULL;
+        g_reactor.free_slots[g_reactor.free_count++] = src->index;
+    }
+    pthread_mutex_unlock(&g_reactor.table_lock);
+}
+
+static nexterm_reactor_source_t* reactor_table_lookup(uint64_t token, int* slot) {
+    uint32_t idx = (uint32_t)(token >> 32);
+    uint32_t gen = (uint32_t)(token >> 8) & REACTOR_GEN_MASK;
+    nexterm_reactor_source_t* src = NULL;
+
+    pthread_mutex_lock(&g_reactor.table_lock);
+    if (idx < g_reactor.table_cap) {
+        reactor_entry_t* e = &g_reactor.table[idx];
+        if (e->src && e->generation == gen) {
+            src = e->src;
+            atomic_fetch_add(&src->refs, 1);
+        }
+    }
+    pthread_mutex_unlock(&g_reactor.table_lock);
+
+    *slot = (int)(token & 0xFF);
+    return src;
+}
+
+static uint32_t reactor_to_epoll(uint32_t events) {
+    uint32_t ev = EPOLLONESHOT;
+    if (events & NEXTERM_EV_READ)  ev |= EPOLLIN | EPOLLRDHUP;
+    if (events & NEXTERM_EV_WRITE) ev |= EPOLLOUT;
+    return ev;
+}
+
+static uint32_t reactor_from_epoll(uint32_t ev) {
+    uint32_t events = 0;
+    if (ev & EPOLLIN)  events |= NEXTERM_EV_READ;
+    if (ev & EPOLLOUT) events |= NEXTERM_EV_WRITE;
+    if (ev & (EPOLLHUP | EPOLLERR | EPOLLRDHUP)) events |= NEXTERM_EV_HUP;
+    return events;
+}
+
+static void reactor_arm_locked(nexterm_reactor_source_t* src, int slot) {
+    struct epoll_event ev = {
+        .events = reactor_to_epoll(src->interest[slot]),
+        .data.u64 = reactor_token(src, slot),
+    };
+    if (epoll_ctl(g_reactor.epfd, EPOLL_CTL_MOD, src->fds[slot], &ev) != 0)
+        LOG_WARN("Reactor: failed to re-arm fd %d: %s", src->fds[slot], strerror(errno));
+    src->armed[slot] = src->interest[slot] != 0;
+}
+
+static void reactor_rearm_locked(nexterm_reactor_source_t* src) {
+    for (int i = 0; i < src->nfds; i++) {
+        if (!src->armed[i] && src->interest[i])
+            reactor_arm_locked(src, i);
+    }
+}
+
+static void reactor_detach_locked(nexterm_reactor_source_t* src) {
+    for (int i = 0; i < src->nfds; i++) {
+        epoll_ctl(g_reactor.epfd, EPOLL_CTL_DEL, src->fds[i], NULL);
+        src->armed[i] = false;
+    }
+}
+
+static void reactor_finish(nexterm_reactor_source_t* src) {
+    reactor_table_erase(src);
+    if (src->on_close)
+        src->on_close(src, src->data);
+    reactor_unref(src);
+}
+
+static void reactor_dispatch(nexterm_reactor_source_t* src, int slot,
+                             uint32_t events, bool woken) {
+    pthread_mutex_lock(&src->lock);
+
+    if (slot >= 0 && slot < src->nfds) {
+        src->armed[slot] = false;
+        src->pending.revents[slot] |= events;
+    }
+    if (woken) src->pending.woken = true;
+    src->has_pending = true;
+
+    if (src->closed || src->running) {
+        pthread_mutex_unlock(&src->lock);
+        return;
+    }
+
+    src->running = true;
+    bool self_closed = false;
+
+    while (src->has_pending && !src->closed) {
+        nexterm_reactor_events_t ev = src->pending;
+        memset(&src->pending, 0, sizeof(src->pending));
+        src->has_pending = false;
+        pthread_mutex_unlock(&src->lock);
+
+        int rc = src->on_event(src, &ev, src->data);
+
+        pthread_mutex_lock(&src->lock);
+        if (rc == NEXTERM_REACTOR_CLOSE && !src->closed) {
+            src->closed = true;
+            self_closed = true;
+        }
+    }
+
+    if (src->closed)
+        reactor_detach_locked(src);
+    else
+        reactor_rearm_locked(src);
+
+    src->running = false;
+    pthread_cond_broadcast(&src->idle);
+    pthread_mutex_unlock(&src->lock);
+
+    if (self_closed)
+        reactor_finish(src);
+}
+
+static void reactor_drain_wakeups(void) {
+    uint64_t counter;
+    ssize_t r = read(g_reactor.wake_fd, &counter, sizeof(counter));
+    (void)r;
+
+    pthread_mutex_lock(&g_reactor.wake_lock);
+    nexterm_reactor_source_t* head = g_reactor.wake_head;
+    g_reactor.wake_head = NULL;
+    g_reactor.wake_tail = NULL;
+    pthread_mutex_unlock(&g_reactor.wake_lock);
+
+    while (head) {
+        nexterm_reactor_source_t* src = head;
+        head = src->wake_next;
+
+        pthread_mutex_lock(&src->lock);
+        src->wake_next = NULL;
+        src->wake_queued = false;
+        pthread_mutex_unlock(&src->lock);
+
+        reactor_dispatch(src, -1, 0, true);
+        reactor_unref(src);
+    }
+}
+
+static void* reactor_worker(void* arg) {
+    (void)arg;
+    struct epoll_event events[REACTOR_BATCH];
+
+    while (atomic_load(&g_reactor.running)) {
+        int n = epoll_wait(g_reactor.epfd, events, REACTOR_BATCH, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            LOG_ERROR("Reactor: epoll_wait failed: %s", strerror(errno));
+            break;
+        }
+        if (!atomic_load(&g_reactor.running)) break;
+
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.u64 == REACTOR_WAKE_TOKEN) {
+                reactor_drain_wakeups();
+                continue;
+            }
+
+            int slot;
+            nexterm_reactor_source_t* src = reactor_table_lookup(events[i].data.u64, &slot);
+            if (!src) continue;
+            reactor_dispatch(src, slot, reactor_from_epoll(events[i].events), false);
+            reactor_unref(src);
+        }
+    }
+
+    return NULL;
+}
+
+int nexterm_reactor_init(int workers) {
+    if (workers <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = cpus > 0 ? (int)cpus : 2;
+        if (workers < 2) workers = 2;
+        if (workers > 8) workers = 8;
+    }
+    if (workers > REACTOR_MAX_WORKERS) workers = REACTOR_MAX_WORKERS;
+
+    g_reactor.epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (g_reactor.epfd < 0) {
+        LOG_ERROR("Reactor: epoll_create1 failed: %s", strerror(errno));
+        return -1;
+    }
+
+    g_reactor.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (g_reactor.wake_fd < 0) {
+        LOG_ERROR("Reactor: eventfd failed: %s", strerror(errno));
+        close(g_reactor.epfd);
+        g_reactor.epfd = -1;
+        return -1;
+    }
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.u64 = REACTOR_WAKE_TOKEN };
+    if (epoll_ctl(g_reactor.epfd, EPOLL_CTL_ADD, g_reactor.wake_fd, &ev) != 0) {
+        LOG_ERROR("Reactor: failed to register wake fd: %s", strerror(errno));
+        close(g_reactor.wake_fd);
+        close(g_reactor.epfd);
+        g_reactor.wake_fd = -1;
+        g_reactor.epfd = -1;
+        return -1;
+    }
+
+    pthread_mutex_init(&g_reactor.table_lock, NULL);
+    pthread_mutex_init(&g_reactor.wake_lock, NULL);
+    atomic_store(&g_reactor.running, true);
+
+    for (int i = 0; i < workers; i++) {
+        if (pthread_create(&g_reactor.workers[i], NULL, reactor_worker, NULL) != 0) {
+            LOG_ERROR("Reactor: failed to start worker %d", i);
+            break;
+        }
+        g_reactor.worker_count++;
+    }
+
+    if (g_reactor.worker_count == 0) {
+        nexterm_reactor_shutdown();
+        return -1;
+    }
+
+    LOG_INFO("Reactor started with %d worker(s)", g_reactor.worker_count);
+    return 0;
+}
+
+void nexterm_reactor_shutdown(void) {
+    if (g_reactor.epfd < 0) return;
+
+    atomic_store(&g_reactor.running, false);
+    uint64_t one = 1;
+    ssize_t w = write(g_reactor.wake_fd, &one, sizeof(one));
+    (void)w;
+
+    for (int i = 0; i < g_reactor.worker_count; i++)
+        pthread_join(g_reactor.workers[i], NULL);
+    g_reactor.worker_count = 0;
+
+    close(g_reactor.wake_fd);
+    close(g_reactor.epfd);
+    g_reactor.wake_fd = -1;
+    g_reactor.epfd = -1;
+
+    pthread_mutex_destroy(&g_reactor.table_lock);
+    pthread_mutex_destroy(&g_reactor.wake_lock);
+    free(g_reactor.table);
+    free(g_reactor.free_slots);
+    g_reactor.table = NULL;
+    g_reactor.free_slots = NULL;
+    g_reactor.table_cap = 0;
+    g_reactor.free_count = 0;
+}
+
+nexterm_reactor_source_t* nexterm_reactor_add(const int* fds,
+                                              const uint32_t* events,
+                                              int nfds,
+                                              nexterm_reactor_cb on_event,
+                                              nexterm_reactor_close_cb on_close,
+                                              void* data) {
+    if (g_reactor.epfd < 0 || nfds <= 0 || nfds > NEXTERM_REACTOR_MAX_FDS || !on_event)
+        return NULL;
+
+    nexterm_reactor_source_t* src = calloc(1, sizeof(nexterm_reactor_source_t));
+    if (!src) return NULL;
+
+    src->nfds = nfds;
+    src->on_event = on_event;
+    src->on_close = on_close;
+    src->data = data;
+    pthread_mutex_init(&src->lock, NULL);
+    pthread_cond_init(&src->idle, NULL);
+    atomic_init(&src->refs, 2);
+
+    for (int i = 0; i < nfds; i++) {
+        src->fds[i] = fds[i];
+        src->interest[i] = events[i];
+    }
+
+    if (reactor_table_insert(src) != 0) {
+        pthread_mutex_destroy(&src->lock);
+        pthread_cond_destroy(&src->idle);
+        free(src);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&src->lock);
+    for (int i = 0; i < nfds; i++) {
+        struct epoll_event ev = {
+            .events = reactor_to_epoll(src->interest[i]),
+            .data.u64 = reactor_token(src, i),
+        };
+        if (epoll_ctl(g_reactor.epfd, EPOLL_CTL_ADD, fds[i], &ev) != 0) {
+            LOG_ERROR("Reactor: failed to register fd %d: %s", fds[i], strerror(errno));
+            for (int j = 0; j < i; j++)
+                epoll_ctl(g_reactor.epfd, EPOLL_CTL_DEL, fds[j], NULL);
+            src->closed = true;
+            pthread_mutex_unlock(&src->lock);
+            reactor_table_erase(src);
+            reactor_unref(src);
+            reactor_unref(src);
+            return NULL;
+        }
+        src->armed[i] = src->interest[i] != 0;
+    }
+    pthread_mutex_unlock(&src->lock);
+
+    return src;
+}
+
+int nexterm_reactor_watch(nexterm_reactor_source_t* src, int slot,
+                          uint32_t events) {
+    if (!src || slot < 0 || slot >= src->nfds) return -1;
+
+    pthread_mutex_lock(&src->lock);
+    if (src->closed) {
+        pthread_mutex_unlock(&src->lock);
+        return -1;
+    }
+    if (src->interest[slot] != events) {
+        src->interest[slot] = events;
+        if (src->armed[slot] || !src->running)
+            reactor_arm_locked(src, slot);
+    }
+    pthread_mutex_unlock(&src->lock);
+    return 0;
+}
+
+void nexterm_reactor_notify(nexterm_reactor_source_t* src) {
+    if (!src) return;
+
+    pthread_mutex_lock(&src->lock);
+    if (src->closed || src->wake_queued) {
+        pthread_mutex_unlock(&src->lock);
+        return;
+    }
+    src->wake_queued = true;
+    atomic_fetch_add(&src->refs, 1);
+    pthread_mutex_unlock(&src->lock);
+
+    pthread_mutex_lock(&g_reactor.wake_lock);
+    if (g_reactor.wake_tail)
+        g_reactor.wake_tail->wake_next = src;
+    else
+        g_reactor.wake_head = src;
+    g_reactor.wake_tail = src;
+    pthread_mutex_unlock(&g_reactor.wake_lock);
+
+    uint64_t one = 1;
+    ssize_t w = write(g_reactor.wake_fd, &one, sizeof(one));
+    (void)w;
+}
+
+void nexterm_reactor_remove(nexterm_reactor_source_t* src) {
+    if (!src) return;
+
+    pthread_mutex_lock(&src->lock);
+    bool was_closed = src->closed;
+    src->closed = true;
+    while (src->running)
+        pthread_cond_wait(&src->idle, &src->lock);
+    if (!was_closed)
+        reactor_detach_locked(src);
+    pthread_mutex_unlock(&src->lock);
+
+    if (!was_closed)
+        reactor_finish(src);
+    reactor_unref(src);
+}
+
+void nexterm_reactor_release(nexterm_reactor_source_t* src) {
+    if (src) reactor_unref(src);
+}
@@ -0,0 +1,50 @@
+#ifndef NEXTERM_REACTOR_H
+#define NEXTERM_REACTOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define NEXTERM_REACTOR_MAX_FDS 4
+
+#define NEXTERM_EV_READ  0x01
+#define NEXTERM_EV_WRITE 0x02
+#define NEXTERM_EV_HUP   0x04
+
+#define NEXTERM_REACTOR_CONTINUE 0
+#define NEXTERM_REACTOR_CLOSE    1
+
+typedef struct nexterm_reactor_source nexterm_reactor_source_t;
+
+typedef struct {
+    uint32_t revents[NEXTERM_REACTOR_MAX_FDS];
+    bool woken;
+} nexterm_reactor_events_t;
+
+typedef int (*nexterm_reactor_cb)(nexterm_reactor_source_t* src,
+                                  const nexterm_reactor_events_t* ev,
+                                  void* data);
+
+typedef void (*nexterm_reactor_close_cb)(nexterm_reactor_source_t* src,
+                                         void* data);
+
+int nexterm_reactor_init(int workers);
+
+void nexterm_reactor_shutdown(void);
+
+nexterm_reactor_source_t* nexterm_reactor_add(const int* fds,
+                                              const uint32_t* events,
+                                              int nfds,
+                                              nexterm_reactor_cb on_event,
+                                              nexterm_reactor_close_cb on_close,
+                                              void* data);
+
+int nexterm_reactor_watch(nexterm_reactor_source_t* src, int slot,
+                          uint32_t events);
+
+void nexterm_reactor_notify(nexterm_reactor_source_t* src);
+
+void nexterm_reactor_remove(nexterm_reactor_source_t* src);
+
+void nexterm_reactor_release(nexterm_reactor_source_t* src);
+
+#endif
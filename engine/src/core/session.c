@@ -1,14 +1,142 @@
 #include "session.h"
 #include "log.h"
+#include "reactor.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#define SM_INITIAL_BUCKETS      64
+#define SM_INITIAL_INTERNED     64
+#define SESSION_INITIAL_PARAMS  16
+#define RESIZE_PENDING_FLAG     (1ULL << 32)
+
+static uint32_t sm_hash(const char* str) {
+    uint32_t hash = 2166136261u;
+    for (const unsigned char* p = (const unsigned char*)str; *p; p++) {
+        hash ^= *p;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
 void nexterm_sm_init(nexterm_session_manager_t* sm) {
     memset(sm, 0, sizeof(nexterm_session_manager_t));
     pthread_mutex_init(&sm->mutex, NULL);
+    pthread_mutex_init(&sm->intern_lock, NULL);
+}
+
+static const char* sm_intern(nexterm_session_manager_t* sm, const char* str, uint32_t hash) {
+    pthread_mutex_lock(&sm->intern_lock);
+
+    if (!sm->interned || (sm->interned_count + 1) * 2 > sm->interned_mask + 1) {
+        uint32_t new_size = sm->interned ? (sm->interned_mask + 1) * 2 : SM_INITIAL_INTERNED;
+        char** table = calloc(new_size, sizeof(char*));
+        if (!table) {
+            pthread_mutex_unlock(&sm->intern_lock);
+            return NULL;
+        }
+        if (sm->interned) {
+            for (uint32_t i = 0; i <= sm->interned_mask; i++) {
+                char* entry = sm->interned[i];
+                if (!entry) continue;
+                uint32_t slot = sm_hash(entry) & (new_size - 1);
+                while (table[slot]) slot = (slot + 1) & (new_size - 1);
+                table[slot] = entry;
+            }
+            free(sm->interned);
+        }
+        sm->interned = table;
+        sm->interned_mask = new_size - 1;
+    }
+
+    uint32_t slot = hash & sm->interned_mask;
+    while (sm->interned[slot]) {
+        if (strcmp(sm->interned[slot], str) == 0) {
+            const char* found = sm->interned[slot];
+            pthread_mutex_unlock(&sm->intern_lock);
+            return found;
+        }
+        slot = (slot + 1) & sm->interned_mask;
+    }
+
+    char* copy = strdup(str);
+    if (copy) {
+        sm->interned[slot] = copy;
+        sm->interned_count++;
+    }
+
+    pthread_mutex_unlock(&sm->intern_lock);
+    return copy;
+}
+
+static void sm_index_insert(nexterm_session_t** buckets, uint32_t mask,
+                            nexterm_session_t* session) {
+    nexterm_session_t** head = &buckets[session->id_hash & mask];
+    session->id_next = *head;
+    *head = session;
+}
+
+static void sm_index_erase(nexterm_session_t** buckets, uint32_t mask,
+                           nexterm_session_t* session) {
+    nexterm_session_t** link = &buckets[session->id_hash & mask];
+    while (*link) {
+        if (*link == session) {
+            *link = session->id_next;
+            return;
+        }
+        link = &(*link)->id_next;
+    }
+}
+
+static int sm_grow_locked(nexterm_session_manager_t* sm) {
+    uint32_t old_size = sm->by_id ? sm->bucket_mask + 1 : 0;
+    if (old_size && (uint32_t)(sm->count + 1) * 4 <= old_size * 3)
+        return 0;
+
+    uint32_t new_size = old_size ? old_size * 2 : SM_INITIAL_BUCKETS;
+    nexterm_session_t** by_id = calloc(new_size, sizeof(nexterm_session_t*));
+    if (!by_id) return -1;
+
+    for (uint32_t i = 0; i < old_size; i++) {
+        nexterm_session_t* s = sm->by_id[i];
+        while (s) {
+            nexterm_session_t* next = s->id_next;
+            sm_index_insert(by_id, new_size - 1, s);
+            s = next;
+        }
+    }
+
+    free(sm->by_id);
+    sm->by_id = by_id;
+    sm->bucket_mask = new_size - 1;
+    return 0;
+}
+
+static void sm_free_push(nexterm_session_manager_t* sm, nexterm_session_t* session) {
+    session->free_next = NULL;
+    if (sm->free_tail)
+        sm->free_tail->free_next = session;
+    else
+        sm->free_head = session;
+    sm->free_tail = session;
+}
+
+static nexterm_session_t* sm_alloc_locked(nexterm_session_manager_t* sm) {
+    if (!sm->free_head) {
+        nexterm_session_slab_t* slab = calloc(1, sizeof(nexterm_session_slab_t));
+        if (!slab) return NULL;
+        slab->next = sm->slabs;
+        sm->slabs = slab;
+        for (int i = 0; i < SESSION_SLAB_SIZE; i++)
+            sm_free_push(sm, &slab->sessions[i]);
+    }
+
+    nexterm_session_t* session = sm->free_head;
+    sm->free_head = session->free_next;
+    if (!sm->free_head) sm->free_tail = NULL;
+    return session;
 }
 
 nexterm_session_t* nexterm_sm_create(nexterm_session_manager_t* sm,
@@ -18,29 +146,28 @@ nexterm_session_t* nexterm_sm_create(nexterm_session_manager_t* sm,
                                      uint16_t port) {
     pthread_mutex_lock(&sm->mutex);
 
-    int free_slot = -1;
-    for (int i = 0; i < MAX_SESSIONS; i++) {
-        if (sm->sessions[i].session_id[0] == '\0') {
-            if (free_slot < 0) free_slot = i;
-        } else if (strcmp(sm->sessions[i].session_id, session_id) == 0) {
-            LOG_WARN("Session already exists: %s", session_id);
-            pthread_mutex_unlock(&sm->mutex);
-            return NULL;
-        }
+    if (nexterm_sm_find_locked(sm, session_id)) {
+        LOG_WARN("Session already exists: %s", session_id);
+        pthread_mutex_unlock(&sm->mutex);
+        return NULL;
     }
 
-    if (free_slot < 0) {
-        LOG_ERROR("Maximum sessions reached (%d)", MAX_SESSIONS);
+    nexterm_session_t* session = NULL;
+    if (sm_grow_locked(sm) == 0)
+        session = sm_alloc_locked(sm);
+
+    if (!session) {
+        LOG_ERROR("Failed to allocate session %s (%d active)", session_id, sm->count);
         pthread_mutex_unlock(&sm->mutex);
         return NULL;
     }
 
-    nexterm_session_t* session = &sm->sessions[free_slot];
     memset(session, 0, sizeof(nexterm_session_t));
 
     snprintf(session->session_id, sizeof(session->session_id), "%s", session_id);
     session->type = type;
-    session->state = SESSION_STATE_PENDING;
+    atomic_init(&session->state, SESSION_STATE_PENDING);
+    atomic_init(&session->pending_resize, 0);
     snprintf(session->host, sizeof(session->host), "%s", host);
     session->port = port;
     session->data_fd = -1;
@@ -51,6 +178,11 @@ nexterm_session_t* nexterm_sm_create(nexterm_session_manager_t* sm,
     session->telnet_sock = -1;
     session->param_count = 0;
 
+    session->manager = sm;
+    session->in_use = true;
+    session->id_hash = sm_hash(session->session_id);
+    sm_index_insert(sm->by_id, sm->bucket_mask, session);
+
     sm->count++;
 
     LOG_INFO("Session created: %s (type=%d, target=%s:%d)", session_id, type, host, port);
@@ -62,18 +194,9 @@ nexterm_session_t* nexterm_sm_create(nexterm_session_manager_t* sm,
 nexterm_session_t* nexterm_sm_find(nexterm_session_manager_t* sm,
                                    const char* session_id) {
     pthread_mutex_lock(&sm->mutex);
-
-    for (int i = 0; i < MAX_SESSIONS; i++) {
-        if (sm->sessions[i].session_id[0] != '\0' &&
-            strcmp(sm->sessions[i].session_id, session_id) == 0) {
-            nexterm_session_t* s = &sm->sessions[i];
-            pthread_mutex_unlock(&sm->mutex);
-            return s;
-        }
-    }
-
+    nexterm_session_t* s = nexterm_sm_find_locked(sm, session_id);
     pthread_mutex_unlock(&sm->mutex);
-    return NULL;
+    return s;
 }
 
 void nexterm_sm_lock(nexterm_session_manager_t* sm) {
@@ -86,10 +209,12 @@ void nexterm_sm_unlock(nexterm_session_manager_t* sm) {
 
 nexterm_session_t* nexterm_sm_find_locked(nexterm_session_manager_t* sm,
                                           const char* session_id) {
-    for (int i = 0; i < MAX_SESSIONS; i++) {
-        if (sm->sessions[i].session_id[0] != '\0' &&
-            strcmp(sm->sessions[i].session_id, session_id) == 0)
-            return &sm->sessions[i];
+    if (!sm->by_id) return NULL;
+
+    uint32_t hash = sm_hash(session_id);
+    for (nexterm_session_t* s = sm->by_id[hash & sm->bucket_mask]; s; s = s->id_next) {
+        if (s->id_hash == hash && strcmp(s->session_id, session_id) == 0)
+            return s;
     }
     return NULL;
 }
@@ -99,6 +224,12 @@ static void session_cleanup_resources(nexterm_session_t* session) {
         free(session->params[j].value);
         session->params[j].value = NULL;
     }
+    free(session->params);
+    free(session->param_index);
+    session->params = NULL;
+    session->param_index = NULL;
+    session->param_count = 0;
+    session->param_capacity = 0;
 
     if (session->data_fd >= 0) {
         close(session->data_fd);
@@ -117,9 +248,18 @@ static void session_cleanup_resources(nexterm_session_t* session) {
 static void session_remove_locked(nexterm_session_manager_t* sm,
                                   nexterm_session_t* s) {
     LOG_INFO("Session removed: %s", s->session_id);
+
+    sm_index_erase(sm->by_id, sm->bucket_mask, s);
+
     session_cleanup_resources(s);
-    s->resize_pending = false;
+    atomic_store(&s->pending_resize, 0);
     s->session_id[0] = '\0';
+    s->guac_connection_id[0] = '\0';
+    s->in_use = false;
+
+    /* Slots are reused oldest-first so that stale pointers held by exiting
+     * threads keep referring to a dead session for as long as possible */
+    sm_free_push(sm, s);
     sm->count--;
 }
 
@@ -154,41 +294,101 @@ void nexterm_sm_request_resize(nexterm_session_manager_t* sm,
                                uint16_t cols, uint16_t rows) {
     pthread_mutex_lock(&sm->mutex);
 
-    for (int i = 0; i < MAX_SESSIONS; i++) {
-        if (sm->sessions[i].session_id[0] != '\0' &&
-            strcmp(sm->sessions[i].session_id, session_id) == 0) {
-            sm->sessions[i].pending_cols = cols;
-            sm->sessions[i].pending_rows = rows;
-            sm->sessions[i].resize_pending = true;
-            break;
-        }
+    nexterm_session_t* s = nexterm_sm_find_locked(sm, session_id);
+    if (s) {
+        atomic_store(&s->pending_resize,
+                     RESIZE_PENDING_FLAG | ((uint64_t)cols << 16) | rows);
+        nexterm_reactor_notify(s->reactor_source);
     }
 
     pthread_mutex_unlock(&sm->mutex);
 }
 
+bool nexterm_session_take_resize(nexterm_session_t* session,
+                                 uint16_t* cols, uint16_t* rows) {
+    uint64_t pending = atomic_exchange(&session->pending_resize, 0);
+    if (!(pending & RESIZE_PENDING_FLAG)) return false;
+
+    *cols = (uint16_t)(pending >> 16);
+    *rows = (uint16_t)pending;
+    return true;
+}
+
 const char* nexterm_session_get_param(const nexterm_session_t* session,
                                       const char* key) {
-    for (int i = 0; i < session->param_count; i++) {
-        if (strcmp(session->params[i].key, key) == 0)
-            return session->params[i].value;
+    if (!session->param_index) return NULL;
+
+    uint32_t hash = sm_hash(key);
+    uint32_t slot = hash & session->param_index_mask;
+    while (session->param_index[slot] >= 0) {
+        const session_param_t* p = &session->params[session->param_index[slot]];
+        if (p->hash == hash && strcmp(p->key, key) == 0)
+            return p->value;
+        slot = (slot + 1) & session->param_index_mask;
     }
     return NULL;
 }
 
+static int session_index_param(nexterm_session_t* session, int idx) {
+    uint32_t size = session->param_index ? session->param_index_mask + 1 : 0;
+
+    if ((uint32_t)(session->param_count + 1) * 2 > size) {
+        uint32_t new_size = size ? size * 2 : SESSION_INITIAL_PARAMS * 2;
+        int* index = malloc(new_size * sizeof(int));
+        if (!index) return -1;
+        memset(index, 0xFF, new_size * sizeof(int));
+
+        free(session->param_index);
+        session->param_index = index;
+        session->param_index_mask = new_size - 1;
+
+        for (int i = 0; i < idx; i++)
+            session_index_param(session, i);
+    }
+
+    const session_param_t* p = &session->params[idx];
+    uint32_t slot = p->hash & session->param_index_mask;
+    while (session->param_index[slot] >= 0) {
+        /* The first value added for a key wins, as with a linear search */
+        if (session->params[session->param_index[slot]].key == p->key)
+            return 0;
+        slot = (slot + 1) & session->param_index_mask;
+    }
+    session->param_index[slot] = idx;
+    return 0;
+}
+
 int nexterm_session_add_param(nexterm_session_t* session,
                               const char* key,
                               const char* value) {
-    if (session->param_count >= MAX_PARAMS) {
-        LOG_WARN("Max params reached for session %s", session->session_id);
-        return -1;
+    if (session->param_count >= session->param_capacity) {
+        int capacity = session->param_capacity ? session->param_capacity * 2
+                                               : SESSION_INITIAL_PARAMS;
+        session_param_t* params = realloc(session->params, capacity * sizeof(session_param_t));
+        if (!params) {
+            LOG_WARN("Failed to grow params for session %s", session->session_id);
+            return -1;
+        }
+        session->params = params;
+        session->param_capacity = capacity;
     }
 
-    snprintf(session->params[session->param_count].key,
-             sizeof(session->params[session->param_count].key), "%s", key);
-    session->params[session->param_count].value = strdup(value ? value : "");
-    if (!session->params[session->param_count].value)
+    uint32_t hash = sm_hash(key);
+    const char* interned = sm_intern(session->manager, key, hash);
+    if (!interned) return -1;
+
+    session_param_t* p = &session->params[session->param_count];
+    p->key = interned;
+    p->hash = hash;
+    p->value = strdup(value ? value : "");
+    if (!p->value)
         return -1;
+
+    if (session_index_param(session, session->param_count) != 0) {
+        free(p->value);
+        p->value = NULL;
+        return -1;
+    }
     session->param_count++;
 
     return 0;
@@ -197,14 +397,33 @@ int nexterm_session_add_param(nexterm_session_t* session,
 void nexterm_sm_destroy(nexterm_session_manager_t* sm) {
     pthread_mutex_lock(&sm->mutex);
 
-    for (int i = 0; i < MAX_SESSIONS; i++) {
-        if (sm->sessions[i].session_id[0] != '\0') {
-            session_cleanup_resources(&sm->sessions[i]);
-            sm->sessions[i].session_id[0] = '\0';
+    nexterm_session_slab_t* slab = sm->slabs;
+    while (slab) {
+        nexterm_session_slab_t* next = slab->next;
+        for (int i = 0; i < SESSION_SLAB_SIZE; i++) {
+            if (slab->sessions[i].in_use)
+                session_cleanup_resources(&slab->sessions[i]);
         }
+        free(slab);
+        slab = next;
     }
 
+    free(sm->by_id);
+    sm->slabs = NULL;
+    sm->by_id = NULL;
+    sm->free_head = NULL;
+    sm->free_tail = NULL;
     sm->count = 0;
     pthread_mutex_unlock(&sm->mutex);
     pthread_mutex_destroy(&sm->mutex);
+
+    pthread_mutex_lock(&sm->intern_lock);
+    if (sm->interned) {
+        for (uint32_t i = 0; i <= sm->interned_mask; i++)
+            free(sm->interned[i]);
+        free(sm->interned);
+        sm->interned = NULL;
+    }
+    pthread_mutex_unlock(&sm->intern_lock);
+    pthread_mutex_destroy(&sm->intern_lock);
 }
@@ -3,11 +3,11 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdatomic.h>
 #include <pthread.h>
 
 #define MAX_SESSION_ID_LEN 64
-#define MAX_SESSIONS 256
-#define MAX_PARAMS 128
+#define SESSION_SLAB_SIZE 64
 
 typedef enum {
     SESSION_TYPE_VNC,
@@ -29,24 +29,28 @@ typedef enum {
 } session_state_t;
 
 typedef struct {
-    char key[64];
+    const char* key;
+    uint32_t hash;
     char* value;
 } session_param_t;
 
+struct nexterm_session_manager;
+
 typedef struct nexterm_session {
     char session_id[MAX_SESSION_ID_LEN];
     session_type_t type;
-    volatile session_state_t state;
+    _Atomic session_state_t state;
 
     char host[256];
     uint16_t port;
 
-    session_param_t params[MAX_PARAMS];
+    session_param_t* params;
     int param_count;
+    int param_capacity;
+    int* param_index;
+    uint32_t param_index_mask;
 
-    volatile uint16_t pending_cols;
-    volatile uint16_t pending_rows;
-    volatile bool resize_pending;
+    _Atomic uint64_t pending_resize;
 
     char guac_connection_id[64];
 
@@ -63,12 +67,36 @@ typedef struct nexterm_session {
 
     pthread_t thread;
     bool thread_active;
+
+    struct nexterm_reactor_source* reactor_source;
+
+    struct nexterm_session_manager* manager;
+    bool in_use;
+    uint32_t id_hash;
+    struct nexterm_session* id_next;
+    struct nexterm_session* free_next;
 } nexterm_session_t;
 
-typedef struct {
-    nexterm_session_t sessions[MAX_SESSIONS];
-    int count;
+typedef struct nexterm_session_slab {
+    struct nexterm_session_slab* next;
+    nexterm_session_t sessions[SESSION_SLAB_SIZE];
+} nexterm_session_slab_t;
+
+typedef struct nexterm_session_manager {
     pthread_mutex_t mutex;
+
+    nexterm_session_t** by_id;
+    uint32_t bucket_mask;
+    int count;
+
+    nexterm_session_slab_t* slabs;
+    nexterm_session_t* free_head;
+    nexterm_session_t* free_tail;
+
+    pthread_mutex_t intern_lock;
+    char** interned;
+    uint32_t interned_mask;
+    uint32_t interned_count;
 } nexterm_session_manager_t;
 
 void nexterm_sm_init(nexterm_session_manager_t* sm);
@@ -98,6 +126,9 @@ void nexterm_sm_request_resize(nexterm_session_manager_t* sm,
                                const char* session_id,
                                uint16_t cols, uint16_t rows);
 
+bool nexterm_session_take_resize(nexterm_session_t* session,
+                                 uint16_t* cols, uint16_t* rows);
+
 const char* nexterm_session_get_param(const nexterm_session_t* session,
                                       const char* key);
 
@@ -1,9 +1,13 @@
 #include "control_plane.h"
+#include "reactor.h"
 #include "session.h"
+#include "ssh_pool.h"
+#include "thumb_cache.h"
 #include "config.h"
 #include "log.h"
 
 #include <curl/curl.h>
+#include <guacamole/display.h>
 #include <libssh2.h>
 
 #include <getopt.h>
@@ -194,15 +198,37 @@ int main(int argc, char* argv[]) {
 
     nexterm_sm_init(&g_session_manager);
 
+    if (nexterm_reactor_init(config.reactor_threads) != 0) {
+        LOG_ERROR("Failed to start session reactor");
+        return 1;
+    }
+
+    if (nexterm_ssh_pool_init() != 0) {
+        LOG_ERROR("Failed to start SSH connection pool");
+        return 1;
+    }
+
+    nexterm_thumb_cache_init((size_t)config.thumb_cache_mb * 1024 * 1024,
+                             config.thumb_cache_dir,
+                             (size_t)config.thumb_cache_disk_mb * 1024 * 1024);
+
+    guac_display_configure_pool(config.encoder_threads,
+                                config.encoder_threads_per_session,
+                                config.encoder_pin_threads);
+
     nexterm_control_plane_t* cp = nexterm_cp_create(server_host, server_port,
                                                      config.registration_token,
                                                      config.tls,
                                                      config.ca_cert_path,
-                                                     config.tls_skip_verify);
+                                                     config.tls_skip_verify,
+                                                     config.tls_offload);
     if (!cp) {
         LOG_ERROR("Failed to create control plane client");
         return 1;
     }
+    cp->data_pool_size = config.data_pool_size;
+    cp->chained_output = config.chained_output;
+    cp->broadcast_queue_kb = config.broadcast_queue_kb;
     g_control_plane = cp;
 
     while (!g_shutdown) {
@@ -226,6 +252,9 @@ int main(int argc, char* argv[]) {
     }
 
     LOG_INFO("Shutting down engine");
+    nexterm_ssh_pool_shutdown();
+    nexterm_reactor_shutdown();
+    nexterm_thumb_cache_shutdown();
     nexterm_sm_destroy(&g_session_manager);
     nexterm_cp_destroy(cp);
     curl_global_cleanup();
@@ -4,6 +4,7 @@
 #include "telnet.h"
 #include "websocket.h"
 #include "log.h"
+#include "reactor.h"
 #include "session.h"
 
 extern nexterm_session_manager_t g_session_manager;
@@ -15,6 +16,7 @@ extern nexterm_session_manager_t g_session_manager;
 #include <guacamole/user.h>
 
 #include <errno.h>
+#include <inttypes.h>
 #include <poll.h>
 #include <pthread.h>
 #include <stdarg.h>
@@ -36,6 +38,7 @@ typedef struct {
     guac_client* client;
     int fd;
     int owner;
+    bool chained_output;
     char session_id[MAX_SESSION_ID_LEN];
 } guac_user_thread_args_t;
 
@@ -60,7 +63,8 @@ static void* guac_user_thread(void* arg) {
     int fd = params->fd;
     int owner = params->owner;
 
-    guac_socket* socket = guac_socket_open(fd);
+    guac_socket* socket = guac_socket_open_buffered(fd, params->chained_output
+            ? GUAC_SOCKET_FD_BUFFERING_CHAINED : GUAC_SOCKET_FD_BUFFERING_FIXED);
     if (!socket) {
         LOG_ERROR("Failed to create guac_socket for session %s", params->session_id);
         close(fd);
@@ -119,6 +123,14 @@ static void* guac_user_thread(void* arg) {
     LOG_INFO("User disconnected from session %s (owner=%d, remaining=%d)",
              params->session_id, owner, client->connected_users);
 
+    guac_socket_fd_stats stats;
+    if (guac_socket_fd_get_stats(socket, &stats) == 0) {
+        LOG_DEBUG("Session %s output: %" PRIu64 " bytes in %" PRIu64 " writes "
+                  "(%" PRIu64 " flushes, %" PRIu64 " zero-copy)",
+                  params->session_id, stats.bytes_written, stats.write_calls,
+                  stats.flushes, stats.zerocopy_calls);
+    }
+
     guac_socket_free(socket);
     guac_user_free(user);
     free(params);
@@ -126,13 +138,15 @@ static void* guac_user_thread(void* arg) {
 }
 
 static int start_user_thread(guac_client* client, int fd, int owner,
-                              const char* session_id, pthread_t* out_thread) {
+                              bool chained_output, const char* session_id,
+                              pthread_t* out_thread) {
     guac_user_thread_args_t* params = calloc(1, sizeof(guac_user_thread_args_t));
     if (!params) return -1;
 
     params->client = client;
     params->fd = fd;
     params->owner = owner;
+    params->chained_output = chained_output;
     snprintf(params->session_id, sizeof(params->session_id), "%s", session_id);
 
     if (pthread_create(out_thread, NULL, guac_user_thread, params) != 0) {
@@ -200,6 +214,11 @@ static guac_client* guac_setup_client(nexterm_session_t* session,
         return NULL;
     }
 
+    /* Viewers of shared sessions are fed from their own queues so that one
+     * slow viewer cannot stall the owner or everyone else. The owner itself
+     * stays synchronous, keeping backpressure for single-user sessions. */
+    guac_client_enable_broadcast_queues(client, (size_t)cp->broadcast_queue_kb * 1024);
+
     return client;
 }
 
@@ -230,8 +249,8 @@ static int receive_join_fd(int pipe_fd) {
 }
 
 static void guac_accept_joins(nexterm_session_t* session, guac_client* client,
-                              pthread_t* user_threads, int* user_thread_count,
-                              int max_user_threads) {
+                              bool chained_output, pthread_t* user_threads,
+                              int* user_thread_count, int max_user_threads) {
     bool active = true;
     while (active && session->state == SESSION_STATE_ACTIVE) {
         struct pollfd pfd = { .fd = session->join_pipe[0], .events = POLLIN };
@@ -264,7 +283,7 @@ static void guac_accept_joins(nexterm_session_t* session, guac_client* client,
         LOG_INFO("Join connection received for session %s (fd=%d)", session->session_id, join_fd);
 
         pthread_t join_thread;
-        if (start_user_thread(client, join_fd, 0, session->session_id, &join_thread) != 0) {
+        if (start_user_thread(client, join_fd, 0, chained_output, session->session_id, &join_thread) != 0) {
             close(join_fd);
             continue;
         }
@@ -319,7 +338,7 @@ static void* guac_session_thread(void* arg) {
     pthread_t owner_thread;
     int owner_fd = session->data_fd;
     session->data_fd = -1;
-    if (start_user_thread(client, owner_fd, 1, session->session_id, &owner_thread) != 0) {
+    if (start_user_thread(client, owner_fd, 1, cp->chained_output, session->session_id, &owner_thread) != 0) {
         LOG_ERROR("Failed to start owner user thread for session %s", session->session_id);
         close(owner_fd);
         nexterm_sm_lock(&g_session_manager);
@@ -335,7 +354,7 @@ static void* guac_session_thread(void* arg) {
     }
     user_threads[user_thread_count++] = owner_thread;
 
-    guac_accept_joins(session, client, user_threads, &user_thread_count,
+    guac_accept_joins(session, client, cp->chained_output, user_threads, &user_thread_count,
                       (int)(sizeof(user_threads) / sizeof(user_threads[0])));
 
     for (int i = 0; i < user_thread_count; i++) {
@@ -464,4 +483,6 @@ void nexterm_connection_close(nexterm_session_t* session) {
 
     if (session->guac_client)
         guac_client_stop((guac_client*)session->guac_client);
+
+    nexterm_reactor_notify(session->reactor_source);
 }
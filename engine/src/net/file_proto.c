@@ -4,16 +4,17 @@
 
 #include "sftp_protocol_builder.h"
 
+#include <arpa/inet.h>
 #include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
-static int fp_finalize_and_send(flatcc_builder_t* b, int fd) {
+static int fp_finalize_and_send(flatcc_builder_t* b, fp_out_t out) {
     size_t sz;
     uint8_t* buf = (uint8_t*)flatcc_builder_finalize_buffer(b, &sz);
-    int ret = nexterm_send_frame(fd, buf, sz, NULL);
+    int ret = nexterm_send_frame(out.fd, buf, sz, out.lock);
     flatcc_builder_clear(b);
     free(buf);
     return ret;
@@ -59,21 +60,21 @@ static void fp_start_message(flatcc_builder_t* b,
     Nexterm_SftpProtocol_SftpMessage_request_id_add(b, rid);
 }
 
-int fp_send_ready(int fd) {
+int fp_send_ready(fp_out_t out) {
     flatcc_builder_t b;
     fp_start_message(&b, Nexterm_SftpProtocol_SftpMsgType_Ready, 0);
     Nexterm_SftpProtocol_SftpMessage_end_as_root(&b);
-    return fp_finalize_and_send(&b, fd);
+    return fp_finalize_and_send(&b, out);
 }
 
-int fp_send_ok(int fd, uint32_t rid) {
+int fp_send_ok(fp_out_t out, uint32_t rid) {
     flatcc_builder_t b;
     fp_start_message(&b, Nexterm_SftpProtocol_SftpMsgType_Ok, rid);
     Nexterm_SftpProtocol_SftpMessage_end_as_root(&b);
-    return fp_finalize_and_send(&b, fd);
+    return fp_finalize_and_send(&b, out);
 }
 
-int fp_send_error(int fd, uint32_t rid, const char* message, int32_t code) {
+int fp_send_error(fp_out_t out, uint32_t rid, const char* message, int32_t code) {
     flatcc_builder_t b;
     fp_start_message(&b, Nexterm_SftpProtocol_SftpMsgType_Error, rid);
     Nexterm_SftpProtocol_SftpMessage_error_res_start(&b);
@@ -81,10 +82,10 @@ int fp_send_error(int fd, uint32_t rid, const char* message, int32_t code) {
     Nexterm_SftpProtocol_ErrorRes_code_add(&b, code);
     Nexterm_SftpProtocol_SftpMessage_error_res_end(&b);
     Nexterm_SftpProtocol_SftpMessage_end_as_root(&b);
-    return fp_finalize_and_send(&b, fd);
+    return fp_finalize_and_send(&b, out);
 }
 
-int fp_send_file_data(int fd, uint32_t rid, const uint8_t* data, size_t len,
+int fp_send_file_data(fp_out_t out, uint32_t rid, const uint8_t* data, size_t len,
                       uint64_t total_size) {
     flatcc_builder_t b;
     fp_start_message(&b, Nexterm_SftpProtocol_SftpMsgType_FileData, rid);
@@ -93,17 +94,76 @@ int fp_send_file_data(int fd, uint32_t rid, const uint8_t* data, size_t len,
     Nexterm_SftpProtocol_FileDataRes_total_size_add(&b, total_size);
     Nexterm_SftpProtocol_SftpMessage_file_data_res_end(&b);
     Nexterm_SftpProtocol_SftpMessage_end_as_root(&b);
-    return fp_finalize_and_send(&b, fd);
+    return fp_finalize_and_send(&b, out);
 }
 
-int fp_send_file_end(int fd, uint32_t rid) {
+static void fp_put_le16(uint8_t* p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void fp_put_le32(uint8_t* p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static void fp_put_le64(uint8_t* p, uint64_t v) {
+    for (int i = 0; i < 8; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+/* Fixed FileData frame so the payload can be read straight behind it:
+ *   0 frame length | 4 root | 8 vtable | 44 SftpMessage | 60 vtable
+ *   68 FileDataRes | 84 data length | 88 data */
+void fp_file_data_header(uint8_t* hdr, uint32_t rid, size_t len,
+                         uint64_t total_size) {
+    uint8_t* fb = hdr + FRAME_HEADER_SIZE;
+    memset(hdr, 0, FP_FILE_DATA_HEADER);
+
+    uint32_t frame_len = htonl((uint32_t)(FP_FILE_DATA_HEADER - FRAME_HEADER_SIZE + len));
+    memcpy(hdr, &frame_len, FRAME_HEADER_SIZE);
+
+    fp_put_le32(fb + 0, 40);
+
+    fp_put_le16(fb + 4, 34);
+    fp_put_le16(fb + 6, 16);
+    fp_put_le16(fb + 8, 12);
+    fp_put_le16(fb + 10, 4);
+    fp_put_le16(fb + 36, 8);
+
+    fp_put_le32(fb + 40, 36);
+    fp_put_le32(fb + 44, rid);
+    fp_put_le32(fb + 48, 16);
+    fb[52] = Nexterm_SftpProtocol_SftpMsgType_FileData;
+
+    fp_put_le16(fb + 56, 8);
+    fp_put_le16(fb + 58, 16);
+    fp_put_le16(fb + 60, 4);
+    fp_put_le16(fb + 62, 8);
+
+    fp_put_le32(fb + 64, 8);
+    fp_put_le32(fb + 68, 12);
+    fp_put_le64(fb + 72, total_size);
+    fp_put_le32(fb + 80, (uint32_t)len);
+}
+
+int fp_send_file_end(fp_out_t out, uint32_t rid) {
     flatcc_builder_t b;
     fp_start_message(&b, Nexterm_SftpProtocol_SftpMsgType_FileEnd, rid);
     Nexterm_SftpProtocol_SftpMessage_end_as_root(&b);
-    return fp_finalize_and_send(&b, fd);
+    return fp_finalize_and_send(&b, out);
+}
+
+int fp_send_write_ack(fp_out_t out, uint32_t rid, uint64_t committed, uint32_t window) {
+    flatcc_builder_t b;
+    fp_start_message(&b, Nexterm_SftpProtocol_SftpMsgType_WriteAck, rid);
+    Nexterm_SftpProtocol_SftpMessage_write_ack_res_start(&b);
+    Nexterm_SftpProtocol_WriteAckRes_committed_add(&b, committed);
+    Nexterm_SftpProtocol_WriteAckRes_window_add(&b, window);
+    Nexterm_SftpProtocol_SftpMessage_write_ack_res_end(&b);
+    Nexterm_SftpProtocol_SftpMessage_end_as_root(&b);
+    return fp_finalize_and_send(&b, out);
 }
 
-int fp_send_thumbnail(int fd, uint32_t rid, const uint8_t* data, size_t len,
+int fp_send_thumbnail(fp_out_t out, uint32_t rid, const uint8_t* data, size_t len,
                       uint32_t w, uint32_t h) {
     flatcc_builder_t b;
     fp_start_message(&b, Nexterm_SftpProtocol_SftpMsgType_ThumbnailResult, rid);
@@ -113,10 +173,10 @@ int fp_send_thumbnail(int fd, uint32_t rid, const uint8_t* data, size_t len,
     Nexterm_SftpProtocol_ThumbnailRes_height_add(&b, h);
     Nexterm_SftpProtocol_SftpMessage_thumbnail_res_end(&b);
     Nexterm_SftpProtocol_SftpMessage_end_as_root(&b);
-    return fp_finalize_and_send(&b, fd);
+    return fp_finalize_and_send(&b, out);
 }
 
-int fp_send_dir_list(int fd, uint32_t rid, const fp_entries_t* list) {
+int fp_send_dir_list(fp_out_t out, uint32_t rid, const fp_entries_t* list) {
     flatcc_builder_t b;
     fp_start_message(&b, Nexterm_SftpProtocol_SftpMsgType_DirList, rid);
     Nexterm_SftpProtocol_SftpMessage_dir_list_res_start(&b);
@@ -137,10 +197,10 @@ int fp_send_dir_list(int fd, uint32_t rid, const fp_entries_t* list) {
     Nexterm_SftpProtocol_DirListRes_entries_end(&b);
     Nexterm_SftpProtocol_SftpMessage_dir_list_res_end(&b);
     Nexterm_SftpProtocol_SftpMessage_end_as_root(&b);
-    return fp_finalize_and_send(&b, fd);
+    return fp_finalize_and_send(&b, out);
 }
 
-int fp_send_stat(int fd, uint32_t rid, const fp_stat_t* st) {
+int fp_send_stat(fp_out_t out, uint32_t rid, const fp_stat_t* st) {
     flatcc_builder_t b;
     fp_start_message(&b, Nexterm_SftpProtocol_SftpMsgType_StatResult, rid);
     Nexterm_SftpProtocol_SftpMessage_stat_res_start(&b);
@@ -155,10 +215,10 @@ int fp_send_stat(int fd, uint32_t rid, const fp_stat_t* st) {
     Nexterm_SftpProtocol_StatRes_is_dir_add(&b, st->is_dir);
     Nexterm_SftpProtocol_SftpMessage_stat_res_end(&b);
     Nexterm_SftpProtocol_SftpMessage_end_as_root(&b);
-    return fp_finalize_and_send(&b, fd);
+    return fp_finalize_and_send(&b, out);
 }
 
-int fp_send_realpath(int fd, uint32_t rid, const char* path, bool is_dir) {
+int fp_send_realpath(fp_out_t out, uint32_t rid, const char* path, bool is_dir) {
     flatcc_builder_t b;
     fp_start_message(&b, Nexterm_SftpProtocol_SftpMsgType_RealpathResult, rid);
     Nexterm_SftpProtocol_SftpMessage_realpath_res_start(&b);
@@ -166,10 +226,10 @@ int fp_send_realpath(int fd, uint32_t rid, const char* path, bool is_dir) {
     Nexterm_SftpProtocol_RealpathRes_is_dir_add(&b, is_dir);
     Nexterm_SftpProtocol_SftpMessage_realpath_res_end(&b);
     Nexterm_SftpProtocol_SftpMessage_end_as_root(&b);
-    return fp_finalize_and_send(&b, fd);
+    return fp_finalize_and_send(&b, out);
 }
 
-int fp_send_exec_result(int fd, uint32_t rid, const char* stdout_data,
+int fp_send_exec_result(fp_out_t out, uint32_t rid, const char* stdout_data,
                         const char* stderr_data, int32_t exit_code) {
     flatcc_builder_t b;
     fp_start_message(&b, Nexterm_SftpProtocol_SftpMsgType_ExecResult, rid);
@@ -179,10 +239,10 @@ int fp_send_exec_result(int fd, uint32_t rid, const char* stdout_data,
     Nexterm_SftpProtocol_ExecRes_exit_code_add(&b, exit_code);
     Nexterm_SftpProtocol_SftpMessage_exec_res_end(&b);
     Nexterm_SftpProtocol_SftpMessage_end_as_root(&b);
-    return fp_finalize_and_send(&b, fd);
+    return fp_finalize_and_send(&b, out);
 }
 
-int fp_send_search_result(int fd, uint32_t rid, const fp_search_t* ctx) {
+int fp_send_search_result(fp_out_t out, uint32_t rid, const fp_search_t* ctx) {
     flatcc_builder_t b;
     fp_start_message(&b, Nexterm_SftpProtocol_SftpMsgType_SearchResult, rid);
     Nexterm_SftpProtocol_SftpMessage_search_res_start(&b);
@@ -192,7 +252,7 @@ int fp_send_search_result(int fd, uint32_t rid, const fp_search_t* ctx) {
     Nexterm_SftpProtocol_SearchRes_directories_end(&b);
     Nexterm_SftpProtocol_SftpMessage_search_res_end(&b);
     Nexterm_SftpProtocol_SftpMessage_end_as_root(&b);
-    return fp_finalize_and_send(&b, fd);
+    return fp_finalize_and_send(&b, out);
 }
 
 int64_t fp_monotonic_ms(void) {
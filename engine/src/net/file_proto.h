@@ -1,6 +1,7 @@
 #ifndef NEXTERM_FILE_PROTO_H
 #define NEXTERM_FILE_PROTO_H
 
+#include <pthread.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -10,6 +11,7 @@
 #define FP_MAX_FRAME   (16 * 1024 * 1024)
 #define FP_SEARCH_MAX  20
 #define FP_THUMB_MAX_BYTES (12 * 1024 * 1024)
+#define FP_FILE_DATA_HEADER 88
 
 typedef struct {
     char* name;
@@ -38,6 +40,14 @@ typedef struct {
     bool is_dir;
 } fp_stat_t;
 
+/* A data connection to send frames on. A connection written from more than
+ * one thread carries its own lock, held for each whole frame and taken by the
+ * caller around raw writes too; NULL when a single thread does all sends. */
+typedef struct {
+    int fd;
+    pthread_mutex_t* lock;
+} fp_out_t;
+
 typedef struct {
     char paths[FP_SEARCH_MAX][FP_MAX_PATH];
     int count;
@@ -50,20 +60,23 @@ int fp_entries_push(fp_entries_t* list, const char* name, bool is_dir,
                     bool is_symlink, uint64_t size, uint32_t mtime, uint32_t mode);
 void fp_entries_free(fp_entries_t* list);
 
-int fp_send_ready(int fd);
-int fp_send_ok(int fd, uint32_t rid);
-int fp_send_error(int fd, uint32_t rid, const char* message, int32_t code);
-int fp_send_file_data(int fd, uint32_t rid, const uint8_t* data, size_t len,
+int fp_send_ready(fp_out_t out);
+int fp_send_ok(fp_out_t out, uint32_t rid);
+int fp_send_error(fp_out_t out, uint32_t rid, const char* message, int32_t code);
+int fp_send_file_data(fp_out_t out, uint32_t rid, const uint8_t* data, size_t len,
                       uint64_t total_size);
-int fp_send_file_end(int fd, uint32_t rid);
-int fp_send_thumbnail(int fd, uint32_t rid, const uint8_t* data, size_t len,
+void fp_file_data_header(uint8_t* hdr, uint32_t rid, size_t len,
+                         uint64_t total_size);
+int fp_send_file_end(fp_out_t out, uint32_t rid);
+int fp_send_write_ack(fp_out_t out, uint32_t rid, uint64_t committed, uint32_t window);
+int fp_send_thumbnail(fp_out_t out, uint32_t rid, const uint8_t* data, size_t len,
                       uint32_t w, uint32_t h);
-int fp_send_dir_list(int fd, uint32_t rid, const fp_entries_t* list);
-int fp_send_stat(int fd, uint32_t rid, const fp_stat_t* st);
-int fp_send_realpath(int fd, uint32_t rid, const char* path, bool is_dir);
-int fp_send_exec_result(int fd, uint32_t rid, const char* stdout_data,
+int fp_send_dir_list(fp_out_t out, uint32_t rid, const fp_entries_t* list);
+int fp_send_stat(fp_out_t out, uint32_t rid, const fp_stat_t* st);
+int fp_send_realpath(fp_out_t out, uint32_t rid, const char* path, bool is_dir);
+int fp_send_exec_result(fp_out_t out, uint32_t rid, const char* stdout_data,
                         const char* stderr_data, int32_t exit_code);
-int fp_send_search_result(int fd, uint32_t rid, const fp_search_t* ctx);
+int fp_send_search_result(fp_out_t out, uint32_t rid, const fp_search_t* ctx);
 
 int64_t fp_monotonic_ms(void);
 bool fp_name_matches(const char* name, const char* search_term);
@@ -195,14 +195,14 @@ static const char* ftp_strerror(long response) {
     }
 }
 
-static void ftp_send_curl_error(ftp_conn_t* c, int fd, uint32_t rid, CURLcode rc) {
+static void ftp_send_curl_error(ftp_conn_t* c, fp_out_t out, uint32_t rid, CURLcode rc) {
     long response = 0;
     curl_easy_getinfo(c->curl, CURLINFO_RESPONSE_CODE, &response);
 
     const char* message = ftp_strerror(response);
     if (!message) message = c->errbuf[0] ? c->errbuf : curl_easy_strerror(rc);
 
-    fp_send_error(fd, rid, message, response > 0 ? (int32_t)response : (int32_t)rc);
+    fp_send_error(out, rid, message, response > 0 ? (int32_t)response : (int32_t)rc);
 }
 
 static CURLcode ftp_run_quote(ftp_conn_t* c, struct curl_slist* cmds, ftp_buf_t* replies) {
@@ -578,23 +578,23 @@ static void ftp_split_parent(const char* path, char* parent, size_t parent_sz,
     snprintf(name, name_sz, "%s", slash + 1);
 }
 
-static void handle_list_dir(ftp_conn_t* c, int fd, uint32_t rid, const char* path) {
+static void handle_list_dir(ftp_conn_t* c, fp_out_t out, uint32_t rid, const char* path) {
     char normalized[FP_MAX_PATH];
     ftp_normalize_path(path, normalized, sizeof(normalized));
 
     fp_entries_t entries = {0};
     CURLcode rc = ftp_list_dir(c, normalized, &entries);
     if (rc != CURLE_OK) {
-        ftp_send_curl_error(c, fd, rid, rc);
+        ftp_send_curl_error(c, out, rid, rc);
         fp_entries_free(&entries);
         return;
     }
 
-    fp_send_dir_list(fd, rid, &entries);
+    fp_send_dir_list(out, rid, &entries);
     fp_entries_free(&entries);
 }
 
-static void handle_stat(ftp_conn_t* c, int fd, uint32_t rid, const char* path) {
+static void handle_stat(ftp_conn_t* c, fp_out_t out, uint32_t rid, const char* path) {
     char normalized[FP_MAX_PATH];
     ftp_normalize_path(path, normalized, sizeof(normalized));
 
@@ -604,7 +604,7 @@ static void handle_stat(ftp_conn_t* c, int fd, uint32_t rid, const char* path) {
     if (strcmp(normalized, "/") == 0) {
         st.is_dir = true;
         st.mode = 0755u | S_IFDIR;
-        fp_send_stat(fd, rid, &st);
+        fp_send_stat(out, rid, &st);
         return;
     }
 
@@ -615,7 +615,7 @@ static void handle_stat(ftp_conn_t* c, int fd, uint32_t rid, const char* path) {
     fp_entries_t entries = {0};
     CURLcode rc = ftp_list_dir(c, parent, &entries);
     if (rc != CURLE_OK) {
-        ftp_send_curl_error(c, fd, rid, rc);
+        ftp_send_curl_error(c, out, rid, rc);
         fp_entries_free(&entries);
         return;
     }
@@ -628,22 +628,22 @@ static void handle_stat(ftp_conn_t* c, int fd, uint32_t rid, const char* path) {
         st.mtime = entries.items[i].mtime;
         st.atime = entries.items[i].mtime;
         st.is_dir = entries.items[i].is_dir;
-        fp_send_stat(fd, rid, &st);
+        fp_send_stat(out, rid, &st);
         fp_entries_free(&entries);
         return;
     }
 
     fp_entries_free(&entries);
-    fp_send_error(fd, rid, "Path does not exist", 550);
+    fp_send_error(out, rid, "Path does not exist", 550);
 }
 
-static void handle_simple_command(ftp_conn_t* c, int fd, uint32_t rid,
+static void handle_simple_command(ftp_conn_t* c, fp_out_t out, uint32_t rid,
                                   const char* verb, const char* path) {
     CURLcode rc = ftp_command_path(c, verb, path);
     if (rc != CURLE_OK)
-        ftp_send_curl_error(c, fd, rid, rc);
+        ftp_send_curl_error(c, out, rid, rc);
     else
-        fp_send_ok(fd, rid);
+        fp_send_ok(out, rid);
 }
 
 static CURLcode ftp_recursive_rmdir(ftp_conn_t* c, const char* path, int depth) {
@@ -673,22 +673,22 @@ static CURLcode ftp_recursive_rmdir(ftp_conn_t* c, const char* path, int depth)
     return ftp_command_path(c, "RMD", path);
 }
 
-static void handle_rmdir(ftp_conn_t* c, int fd, uint32_t rid, const char* path,
+static void handle_rmdir(ftp_conn_t* c, fp_out_t out, uint32_t rid, const char* path,
                          bool recursive) {
     CURLcode rc = recursive ? ftp_recursive_rmdir(c, path, 0)
                             : ftp_command_path(c, "RMD", path);
     if (rc == FTP_ERR_TOO_DEEP)
-        fp_send_error(fd, rid, "Directory tree is too deep to delete", -1);
+        fp_send_error(out, rid, "Directory tree is too deep to delete", -1);
     else if (rc != CURLE_OK)
-        ftp_send_curl_error(c, fd, rid, rc);
+        ftp_send_curl_error(c, out, rid, rc);
     else
-        fp_send_ok(fd, rid);
+        fp_send_ok(out, rid);
 }
 
-static void handle_rename(ftp_conn_t* c, int fd, uint32_t rid,
+static void handle_rename(ftp_conn_t* c, fp_out_t out, uint32_t rid,
                           const char* old_path, const char* new_path) {
     if (!ftp_path_is_safe(old_path) || !ftp_path_is_safe(new_path)) {
-        fp_send_error(fd, rid, "Invalid path", -1);
+        fp_send_error(out, rid, "Invalid path", -1);
         return;
     }
 
@@ -700,7 +700,7 @@ static void handle_rename(ftp_conn_t* c, int fd, uint32_t rid,
     struct curl_slist* cmds = curl_slist_append(NULL, from);
     if (cmds) cmds = curl_slist_append(cmds, to);
     if (!cmds) {
-        fp_send_error(fd, rid, "Out of memory", -1);
+        fp_send_error(out, rid, "Out of memory", -1);
         return;
     }
 
@@ -708,15 +708,15 @@ static void handle_rename(ftp_conn_t* c, int fd, uint32_t rid,
     curl_slist_free_all(cmds);
 
     if (rc != CURLE_OK)
-        ftp_send_curl_error(c, fd, rid, rc);
+        ftp_send_curl_error(c, out, rid, rc);
     else
-        fp_send_ok(fd, rid);
+        fp_send_ok(out, rid);
 }
 
-static void handle_chmod(ftp_conn_t* c, int fd, uint32_t rid, const char* path,
+static void handle_chmod(ftp_conn_t* c, fp_out_t out, uint32_t rid, const char* path,
                          uint32_t mode) {
     if (!ftp_path_is_safe(path)) {
-        fp_send_error(fd, rid, "Invalid path", -1);
+        fp_send_error(out, rid, "Invalid path", -1);
         return;
     }
 
@@ -725,9 +725,9 @@ static void handle_chmod(ftp_conn_t* c, int fd, uint32_t rid, const char* path,
 
     CURLcode rc = ftp_command(c, cmd, NULL);
     if (rc != CURLE_OK)
-        ftp_send_curl_error(c, fd, rid, rc);
+        ftp_send_curl_error(c, out, rid, rc);
     else
-        fp_send_ok(fd, rid);
+        fp_send_ok(out, rid);
 }
 
 static bool ftp_parse_pwd_reply(const char* replies, char* out, size_t out_sz) {
@@ -759,18 +759,18 @@ static bool ftp_get_cwd(ftp_conn_t* c, char* out, size_t out_sz) {
     return ok;
 }
 
-static void handle_realpath(ftp_conn_t* c, int fd, uint32_t rid, const char* path) {
+static void handle_realpath(ftp_conn_t* c, fp_out_t out, uint32_t rid, const char* path) {
     char resolved[FP_MAX_PATH];
 
     if (!path || !*path || strcmp(path, ".") == 0 || strcmp(path, "~") == 0) {
         if (!ftp_get_cwd(c, resolved, sizeof(resolved)))
             snprintf(resolved, sizeof(resolved), "/");
-        fp_send_realpath(fd, rid, resolved, true);
+        fp_send_realpath(out, rid, resolved, true);
         return;
     }
 
     ftp_normalize_path(path, resolved, sizeof(resolved));
-    fp_send_realpath(fd, rid, resolved, ftp_is_dir(c, resolved));
+    fp_send_realpath(out, rid, resolved, ftp_is_dir(c, resolved));
 }
 
 static bool ftp_get_size(ftp_conn_t* c, const char* path, uint64_t* out_size) {
@@ -793,7 +793,7 @@ static bool ftp_get_size(ftp_conn_t* c, const char* path, uint64_t* out_size) {
 }
 
 typedef struct {
-    int fd;
+    fp_out_t out;
     uint32_t rid;
     uint64_t total;
     uint8_t* buf;
@@ -803,7 +803,7 @@ typedef struct {
 
 static bool ftp_download_flush(ftp_download_t* d) {
     if (d->len == 0) return true;
-    if (fp_send_file_data(d->fd, d->rid, d->buf, d->len, d->total) != 0) {
+    if (fp_send_file_data(d->out, d->rid, d->buf, d->len, d->total) != 0) {
         d->failed = true;
         return false;
     }
@@ -829,20 +829,20 @@ static size_t ftp_download_cb(void* contents, size_t size, size_t nmemb, void* u
     return total;
 }
 
-static void handle_read_file(ftp_conn_t* c, int fd, uint32_t rid, const char* path) {
+static void handle_read_file(ftp_conn_t* c, fp_out_t out, uint32_t rid, const char* path) {
     char url[FTP_URL_MAX];
     if (!ftp_build_url(c, path, false, url, sizeof(url))) {
-        fp_send_error(fd, rid, "Invalid path", -1);
+        fp_send_error(out, rid, "Invalid path", -1);
         return;
     }
 
     ftp_download_t dl;
     memset(&dl, 0, sizeof(dl));
-    dl.fd = fd;
+    dl.out = out;
     dl.rid = rid;
     dl.buf = malloc(FP_CHUNK_SIZE);
     if (!dl.buf) {
-        fp_send_error(fd, rid, "Out of memory", -1);
+        fp_send_error(out, rid, "Out of memory", -1);
         return;
     }
     ftp_get_size(c, path, &dl.total);
@@ -855,7 +855,7 @@ static void handle_read_file(ftp_conn_t* c, int fd, uint32_t rid, const char* pa
     CURLcode rc = curl_easy_perform(c->curl);
 
     if (rc != CURLE_OK) {
-        if (!dl.failed) ftp_send_curl_error(c, fd, rid, rc);
+        if (!dl.failed) ftp_send_curl_error(c, out, rid, rc);
         free(dl.buf);
         return;
     }
@@ -866,14 +866,14 @@ static void handle_read_file(ftp_conn_t* c, int fd, uint32_t rid, const char* pa
     }
 
     free(dl.buf);
-    fp_send_file_end(fd, rid);
+    fp_send_file_end(out, rid);
 }
 
-static void handle_thumbnail(ftp_conn_t* c, int fd, uint32_t rid, const char* path,
+static void handle_thumbnail(ftp_conn_t* c, fp_out_t out, uint32_t rid, const char* path,
                              uint32_t size) {
     char url[FTP_URL_MAX];
     if (!ftp_build_url(c, path, false, url, sizeof(url))) {
-        fp_send_error(fd, rid, "Invalid path", -1);
+        fp_send_error(out, rid, "Invalid path", -1);
         return;
     }
 
@@ -888,15 +888,15 @@ static void handle_thumbnail(ftp_conn_t* c, int fd, uint32_t rid, const char* pa
     CURLcode rc = curl_easy_perform(c->curl);
     if (rc != CURLE_OK) {
         if (buf.overflow)
-            fp_send_error(fd, rid, "Image too large for thumbnail", -1);
+            fp_send_error(out, rid, "Image too large for thumbnail", -1);
         else
-            ftp_send_curl_error(c, fd, rid, rc);
+            ftp_send_curl_error(c, out, rid, rc);
         ftp_buf_free(&buf);
         return;
     }
 
     if (buf.len == 0) {
-        fp_send_error(fd, rid, "Failed to generate thumbnail", -1);
+        fp_send_error(out, rid, "Failed to generate thumbnail", -1);
         ftp_buf_free(&buf);
         return;
     }
@@ -906,17 +906,17 @@ static void handle_thumbnail(ftp_conn_t* c, int fd, uint32_t rid, const char* pa
     int ow = 0, oh = 0;
     if (nexterm_make_thumbnail((const uint8_t*)buf.data, buf.len, (int)size,
                                &jpeg, &jpeg_len, &ow, &oh) != 0) {
-        fp_send_error(fd, rid, "Failed to generate thumbnail", -1);
+        fp_send_error(out, rid, "Failed to generate thumbnail", -1);
         ftp_buf_free(&buf);
         return;
     }
     ftp_buf_free(&buf);
 
-    fp_send_thumbnail(fd, rid, jpeg, jpeg_len, (uint32_t)ow, (uint32_t)oh);
+    fp_send_thumbnail(out, rid, jpeg, jpeg_len, (uint32_t)ow, (uint32_t)oh);
     free(jpeg);
 }
 
-static void handle_search_dirs(ftp_conn_t* c, int fd, uint32_t rid,
+static void handle_search_dirs(ftp_conn_t* c, fp_out_t out, uint32_t rid,
                                const char* search_path, uint32_t max_results,
                                uint32_t timeout_ms) {
     if (max_results == 0 || max_results > FP_SEARCH_MAX)
@@ -956,7 +956,7 @@ static void handle_search_dirs(ftp_conn_t* c, int fd, uint32_t rid,
         LOG_WARN("FTP: search timed out after %u ms, returning %d partial result(s)",
                  timeout_ms, ctx.count);
 
-    fp_send_search_result(fd, rid, &ctx);
+    fp_send_search_result(out, rid, &ctx);
 }
 
 typedef struct {
@@ -1040,17 +1040,17 @@ static void ftp_upload_abort(ftp_upload_t* up) {
     ftp_upload_dispose(up);
 }
 
-static ftp_upload_t* handle_write_begin(ftp_conn_t* c, int fd, uint32_t rid,
+static ftp_upload_t* handle_write_begin(ftp_conn_t* c, fp_out_t out, uint32_t rid,
                                         const char* path) {
     char url[FTP_URL_MAX];
     if (!ftp_build_url(c, path, false, url, sizeof(url))) {
-        fp_send_error(fd, rid, "Invalid path", -1);
+        fp_send_error(out, rid, "Invalid path", -1);
         return NULL;
     }
 
     ftp_upload_t* up = calloc(1, sizeof(ftp_upload_t));
     if (!up) {
-        fp_send_error(fd, rid, "Out of memory", -1);
+        fp_send_error(out, rid, "Out of memory", -1);
         return NULL;
     }
 
@@ -1060,7 +1060,7 @@ static ftp_upload_t* handle_write_begin(ftp_conn_t* c, int fd, uint32_t rid,
         free(up->buf);
         if (up->curl) curl_easy_cleanup(up->curl);
         free(up);
-        fp_send_error(fd, rid, "Out of memory", -1);
+        fp_send_error(out, rid, "Out of memory", -1);
         return NULL;
     }
 
@@ -1079,12 +1079,12 @@ static ftp_upload_t* handle_write_begin(ftp_conn_t* c, int fd, uint32_t rid,
     if (pthread_create(&up->thread, NULL, ftp_upload_thread, up) != 0) {
         ftp_upload_dispose(up);
         free(up);
-        fp_send_error(fd, rid, "Failed to start upload", -1);
+        fp_send_error(out, rid, "Failed to start upload", -1);
         return NULL;
     }
 
     up->active = true;
-    fp_send_ok(fd, rid);
+    fp_send_ok(out, rid);
     return up;
 }
 
@@ -1116,7 +1116,7 @@ static int ftp_upload_push(ftp_upload_t* up, const uint8_t* data, size_t len) {
     return rc;
 }
 
-static void handle_write_end(ftp_upload_t* up, int fd) {
+static void handle_write_end(ftp_upload_t* up, fp_out_t out) {
     pthread_mutex_lock(&up->mutex);
     up->eof = true;
     pthread_cond_broadcast(&up->cond);
@@ -1132,9 +1132,9 @@ static void handle_write_end(ftp_upload_t* up, int fd) {
     ftp_upload_dispose(up);
 
     if (failed)
-        fp_send_error(fd, rid, error[0] ? error : "Upload failed", -1);
+        fp_send_error(out, rid, error[0] ? error : "Upload failed", -1);
     else
-        fp_send_ok(fd, rid);
+        fp_send_ok(out, rid);
 }
 
 static const char* extract_path_req(Nexterm_SftpProtocol_SftpMessage_table_t msg) {
@@ -1143,35 +1143,35 @@ static const char* extract_path_req(Nexterm_SftpProtocol_SftpMessage_table_t msg
 }
 
 static void dispatch_path_op(Nexterm_SftpProtocol_SftpMsgType_enum_t mt,
-                             ftp_conn_t* c, int data_fd, uint32_t rid,
+                             ftp_conn_t* c, fp_out_t out, uint32_t rid,
                              Nexterm_SftpProtocol_SftpMessage_table_t msg) {
     const char* path = extract_path_req(msg);
-    if (!path) { fp_send_error(data_fd, rid, "Missing path", -1); return; }
+    if (!path) { fp_send_error(out, rid, "Missing path", -1); return; }
 
     switch (mt) {
         case Nexterm_SftpProtocol_SftpMsgType_ListDir:
-            handle_list_dir(c, data_fd, rid, path); return;
+            handle_list_dir(c, out, rid, path); return;
         case Nexterm_SftpProtocol_SftpMsgType_Stat:
-            handle_stat(c, data_fd, rid, path); return;
+            handle_stat(c, out, rid, path); return;
         case Nexterm_SftpProtocol_SftpMsgType_Mkdir:
-            handle_simple_command(c, data_fd, rid, "MKD", path); return;
+            handle_simple_command(c, out, rid, "MKD", path); return;
         case Nexterm_SftpProtocol_SftpMsgType_Unlink:
-            handle_simple_command(c, data_fd, rid, "DELE", path); return;
+            handle_simple_command(c, out, rid, "DELE", path); return;
         case Nexterm_SftpProtocol_SftpMsgType_Realpath:
-            handle_realpath(c, data_fd, rid, path); return;
+            handle_realpath(c, out, rid, path); return;
         case Nexterm_SftpProtocol_SftpMsgType_ReadFile:
-            handle_read_file(c, data_fd, rid, path); return;
+            handle_read_file(c, out, rid, path); return;
         default: return;
     }
 }
 
 static void dispatch_write_op(Nexterm_SftpProtocol_SftpMsgType_enum_t mt,
-                              ftp_conn_t* c, int data_fd, uint32_t rid,
+                              ftp_conn_t* c, fp_out_t out, uint32_t rid,
                               Nexterm_SftpProtocol_SftpMessage_table_t msg,
                               ftp_upload_t** upload) {
     if (mt == Nexterm_SftpProtocol_SftpMsgType_WriteData) {
         if (!*upload) {
-            fp_send_error(data_fd, rid, "No write in progress", -1);
+            fp_send_error(out, rid, "No write in progress", -1);
             return;
         }
 
@@ -1189,7 +1189,7 @@ static void dispatch_write_op(Nexterm_SftpProtocol_SftpMsgType_enum_t mt,
 
     if (mt == Nexterm_SftpProtocol_SftpMsgType_WriteEnd) {
         if (*upload) {
-            handle_write_end(*upload, data_fd);
+            handle_write_end(*upload, out);
             free(*upload);
             *upload = NULL;
         }
@@ -1205,59 +1205,59 @@ static void dispatch_write_op(Nexterm_SftpProtocol_SftpMsgType_enum_t mt,
     Nexterm_SftpProtocol_WriteBeginReq_table_t req =
         Nexterm_SftpProtocol_SftpMessage_write_begin_req(msg);
     const char* path = req ? Nexterm_SftpProtocol_WriteBeginReq_path(req) : NULL;
-    if (!path) { fp_send_error(data_fd, rid, "Missing path", -1); return; }
+    if (!path) { fp_send_error(out, rid, "Missing path", -1); return; }
 
-    *upload = handle_write_begin(c, data_fd, rid, path);
+    *upload = handle_write_begin(c, out, rid, path);
 }
 
-static void dispatch_rmdir(ftp_conn_t* c, int data_fd, uint32_t rid,
+static void dispatch_rmdir(ftp_conn_t* c, fp_out_t out, uint32_t rid,
                            Nexterm_SftpProtocol_SftpMessage_table_t msg) {
     Nexterm_SftpProtocol_RmdirReq_table_t req = Nexterm_SftpProtocol_SftpMessage_rmdir_req(msg);
     const char* path = req ? Nexterm_SftpProtocol_RmdirReq_path(req) : NULL;
     bool rec = req ? Nexterm_SftpProtocol_RmdirReq_recursive(req) : false;
-    if (!path) { fp_send_error(data_fd, rid, "Missing path", -1); return; }
-    handle_rmdir(c, data_fd, rid, path, rec);
+    if (!path) { fp_send_error(out, rid, "Missing path", -1); return; }
+    handle_rmdir(c, out, rid, path, rec);
 }
 
-static void dispatch_rename(ftp_conn_t* c, int data_fd, uint32_t rid,
+static void dispatch_rename(ftp_conn_t* c, fp_out_t out, uint32_t rid,
                             Nexterm_SftpProtocol_SftpMessage_table_t msg) {
     Nexterm_SftpProtocol_RenameReq_table_t req = Nexterm_SftpProtocol_SftpMessage_rename_req(msg);
     const char* old_path = req ? Nexterm_SftpProtocol_RenameReq_old_path(req) : NULL;
     const char* new_path = req ? Nexterm_SftpProtocol_RenameReq_new_path(req) : NULL;
-    if (!old_path || !new_path) { fp_send_error(data_fd, rid, "Missing paths", -1); return; }
-    handle_rename(c, data_fd, rid, old_path, new_path);
+    if (!old_path || !new_path) { fp_send_error(out, rid, "Missing paths", -1); return; }
+    handle_rename(c, out, rid, old_path, new_path);
 }
 
-static void dispatch_chmod(ftp_conn_t* c, int data_fd, uint32_t rid,
+static void dispatch_chmod(ftp_conn_t* c, fp_out_t out, uint32_t rid,
                            Nexterm_SftpProtocol_SftpMessage_table_t msg) {
     Nexterm_SftpProtocol_ChmodReq_table_t req = Nexterm_SftpProtocol_SftpMessage_chmod_req(msg);
     const char* path = req ? Nexterm_SftpProtocol_ChmodReq_path(req) : NULL;
     uint32_t mode = req ? Nexterm_SftpProtocol_ChmodReq_mode(req) : 0;
-    if (!path) { fp_send_error(data_fd, rid, "Missing path", -1); return; }
-    handle_chmod(c, data_fd, rid, path, mode);
+    if (!path) { fp_send_error(out, rid, "Missing path", -1); return; }
+    handle_chmod(c, out, rid, path, mode);
 }
 
-static void dispatch_search(ftp_conn_t* c, int data_fd, uint32_t rid,
+static void dispatch_search(ftp_conn_t* c, fp_out_t out, uint32_t rid,
                             Nexterm_SftpProtocol_SftpMessage_table_t msg) {
     Nexterm_SftpProtocol_SearchReq_table_t req = Nexterm_SftpProtocol_SftpMessage_search_req(msg);
     const char* sp = req ? Nexterm_SftpProtocol_SearchReq_search_path(req) : NULL;
     uint32_t max = req ? Nexterm_SftpProtocol_SearchReq_max_results(req) : FP_SEARCH_MAX;
     uint32_t timeout_ms = req ? Nexterm_SftpProtocol_SearchReq_timeout_ms(req) : 0;
-    if (!sp) { fp_send_error(data_fd, rid, "Missing search path", -1); return; }
+    if (!sp) { fp_send_error(out, rid, "Missing search path", -1); return; }
     if (timeout_ms == 0) timeout_ms = 30000;
-    handle_search_dirs(c, data_fd, rid, sp, max, timeout_ms);
+    handle_search_dirs(c, out, rid, sp, max, timeout_ms);
 }
 
-static void dispatch_thumbnail(ftp_conn_t* c, int data_fd, uint32_t rid,
+static void dispatch_thumbnail(ftp_conn_t* c, fp_out_t out, uint32_t rid,
                                Nexterm_SftpProtocol_SftpMessage_table_t msg) {
     Nexterm_SftpProtocol_ThumbnailReq_table_t req = Nexterm_SftpProtocol_SftpMessage_thumbnail_req(msg);
     const char* path = req ? Nexterm_SftpProtocol_ThumbnailReq_path(req) : NULL;
     uint32_t size = req ? Nexterm_SftpProtocol_ThumbnailReq_size(req) : 100;
-    if (!path) { fp_send_error(data_fd, rid, "Missing path", -1); return; }
-    handle_thumbnail(c, data_fd, rid, path, size);
+    if (!path) { fp_send_error(out, rid, "Missing path", -1); return; }
+    handle_thumbnail(c, out, rid, path, size);
 }
 
-static void ftp_dispatch_message(ftp_conn_t* c, int data_fd,
+static void ftp_dispatch_message(ftp_conn_t* c, fp_out_t out,
                                  Nexterm_SftpProtocol_SftpMessage_table_t msg,
                                  ftp_upload_t** upload) {
     Nexterm_SftpProtocol_SftpMsgType_enum_t mt =
@@ -1271,50 +1271,50 @@ static void ftp_dispatch_message(ftp_conn_t* c, int data_fd,
         case Nexterm_SftpProtocol_SftpMsgType_Unlink:
         case Nexterm_SftpProtocol_SftpMsgType_Realpath:
         case Nexterm_SftpProtocol_SftpMsgType_ReadFile:
-            dispatch_path_op(mt, c, data_fd, rid, msg);
+            dispatch_path_op(mt, c, out, rid, msg);
             return;
 
         case Nexterm_SftpProtocol_SftpMsgType_WriteBegin:
         case Nexterm_SftpProtocol_SftpMsgType_WriteData:
         case Nexterm_SftpProtocol_SftpMsgType_WriteEnd:
-            dispatch_write_op(mt, c, data_fd, rid, msg, upload);
+            dispatch_write_op(mt, c, out, rid, msg, upload);
             return;
 
         case Nexterm_SftpProtocol_SftpMsgType_Rmdir:
-            dispatch_rmdir(c, data_fd, rid, msg); return;
+            dispatch_rmdir(c, out, rid, msg); return;
         case Nexterm_SftpProtocol_SftpMsgType_Rename:
-            dispatch_rename(c, data_fd, rid, msg); return;
+            dispatch_rename(c, out, rid, msg); return;
         case Nexterm_SftpProtocol_SftpMsgType_Chmod:
-            dispatch_chmod(c, data_fd, rid, msg); return;
+            dispatch_chmod(c, out, rid, msg); return;
         case Nexterm_SftpProtocol_SftpMsgType_SearchDirs:
-            dispatch_search(c, data_fd, rid, msg); return;
+            dispatch_search(c, out, rid, msg); return;
         case Nexterm_SftpProtocol_SftpMsgType_Thumbnail:
-            dispatch_thumbnail(c, data_fd, rid, msg); return;
+            dispatch_thumbnail(c, out, rid, msg); return;
 
         case Nexterm_SftpProtocol_SftpMsgType_Exec:
-            fp_send_exec_result(data_fd, rid, "",
+            fp_send_exec_result(out, rid, "",
                                 "Command execution is not available over FTP", 127);
             return;
 
         default:
             LOG_WARN("FTP: unknown msg_type %d", mt);
-            fp_send_error(data_fd, rid, "Unknown operation", -1);
+            fp_send_error(out, rid, "Unknown operation", -1);
             return;
     }
 }
 
-static void ftp_request_loop(nexterm_session_t* session, ftp_conn_t* c, int data_fd) {
+static void ftp_request_loop(nexterm_session_t* session, ftp_conn_t* c, fp_out_t out) {
     ftp_upload_t* upload = NULL;
 
     while (session->state == SESSION_STATE_ACTIVE) {
-        struct pollfd pfd = { .fd = data_fd, .events = POLLIN, .revents = 0 };
+        struct pollfd pfd = { .fd = out.fd, .events = POLLIN, .revents = 0 };
         int ret = poll(&pfd, 1, 1000);
         if (ret == 0) continue;
         if (ret < 0) { if (errno == EINTR) continue; break; }
         if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) break;
 
         uint32_t payload_len;
-        uint8_t* payload = nexterm_read_frame(data_fd, FP_MAX_FRAME, &payload_len);
+        uint8_t* payload = nexterm_read_frame(out.fd, FP_MAX_FRAME, &payload_len);
         if (!payload) {
             LOG_DEBUG("FTP session %s: connection closed or read error",
                       session->session_id);
@@ -1329,7 +1329,7 @@ static void ftp_request_loop(nexterm_session_t* session, ftp_conn_t* c, int data
             continue;
         }
 
-        ftp_dispatch_message(c, data_fd, msg, &upload);
+        ftp_dispatch_message(c, out, msg, &upload);
         free(payload);
     }
 
@@ -1414,7 +1414,9 @@ static void* ftp_session_thread(void* arg) {
     session->state = SESSION_STATE_ACTIVE;
     nexterm_cp_send_session_result(cp, session->session_id, true, NULL, NULL);
 
-    if (fp_send_ready(data_fd) != 0) {
+    /* Only this thread writes to the data connection */
+    fp_out_t out = { .fd = data_fd, .lock = NULL };
+    if (fp_send_ready(out) != 0) {
         LOG_ERROR("FTP session %s: failed to send Ready", session->session_id);
         goto cleanup;
     }
@@ -1422,7 +1424,7 @@ static void* ftp_session_thread(void* arg) {
     LOG_INFO("FTP session %s active (target=%s:%u, user=%s, cwd=%.256s)",
              session->session_id, session->host, session->port, username, cwd);
 
-    ftp_request_loop(session, &conn, data_fd);
+    ftp_request_loop(session, &conn, out);
 
     LOG_INFO("FTP session %s ending", session->session_id);
 
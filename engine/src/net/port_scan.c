@@ -0,0 +1,413 @@
+#include "port_scan.h"
+
+#include <stdio.h>
+
+#include "log.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PORT_SCAN_PIPE_TOKEN UINT64_MAX
+
+typedef enum {
+    SCAN_QUEUED,
+    SCAN_RESOLVING,
+    SCAN_CONNECTING,
+    SCAN_DONE,
+} scan_state_t;
+
+typedef struct {
+    char* host;
+    char port[8];
+    scan_state_t state;
+    int fd;
+    int64_t deadline;
+    int gai_rc;
+    struct addrinfo* res;
+    struct addrinfo* next_ai;
+} scan_target_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int refs;
+    bool stop;
+    size_t* queue;
+    size_t qhead;
+    size_t qtail;
+    scan_target_t* targets;
+    size_t count;
+    int pipe_rd;
+    int pipe_wr;
+} scan_shared_t;
+
+static int64_t scan_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void scan_unref(scan_shared_t* sh) {
+    pthread_mutex_lock(&sh->lock);
+    bool last = --sh->refs == 0;
+    pthread_mutex_unlock(&sh->lock);
+    if (!last) return;
+
+    for (size_t i = 0; i < sh->count; i++) {
+        if (sh->targets[i].res) freeaddrinfo(sh->targets[i].res);
+        free(sh->targets[i].host);
+    }
+    if (sh->pipe_wr >= 0) close(sh->pipe_wr);
+    pthread_cond_destroy(&sh->cond);
+    pthread_mutex_destroy(&sh->lock);
+    free(sh->targets);
+    free(sh->queue);
+    free(sh);
+}
+
+static void* scan_resolver_thread(void* arg) {
+    scan_shared_t* sh = arg;
+    struct addrinfo hints = {0};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    pthread_mutex_lock(&sh->lock);
+    for (;;) {
+        while (!sh->stop && sh->qhead == sh->qtail)
+            pthread_cond_wait(&sh->cond, &sh->lock);
+        if (sh->stop) break;
+
+        size_t idx = sh->queue[sh->qhead++];
+        scan_target_t* t = &sh->targets[idx];
+        pthread_mutex_unlock(&sh->lock);
+
+        struct addrinfo* res = NULL;
+        int rc = getaddrinfo(t->host, t->port, &hints, &res);
+
+        pthread_mutex_lock(&sh->lock);
+        if (sh->stop) {
+            if (res) freeaddrinfo(res);
+            break;
+        }
+        t->gai_rc = rc;
+        t->res = res;
+        uint64_t token = idx;
+        ssize_t w;
+        do {
+            w = write(sh->pipe_wr, &token, sizeof(token));
+        } while (w < 0 && errno == EINTR);
+    }
+    pthread_mutex_unlock(&sh->lock);
+
+    scan_unref(sh);
+    return NULL;
+}
+
+static bool scan_is_numeric(const char* host) {
+    unsigned char buf[sizeof(struct in6_addr)];
+    return inet_pton(AF_INET, host, buf) == 1 || inet_pton(AF_INET6, host, buf) == 1;
+}
+
+typedef struct {
+    scan_shared_t* sh;
+    int epfd;
+    size_t inflight;
+    size_t done;
+    nexterm_port_scan_cb on_result;
+    void* ctx;
+} scan_run_t;
+
+static void scan_finish(scan_run_t* r, size_t idx, bool online) {
+    scan_target_t* t = &r->sh->targets[idx];
+    if (t->fd >= 0) {
+        close(t->fd);
+        t->fd = -1;
+    }
+    if (t->state != SCAN_RESOLVING && t->res) {
+        freeaddrinfo(t->res);
+        t->res = NULL;
+    }
+    t->state = SCAN_DONE;
+    r->inflight--;
+    r->done++;
+    r->on_result(r->ctx, idx, online);
+}
+
+static void scan_connect_next(scan_run_t* r, size_t idx) {
+    scan_target_t* t = &r->sh->targets[idx];
+
+    while (t->next_ai) {
+        struct addrinfo* ai = t->next_ai;
+        t->next_ai = ai->ai_next;
+
+        int fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                        ai->ai_protocol);
+        if (fd < 0) continue;
+
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            t->fd = fd;
+            scan_finish(r, idx, true);
+            return;
+        }
+        if (errno != EINPROGRESS) {
+            close(fd);
+            continue;
+        }
+
+        struct epoll_event ev = { .events = EPOLLOUT, .data.u64 = idx };
+        if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            close(fd);
+            continue;
+        }
+        t->fd = fd;
+        t->state = SCAN_CONNECTING;
+        return;
+    }
+
+    scan_finish(r, idx, false);
+}
+
+static void scan_admit(scan_run_t* r, size_t idx, uint32_t timeout_ms) {
+    scan_shared_t* sh = r->sh;
+    scan_target_t* t = &sh->targets[idx];
+
+    r->inflight++;
+    t->deadline = scan_now_ms() + timeout_ms;
+
+    if (!t->host || !t->host[0]) {
+        scan_finish(r, idx, false);
+        return;
+    }
+
+    if (scan_is_numeric(t->host)) {
+        struct addrinfo hints = {0};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+        if (getaddrinfo(t->host, t->port, &hints, &t->res) != 0 || !t->res) {
+            scan_finish(r, idx, false);
+            return;
+        }
+        t->next_ai = t->res;
+        scan_connect_next(r, idx);
+        return;
+    }
+
+    t->state = SCAN_RESOLVING;
+    pthread_mutex_lock(&sh->lock);
+    sh->queue[sh->qtail++] = idx;
+    pthread_cond_signal(&sh->cond);
+    pthread_mutex_unlock(&sh->lock);
+}
+
+static void scan_drain_resolved(scan_run_t* r) {
+    scan_shared_t* sh = r->sh;
+    uint64_t tokens[64];
+
+    for (;;) {
+        ssize_t n = read(sh->pipe_rd, tokens, sizeof(tokens));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return;
+
+        for (size_t k = 0; k < (size_t)n / sizeof(uint64_t); k++) {
+            size_t idx = (size_t)tokens[k];
+            scan_target_t* t = &sh->targets[idx];
+            if (t->state != SCAN_RESOLVING) continue;
+
+            pthread_mutex_lock(&sh->lock);
+            int rc = t->gai_rc;
+            pthread_mutex_unlock(&sh->lock);
+
+            if (rc != 0 || !t->res) {
+                scan_finish(r, idx, false);
+                continue;
+            }
+            t->next_ai = t->res;
+            scan_connect_next(r, idx);
+        }
+    }
+}
+
+static void scan_check_connect(scan_run_t* r, size_t idx) {
+    scan_target_t* t = &r->sh->targets[idx];
+    if (t->state != SCAN_CONNECTING) return;
+
+    int err = 0;
+    socklen_t len = sizeof(err);
+    getsockopt(t->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+    if (err == 0) {
+        scan_finish(r, idx, true);
+        return;
+    }
+
+    close(t->fd);
+    t->fd = -1;
+    if (scan_now_ms() < t->deadline)
+        scan_connect_next(r, idx);
+    else
+        scan_finish(r, idx, false);
+}
+
+static int scan_next_timeout(scan_run_t* r, size_t admitted, bool* expired) {
+    int64_t now = scan_now_ms();
+    int64_t earliest = -1;
+    *expired = false;
+
+    for (size_t i = 0; i < admitted; i++) {
+        scan_target_t* t = &r->sh->targets[i];
+        if (t->state == SCAN_DONE) continue;
+        if (t->deadline <= now) {
+            *expired = true;
+            return 0;
+        }
+        if (earliest < 0 || t->deadline < earliest) earliest = t->deadline;
+    }
+    return earliest < 0 ? -1 : (int)(earliest - now);
+}
+
+static int scan_setup(scan_shared_t* sh, const nexterm_port_target_t* targets,
+                      size_t count) {
+    sh->refs = 1;
+    sh->pipe_rd = -1;
+    sh->pipe_wr = -1;
+    sh->count = count;
+    pthread_mutex_init(&sh->lock, NULL);
+    pthread_cond_init(&sh->cond, NULL);
+
+    sh->targets = calloc(count, sizeof(scan_target_t));
+    sh->queue = calloc(count, sizeof(size_t));
+    if (!sh->targets || !sh->queue) return -1;
+
+    for (size_t i = 0; i < count; i++) {
+        scan_target_t* t = &sh->targets[i];
+        t->fd = -1;
+        t->host = strdup(targets[i].host ? targets[i].host : "");
+        if (!t->host) return -1;
+        snprintf(t->port, sizeof(t->port), "%u", targets[i].port);
+    }
+
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) return -1;
+    sh->pipe_rd = fds[0];
+    sh->pipe_wr = fds[1];
+    fcntl(sh->pipe_rd, F_SETFL, fcntl(sh->pipe_rd, F_GETFL, 0) | O_NONBLOCK);
+    return 0;
+}
+
+int nexterm_port_scan(const nexterm_port_target_t* targets, size_t count,
+                      uint32_t timeout_ms, int concurrency,
+                      nexterm_port_scan_cb on_result,
+                      nexterm_port_scan_tick_cb on_tick, int tick_ms, void* ctx) {
+    if (count == 0) return 0;
+    if (concurrency <= 0) concurrency = PORT_SCAN_DEFAULT_CONCURRENCY;
+    if (concurrency > PORT_SCAN_MAX_CONCURRENCY) concurrency = PORT_SCAN_MAX_CONCURRENCY;
+
+    scan_shared_t* sh = calloc(1, sizeof(scan_shared_t));
+    if (!sh) return -1;
+    if (scan_setup(sh, targets, count) != 0) {
+        if (sh->pipe_rd >= 0) close(sh->pipe_rd);
+        scan_unref(sh);
+        return -1;
+    }
+
+    scan_run_t r = { .sh = sh, .on_result = on_result, .ctx = ctx };
+    r.epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (r.epfd < 0) {
+        close(sh->pipe_rd);
+        scan_unref(sh);
+        return -1;
+    }
+    struct epoll_event pev = { .events = EPOLLIN, .data.u64 = PORT_SCAN_PIPE_TOKEN };
+    epoll_ctl(r.epfd, EPOLL_CTL_ADD, sh->pipe_rd, &pev);
+
+    size_t resolvers = count < PORT_SCAN_RESOLVERS ? count : PORT_SCAN_RESOLVERS;
+    for (size_t i = 0; i < resolvers; i++) {
+        pthread_t thread;
+        pthread_mutex_lock(&sh->lock);
+        sh->refs++;
+        pthread_mutex_unlock(&sh->lock);
+        if (pthread_create(&thread, NULL, scan_resolver_thread, sh) != 0) {
+            pthread_mutex_lock(&sh->lock);
+            sh->refs--;
+            pthread_mutex_unlock(&sh->lock);
+            break;
+        }
+        pthread_detach(thread);
+    }
+
+    size_t admitted = 0;
+    struct epoll_event events[64];
+    if (tick_ms <= 0) on_tick = NULL;
+    int64_t next_tick = on_tick ? scan_now_ms() + tick_ms : 0;
+
+    while (r.done < count) {
+        while (admitted < count && r.inflight < (size_t)concurrency) {
+            scan_admit(&r, admitted, timeout_ms);
+            admitted++;
+        }
+        if (r.done >= count) break;
+
+        bool expired;
+        int wait_ms = scan_next_timeout(&r, admitted, &expired);
+        if (expired) {
+            int64_t now = scan_now_ms();
+            for (size_t i = 0; i < admitted; i++) {
+                scan_target_t* t = &sh->targets[i];
+                if (t->state != SCAN_DONE && t->deadline <= now)
+                    scan_finish(&r, i, false);
+            }
+            continue;
+        }
+
+        if (on_tick) {
+            int64_t now = scan_now_ms();
+            if (now >= next_tick) {
+                on_tick(ctx);
+                next_tick = now + tick_ms;
+            }
+            int until_tick = (int)(next_tick - now);
+            if (wait_ms < 0 || wait_ms > until_tick) wait_ms = until_tick;
+        }
+
+        int n = epoll_wait(r.epfd, events, 64, wait_ms);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            LOG_ERROR("Port scan: epoll_wait failed: %s", strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.u64 == PORT_SCAN_PIPE_TOKEN)
+                scan_drain_resolved(&r);
+            else
+                scan_check_connect(&r, (size_t)events[i].data.u64);
+        }
+    }
+
+    pthread_mutex_lock(&sh->lock);
+    sh->stop = true;
+    pthread_cond_broadcast(&sh->cond);
+    pthread_mutex_unlock(&sh->lock);
+
+    for (size_t i = 0; i < count; i++) {
+        scan_target_t* t = &sh->targets[i];
+        if (t->state != SCAN_DONE) {
+            if (t->state == SCAN_QUEUED) r.inflight++;
+            scan_finish(&r, i, false);
+        }
+    }
+
+    close(r.epfd);
+    close(sh->pipe_rd);
+    scan_unref(sh);
+    return 0;
+}
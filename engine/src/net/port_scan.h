@@ -0,0 +1,27 @@
+#ifndef NEXTERM_PORT_SCAN_H
+#define NEXTERM_PORT_SCAN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define PORT_SCAN_DEFAULT_CONCURRENCY 256
+#define PORT_SCAN_MAX_CONCURRENCY     1024
+#define PORT_SCAN_RESOLVERS           8
+
+typedef struct {
+    const char* host;
+    uint16_t port;
+} nexterm_port_target_t;
+
+typedef void (*nexterm_port_scan_cb)(void* ctx, size_t index, bool online);
+typedef void (*nexterm_port_scan_tick_cb)(void* ctx);
+
+/* on_tick, if set, runs on the scanning thread at least every tick_ms while
+ * results are outstanding, so callers can flush batched results. */
+int nexterm_port_scan(const nexterm_port_target_t* targets, size_t count,
+                      uint32_t timeout_ms, int concurrency,
+                      nexterm_port_scan_cb on_result,
+                      nexterm_port_scan_tick_cb on_tick, int tick_ms, void* ctx);
+
+#endif
@@ -6,6 +6,7 @@
 #include "io.h"
 #include "log.h"
 #include "thumbnail.h"
+#include "thumb_cache.h"
 
 extern nexterm_session_manager_t g_session_manager;
 
@@ -22,14 +23,109 @@ extern nexterm_session_manager_t g_session_manager;
 #include <string.h>
 #include <unistd.h>
 
-#define SFTP_WRITE_BUF     1048576
+/* Upload flow control is a static credit window: the client may have at
+ * most this many bytes past the last committed offset in flight. Every
+ * committed byte has left the buffer, so the buffer can never overflow and
+ * each WriteAck returns credit through `committed` alone. */
+#define SFTP_WRITE_WINDOW  (4 * 1024 * 1024)
 #define SFTP_EXEC_BUF      (256 * 1024)
+#define SFTP_READ_MIN_FRAME (256 * 1024)
+#define SFTP_NAME_TTL_MS   (5 * 60 * 1000)
+#define SFTP_WORKERS       4
+#define SFTP_QUEUE_MAX     64
+#define SFTP_WORKER_STACK  (1024 * 1024)
+#define SFTP_SHARED_POLL_MS 50
+#define SFTP_ORIGIN_LEN    1024
 
 typedef struct {
     nexterm_session_t* session;
     nexterm_control_plane_t* cp;
 } sftp_thread_args_t;
 
+typedef struct {
+    uint32_t id;
+    char* name;
+} sftp_id_name_t;
+
+typedef struct {
+    sftp_id_name_t* entries;
+    size_t count;
+    size_t cap;
+} sftp_id_map_t;
+
+typedef struct {
+    sftp_id_map_t users;
+    sftp_id_map_t groups;
+    int64_t loaded_at;
+} sftp_names_t;
+
+/* One SSH transport shared by the request loop and the workers. libssh2 is
+ * not thread-safe, so every call on it runs under a FIFO ticket lock; a long
+ * listing or download yields between calls rather than between requests. */
+typedef struct {
+    LIBSSH2_SESSION* ssh;
+    int sock;
+    pthread_mutex_t mu;
+    pthread_cond_t turn;
+    uint64_t next_ticket;
+    uint64_t serving;
+    pthread_mutex_t names_lock;
+    sftp_names_t names;
+    char origin[SFTP_ORIGIN_LEN];
+    pthread_mutex_t send_lock;
+} sftp_conn_t;
+
+/* A thread's SFTP channel on the shared transport; error state and flow
+ * control windows are per channel, so threads never share one. */
+typedef struct {
+    sftp_conn_t* conn;
+    LIBSSH2_SFTP* sftp;
+} sftp_ctx_t;
+
+static void sftp_conn_lock(sftp_conn_t* c) {
+    pthread_mutex_lock(&c->mu);
+    uint64_t ticket = c->next_ticket++;
+    while (c->serving != ticket)
+        pthread_cond_wait(&c->turn, &c->mu);
+    pthread_mutex_unlock(&c->mu);
+}
+
+static void sftp_conn_unlock(sftp_conn_t* c) {
+    pthread_mutex_lock(&c->mu);
+    c->serving++;
+    pthread_cond_broadcast(&c->turn);
+    pthread_mutex_unlock(&c->mu);
+}
+
+#define SFTP_LOCKED(x, stmt) \
+    do { sftp_conn_lock((x)->conn); stmt; sftp_conn_unlock((x)->conn); } while (0)
+
+static short sftp_poll_events(int dirs) {
+    short events = 0;
+    if (dirs & LIBSSH2_SESSION_BLOCK_INBOUND)  events |= POLLIN;
+    if (dirs & LIBSSH2_SESSION_BLOCK_OUTBOUND) events |= POLLOUT;
+    return events ? events : POLLIN;
+}
+
+/* Waits for the transport without holding it. Another thread's call may
+ * drain the socket on our behalf, so the wait is kept short. */
+static void sftp_conn_wait(sftp_conn_t* c, int dirs, int64_t timeout_ms) {
+    struct pollfd pfd = { .fd = c->sock, .events = sftp_poll_events(dirs) };
+    if (timeout_ms > SFTP_SHARED_POLL_MS) timeout_ms = SFTP_SHARED_POLL_MS;
+    poll(&pfd, 1, (int)(timeout_ms > 0 ? timeout_ms : 0));
+}
+
+/* A non-blocking call that stopped halfway through an outgoing packet must
+ * be finished by that same call before anyone else uses the transport.
+ * Returns true (after waiting for the socket) if the caller should retry. */
+static bool sftp_conn_outbound_wait(sftp_conn_t* c) {
+    if (!(libssh2_session_block_directions(c->ssh) & LIBSSH2_SESSION_BLOCK_OUTBOUND))
+        return false;
+    struct pollfd pfd = { .fd = c->sock, .events = POLLOUT };
+    poll(&pfd, 1, SFTP_SHARED_POLL_MS);
+    return true;
+}
+
 static const char* sftp_strerror(unsigned long err) {
     switch (err) {
         case LIBSSH2_FX_NO_SUCH_FILE:       return "Path does not exist";
@@ -45,9 +141,9 @@ static const char* sftp_strerror(unsigned long err) {
     }
 }
 
-static void send_sftp_error(LIBSSH2_SFTP* sftp, int fd, uint32_t rid) {
+static void send_sftp_error(LIBSSH2_SFTP* sftp, fp_out_t out, uint32_t rid) {
     unsigned long e = libssh2_sftp_last_error(sftp);
-    fp_send_error(fd, rid, sftp_strerror(e), (int32_t)e);
+    fp_send_error(out, rid, sftp_strerror(e), (int32_t)e);
 }
 
 static void append_capped(char* dst, size_t cap, size_t* len,
@@ -59,46 +155,47 @@ static void append_capped(char* dst, size_t cap, size_t* len,
     *len += copy;
 }
 
-static int exec_command(LIBSSH2_SESSION* ssh, const char* cmd,
+static int exec_command(sftp_conn_t* c, const char* cmd,
                         const char* stdin_data,
                         char* out, size_t out_sz,
                         char* err_buf, size_t err_sz,
                         int* exit_code, uint32_t timeout_ms,
                         bool* timed_out) {
-    LIBSSH2_CHANNEL* ch = libssh2_channel_open_session(ssh);
-    if (!ch) return -1;
-
-    if (libssh2_channel_exec(ch, cmd) != 0) {
+    sftp_conn_lock(c);
+    LIBSSH2_CHANNEL* ch = libssh2_channel_open_session(c->ssh);
+    if (ch && libssh2_channel_exec(ch, cmd) != 0) {
         libssh2_channel_free(ch);
-        return -1;
+        ch = NULL;
     }
 
-
-    if (stdin_data && *stdin_data) {
+    if (ch && stdin_data && *stdin_data) {
         size_t total = strlen(stdin_data), written = 0;
         while (written < total) {
             ssize_t n = libssh2_channel_write(ch, stdin_data + written, total - written);
             if (n <= 0) {
                 libssh2_channel_close(ch);
                 libssh2_channel_free(ch);
-                return -1;
+                ch = NULL;
+                break;
             }
             written += (size_t)n;
         }
     }
-    libssh2_channel_send_eof(ch);
+    if (ch) libssh2_channel_send_eof(ch);
+    sftp_conn_unlock(c);
+    if (!ch) return -1;
 
     const int64_t deadline = fp_monotonic_ms() + (int64_t)timeout_ms;
     size_t out_len = 0, err_len = 0;
     char tmp[4096];
     *timed_out = false;
 
-    libssh2_session_set_blocking(ssh, 0);
-
     for (;;) {
         bool got_data = false;
         bool failed = false;
 
+        sftp_conn_lock(c);
+        libssh2_session_set_blocking(c->ssh, 0);
         for (int stream = 0; stream <= 1 && !failed; stream++) {
             for (;;) {
                 ssize_t n = stream
@@ -112,41 +209,50 @@ static int exec_command(LIBSSH2_SESSION* ssh, const char* cmd,
                         append_capped(out, out_sz, &out_len, tmp, (size_t)n);
                     continue;
                 }
+                if (n == LIBSSH2_ERROR_EAGAIN && sftp_conn_outbound_wait(c))
+                    continue;
                 if (n < 0 && n != LIBSSH2_ERROR_EAGAIN && n != LIBSSH2_ERROR_TIMEOUT)
                     failed = true;
                 break;
             }
         }
-
-        if (failed) break;
-        if (libssh2_channel_eof(ch)) break;
-        if (fp_monotonic_ms() >= deadline) {
+        bool eof = libssh2_channel_eof(ch);
+        int dirs = libssh2_session_block_directions(c->ssh);
+        libssh2_session_set_blocking(c->ssh, 1);
+        sftp_conn_unlock(c);
+
+        if (failed || eof) break;
+        int64_t now = fp_monotonic_ms();
+        if (now >= deadline) {
             *timed_out = true;
             break;
         }
-        if (!got_data) usleep(100 * 1000);
+        if (!got_data)
+            sftp_conn_wait(c, dirs, deadline - now);
     }
 
     out[out_len] = '\0';
     err_buf[err_len] = '\0';
 
-    libssh2_session_set_blocking(ssh, 1);
+    sftp_conn_lock(c);
     libssh2_channel_close(ch);
     if (!*timed_out) libssh2_channel_wait_closed(ch);
     *exit_code = *timed_out ? 124 : libssh2_channel_get_exit_status(ch);
     libssh2_channel_free(ch);
+    sftp_conn_unlock(c);
     return 0;
 }
 
 #define SFTP_RMDIR_MAX_DEPTH 64
 
-static int recursive_rmdir_depth(LIBSSH2_SFTP* sftp, const char* path, int depth) {
+static int recursive_rmdir_depth(sftp_ctx_t* x, const char* path, int depth) {
     if (depth > SFTP_RMDIR_MAX_DEPTH) {
         LOG_WARN("SFTP: recursive delete exceeded max depth at %s", path);
         return -1;
     }
 
-    LIBSSH2_SFTP_HANDLE* dir = libssh2_sftp_opendir(sftp, path);
+    LIBSSH2_SFTP_HANDLE* dir;
+    SFTP_LOCKED(x, dir = libssh2_sftp_opendir(x->sftp, path));
     if (!dir) return -1;
 
     char name[512];
@@ -154,30 +260,38 @@ static int recursive_rmdir_depth(LIBSSH2_SFTP* sftp, const char* path, int depth
     LIBSSH2_SFTP_ATTRIBUTES attrs;
     char fullpath[FP_MAX_PATH];
 
-    while (libssh2_sftp_readdir_ex(dir, name, sizeof(name),
-                                    longentry, sizeof(longentry), &attrs) > 0) {
+    for (;;) {
+        int rc;
+        SFTP_LOCKED(x, rc = libssh2_sftp_readdir_ex(dir, name, sizeof(name),
+                                                    longentry, sizeof(longentry), &attrs));
+        if (rc <= 0) break;
         if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
 
         fp_join_path(path, name, fullpath, sizeof(fullpath));
 
         if (longentry[0] == 'd')
-            recursive_rmdir_depth(sftp, fullpath, depth + 1);
+            recursive_rmdir_depth(x, fullpath, depth + 1);
         else
-            libssh2_sftp_unlink(sftp, fullpath);
+            SFTP_LOCKED(x, libssh2_sftp_unlink(x->sftp, fullpath));
     }
 
+    int rc;
+    sftp_conn_lock(x->conn);
     libssh2_sftp_closedir(dir);
-    return libssh2_sftp_rmdir(sftp, path);
+    rc = libssh2_sftp_rmdir(x->sftp, path);
+    sftp_conn_unlock(x->conn);
+    return rc;
 }
 
-static int recursive_rmdir(LIBSSH2_SFTP* sftp, const char* path) {
-    return recursive_rmdir_depth(sftp, path, 0);
+static int recursive_rmdir(sftp_ctx_t* x, const char* path) {
+    return recursive_rmdir_depth(x, path, 0);
 }
 
-static void search_list_level(LIBSSH2_SFTP* sftp, const char* base,
+static void search_list_level(sftp_ctx_t* x, const char* base,
                               const char* search_term, bool inside,
                               fp_search_t* ctx) {
-    LIBSSH2_SFTP_HANDLE* dir = libssh2_sftp_opendir(sftp, base);
+    LIBSSH2_SFTP_HANDLE* dir;
+    SFTP_LOCKED(x, dir = libssh2_sftp_opendir(x->sftp, base));
     if (!dir) return;
 
     char name[512];
@@ -189,8 +303,10 @@ static void search_list_level(LIBSSH2_SFTP* sftp, const char* base,
             ctx->timed_out = true;
             break;
         }
-        if (libssh2_sftp_readdir_ex(dir, name, sizeof(name),
-                                    longentry, sizeof(longentry), &attrs) <= 0)
+        int rc;
+        SFTP_LOCKED(x, rc = libssh2_sftp_readdir_ex(dir, name, sizeof(name),
+                                                    longentry, sizeof(longentry), &attrs));
+        if (rc <= 0)
             break;
         if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
         if (longentry[0] != 'd') continue;
@@ -200,14 +316,15 @@ static void search_list_level(LIBSSH2_SFTP* sftp, const char* base,
         ctx->count++;
     }
 
-    libssh2_sftp_closedir(dir);
+    SFTP_LOCKED(x, libssh2_sftp_closedir(dir));
 }
 
-static void handle_list_dir(LIBSSH2_SFTP* sftp, int fd, uint32_t rid,
+static void handle_list_dir(sftp_ctx_t* x, fp_out_t out, uint32_t rid,
                             const char* path) {
-    LIBSSH2_SFTP_HANDLE* dir = libssh2_sftp_opendir(sftp, path);
+    LIBSSH2_SFTP_HANDLE* dir;
+    SFTP_LOCKED(x, dir = libssh2_sftp_opendir(x->sftp, path));
     if (!dir) {
-        send_sftp_error(sftp, fd, rid);
+        send_sftp_error(x->sftp, out, rid);
         return;
     }
 
@@ -216,8 +333,11 @@ static void handle_list_dir(LIBSSH2_SFTP* sftp, int fd, uint32_t rid,
     char longentry[512];
     LIBSSH2_SFTP_ATTRIBUTES attrs;
 
-    while (libssh2_sftp_readdir_ex(dir, name, sizeof(name),
-                                    longentry, sizeof(longentry), &attrs) > 0) {
+    for (;;) {
+        int rc;
+        SFTP_LOCKED(x, rc = libssh2_sftp_readdir_ex(dir, name, sizeof(name),
+                                                    longentry, sizeof(longentry), &attrs));
+        if (rc <= 0) break;
         if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
 
         fp_entries_push(&entries, name, longentry[0] == 'd', longentry[0] == 'l',
@@ -225,71 +345,137 @@ static void handle_list_dir(LIBSSH2_SFTP* sftp, int fd, uint32_t rid,
                         (uint32_t)attrs.permissions);
     }
 
-    libssh2_sftp_closedir(dir);
+    SFTP_LOCKED(x, libssh2_sftp_closedir(dir));
 
-    fp_send_dir_list(fd, rid, &entries);
+    fp_send_dir_list(out, rid, &entries);
     fp_entries_free(&entries);
 }
 
-static void shell_escape_path(const char* path, char* escaped, size_t escaped_sz) {
-    if (escaped_sz < 6) {
-        escaped[0] = '\0';
-        return;
+static sftp_id_name_t* id_map_find(sftp_id_map_t* map, uint32_t id) {
+    size_t lo = 0, hi = map->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (map->entries[mid].id == id) return &map->entries[mid];
+        if (map->entries[mid].id < id) lo = mid + 1;
+        else hi = mid;
     }
-    size_t ei = 0;
-    size_t pi = 0;
-    size_t path_len = strlen(path);
-    escaped[ei++] = '\'';
-    while (pi < path_len && ei + 5 < escaped_sz) {
-        if (path[pi] == '\'') {
-            escaped[ei++] = '\'';
-            escaped[ei++] = '\\';
-            escaped[ei++] = '\'';
-            escaped[ei++] = '\'';
-        } else {
-            escaped[ei++] = path[pi];
-        }
-        pi++;
-    }
-    escaped[ei++] = '\'';
-    escaped[ei] = '\0';
+    return NULL;
 }
 
-static void stat_get_owner_group(LIBSSH2_SESSION* ssh, const char* path,
-                                  char* owner, size_t owner_sz,
-                                  char* group, size_t group_sz) {
-    owner[0] = '\0';
-    group[0] = '\0';
+static void id_map_put(sftp_id_map_t* map, uint32_t id, const char* name, size_t len) {
+    size_t lo = 0, hi = map->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (map->entries[mid].id < id) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo < map->count && map->entries[lo].id == id) return;
+
+    if (map->count == map->cap) {
+        size_t cap = map->cap ? map->cap * 2 : 64;
+        sftp_id_name_t* grown = realloc(map->entries, cap * sizeof(*grown));
+        if (!grown) return;
+        map->entries = grown;
+        map->cap = cap;
+    }
+    char* copy = strndup(name, len);
+    if (!copy) return;
+    memmove(&map->entries[lo + 1], &map->entries[lo],
+            (map->count - lo) * sizeof(*map->entries));
+    map->entries[lo].id = id;
+    map->entries[lo].name = copy;
+    map->count++;
+}
 
-    char escaped[FP_MAX_PATH * 2];
-    shell_escape_path(path, escaped, sizeof(escaped));
+static void id_map_clear(sftp_id_map_t* map) {
+    for (size_t i = 0; i < map->count; i++) free(map->entries[i].name);
+    free(map->entries);
+    memset(map, 0, sizeof(*map));
+}
 
-    char cmd[FP_MAX_PATH * 2 + 64];
-    snprintf(cmd, sizeof(cmd), "stat -c '%%U:%%G' %s 2>/dev/null || echo ':'", escaped);
+/* Reads passwd/group-format lines (name:x:id:...) into map up to the first
+ * blank line, returning where parsing stopped. */
+static const char* id_map_parse(sftp_id_map_t* map, const char* p) {
+    while (*p && *p != '\n') {
+        const char* eol = strchr(p, '\n');
+        if (!eol) eol = p + strlen(p);
+        const char* c1 = memchr(p, ':', (size_t)(eol - p));
+        const char* c2 = c1 ? memchr(c1 + 1, ':', (size_t)(eol - c1 - 1)) : NULL;
+        if (c1 && c2 && c1 > p) {
+            char* end;
+            unsigned long id = strtoul(c2 + 1, &end, 10);
+            if (end > c2 + 1 && end <= eol && id <= UINT32_MAX)
+                id_map_put(map, (uint32_t)id, p, (size_t)(c1 - p));
+        }
+        p = *eol ? eol + 1 : eol;
+    }
+    return *p ? p + 1 : p;
+}
 
-    char out[256];
+/* One exec answers both maps: passwd lines, a blank line, group lines. */
+static void sftp_names_query(sftp_conn_t* c, const char* cmd) {
+    char* out = malloc(SFTP_EXEC_BUF);
     char err[256];
     int ec;
     bool timed_out = false;
-    if (exec_command(ssh, cmd, NULL, out, sizeof(out), err, sizeof(err), &ec, 30000, &timed_out) != 0)
-        return;
+    if (!out) return;
+
+    if (exec_command(c, cmd, NULL, out, SFTP_EXEC_BUF,
+                     err, sizeof(err), &ec, 30000, &timed_out) == 0) {
+        const char* p = id_map_parse(&c->names.users, out);
+        id_map_parse(&c->names.groups, p);
+    }
+    free(out);
+}
 
-    size_t len = strlen(out);
-    if (len > 0 && out[len - 1] == '\n') out[len - 1] = '\0';
+static void sftp_names_free(sftp_names_t* names) {
+    id_map_clear(&names->users);
+    id_map_clear(&names->groups);
+    names->loaded_at = 0;
+}
+
+static void sftp_names_resolve(sftp_conn_t* c, uint32_t uid, uint32_t gid,
+                               char* owner, size_t owner_sz,
+                               char* group, size_t group_sz) {
+    sftp_names_t* names = &c->names;
+    pthread_mutex_lock(&c->names_lock);
+
+    int64_t now = fp_monotonic_ms();
+    if (names->loaded_at == 0 || now - names->loaded_at >= SFTP_NAME_TTL_MS) {
+        sftp_names_free(names);
+        sftp_names_query(c,
+            "(getent passwd || cat /etc/passwd) 2>/dev/null; echo; "
+            "(getent group || cat /etc/group) 2>/dev/null");
+        names->loaded_at = now;
+    }
 
-    char* colon = strchr(out, ':');
-    if (colon) {
-        *colon = '\0';
-        snprintf(owner, owner_sz, "%s", out);
-        snprintf(group, group_sz, "%s", colon + 1);
+    /* Directory services may not enumerate; ask for stragglers by id and
+     * remember misses so they cost one exec per TTL. */
+    if (!id_map_find(&names->users, uid) || !id_map_find(&names->groups, gid)) {
+        char cmd[256];
+        snprintf(cmd, sizeof(cmd),
+            "(getent passwd %u || grep '^[^:]*:[^:]*:%u:' /etc/passwd) 2>/dev/null; echo; "
+            "(getent group %u || grep '^[^:]*:[^:]*:%u:' /etc/group) 2>/dev/null",
+            uid, uid, gid, gid);
+        sftp_names_query(c, cmd);
+        id_map_put(&names->users, uid, "", 0);
+        id_map_put(&names->groups, gid, "", 0);
     }
+
+    sftp_id_name_t* u = id_map_find(&names->users, uid);
+    sftp_id_name_t* g = id_map_find(&names->groups, gid);
+    snprintf(owner, owner_sz, "%s", u ? u->name : "");
+    snprintf(group, group_sz, "%s", g ? g->name : "");
+
+    pthread_mutex_unlock(&c->names_lock);
 }
 
-static void handle_stat(LIBSSH2_SFTP* sftp, LIBSSH2_SESSION* ssh,
-                        int fd, uint32_t rid, const char* path) {
+static void handle_stat(sftp_ctx_t* x, fp_out_t out, uint32_t rid, const char* path) {
     LIBSSH2_SFTP_ATTRIBUTES attrs;
-    if (libssh2_sftp_stat(sftp, path, &attrs) != 0) {
-        send_sftp_error(sftp, fd, rid);
+    int rc;
+    SFTP_LOCKED(x, rc = libssh2_sftp_stat(x->sftp, path, &attrs));
+    if (rc != 0) {
+        send_sftp_error(x->sftp, out, rid);
         return;
     }
 
@@ -302,196 +488,317 @@ static void handle_stat(LIBSSH2_SFTP* sftp, LIBSSH2_SESSION* ssh,
     st.atime = (uint32_t)attrs.atime;
     st.mtime = (uint32_t)attrs.mtime;
     st.is_dir = (attrs.permissions & LIBSSH2_SFTP_S_IFMT) == LIBSSH2_SFTP_S_IFDIR;
-    stat_get_owner_group(ssh, path, st.owner, sizeof(st.owner),
-                         st.group, sizeof(st.group));
+    if (attrs.flags & LIBSSH2_SFTP_ATTR_UIDGID)
+        sftp_names_resolve(x->conn, st.uid, st.gid,
+                           st.owner, sizeof(st.owner),
+                           st.group, sizeof(st.group));
 
-    fp_send_stat(fd, rid, &st);
+    fp_send_stat(out, rid, &st);
 }
 
-static void handle_mkdir(LIBSSH2_SFTP* sftp, int fd, uint32_t rid,
+static void handle_mkdir(sftp_ctx_t* x, fp_out_t out, uint32_t rid,
                          const char* path) {
-    if (libssh2_sftp_mkdir(sftp, path, 0755) != 0)
-        send_sftp_error(sftp, fd, rid);
+    int rc;
+    SFTP_LOCKED(x, rc = libssh2_sftp_mkdir(x->sftp, path, 0755));
+    if (rc != 0)
+        send_sftp_error(x->sftp, out, rid);
     else
-        fp_send_ok(fd, rid);
+        fp_send_ok(out, rid);
 }
 
-static void handle_rmdir(LIBSSH2_SFTP* sftp, int fd, uint32_t rid,
+static void handle_rmdir(sftp_ctx_t* x, fp_out_t out, uint32_t rid,
                          const char* path, bool recursive) {
-    int rc = recursive ? recursive_rmdir(sftp, path) : libssh2_sftp_rmdir(sftp, path);
+    int rc;
+    if (recursive)
+        rc = recursive_rmdir(x, path);
+    else
+        SFTP_LOCKED(x, rc = libssh2_sftp_rmdir(x->sftp, path));
     if (rc != 0)
-        send_sftp_error(sftp, fd, rid);
+        send_sftp_error(x->sftp, out, rid);
     else
-        fp_send_ok(fd, rid);
+        fp_send_ok(out, rid);
 }
 
-static void handle_unlink(LIBSSH2_SFTP* sftp, int fd, uint32_t rid,
+static void handle_unlink(sftp_ctx_t* x, fp_out_t out, uint32_t rid,
                           const char* path) {
-    if (libssh2_sftp_unlink(sftp, path) != 0)
-        send_sftp_error(sftp, fd, rid);
+    int rc;
+    SFTP_LOCKED(x, rc = libssh2_sftp_unlink(x->sftp, path));
+    if (rc != 0)
+        send_sftp_error(x->sftp, out, rid);
     else
-        fp_send_ok(fd, rid);
+        fp_send_ok(out, rid);
 }
 
-static void handle_rename(LIBSSH2_SFTP* sftp, int fd, uint32_t rid,
+static void handle_rename(sftp_ctx_t* x, fp_out_t out, uint32_t rid,
                           const char* old_path, const char* new_path) {
-    int rc = libssh2_sftp_rename_ex(sftp,
+    int rc;
+    SFTP_LOCKED(x, rc = libssh2_sftp_rename_ex(x->sftp,
         old_path, (unsigned int)strlen(old_path),
         new_path, (unsigned int)strlen(new_path),
         LIBSSH2_SFTP_RENAME_OVERWRITE | LIBSSH2_SFTP_RENAME_ATOMIC |
-        LIBSSH2_SFTP_RENAME_NATIVE);
+        LIBSSH2_SFTP_RENAME_NATIVE));
     if (rc != 0)
-        send_sftp_error(sftp, fd, rid);
+        send_sftp_error(x->sftp, out, rid);
     else
-        fp_send_ok(fd, rid);
+        fp_send_ok(out, rid);
 }
 
-static void handle_chmod(LIBSSH2_SFTP* sftp, int fd, uint32_t rid,
+static void handle_chmod(sftp_ctx_t* x, fp_out_t out, uint32_t rid,
                          const char* path, uint32_t mode) {
     LIBSSH2_SFTP_ATTRIBUTES attrs;
     memset(&attrs, 0, sizeof(attrs));
     attrs.flags = LIBSSH2_SFTP_ATTR_PERMISSIONS;
     attrs.permissions = (unsigned long)mode;
 
-    int rc = libssh2_sftp_stat_ex(sftp, path, (unsigned int)strlen(path),
-                                   LIBSSH2_SFTP_SETSTAT, &attrs);
+    int rc;
+    SFTP_LOCKED(x, rc = libssh2_sftp_stat_ex(x->sftp, path, (unsigned int)strlen(path),
+                                             LIBSSH2_SFTP_SETSTAT, &attrs));
     if (rc != 0)
-        send_sftp_error(sftp, fd, rid);
+        send_sftp_error(x->sftp, out, rid);
     else
-        fp_send_ok(fd, rid);
+        fp_send_ok(out, rid);
 }
 
-static void handle_realpath(LIBSSH2_SFTP* sftp, int fd, uint32_t rid,
+static void handle_realpath(sftp_ctx_t* x, fp_out_t out, uint32_t rid,
                             const char* path) {
     char resolved[FP_MAX_PATH];
-    int rc = libssh2_sftp_realpath(sftp, path, resolved, sizeof(resolved) - 1);
+    int rc;
+    SFTP_LOCKED(x, rc = libssh2_sftp_realpath(x->sftp, path, resolved, sizeof(resolved) - 1));
     if (rc < 0) {
-        send_sftp_error(sftp, fd, rid);
+        send_sftp_error(x->sftp, out, rid);
         return;
     }
     resolved[rc] = '\0';
 
     LIBSSH2_SFTP_ATTRIBUTES attrs;
     bool is_dir = false;
-    if (libssh2_sftp_stat(sftp, resolved, &attrs) == 0)
+    SFTP_LOCKED(x, rc = libssh2_sftp_stat(x->sftp, resolved, &attrs));
+    if (rc == 0)
         is_dir = (attrs.permissions & LIBSSH2_SFTP_S_IFMT) == LIBSSH2_SFTP_S_IFDIR;
 
-    fp_send_realpath(fd, rid, resolved, is_dir);
+    fp_send_realpath(out, rid, resolved, is_dir);
 }
 
-static void handle_read_file(LIBSSH2_SFTP* sftp, int fd, uint32_t rid,
+/* Sends a FileData frame whose header was written in place by
+ * fp_file_data_header(). */
+static int sftp_send_file_frame(fp_out_t out, const uint8_t* frame, size_t len) {
+    if (out.lock) pthread_mutex_lock(out.lock);
+    int rc = nexterm_write_exact(out.fd, frame, len);
+    if (out.lock) pthread_mutex_unlock(out.lock);
+    return rc;
+}
+
+/* Non-blocking read of up to len bytes. libssh2 keeps FXP_READ requests for
+ * up to four buffers ahead of the file offset in flight between calls, so
+ * the server keeps streaming while the transport is released and while the
+ * previous chunk is being written to the client. Returns bytes read, 0 at
+ * EOF, LIBSSH2_ERROR_EAGAIN if nothing has arrived yet, or another error. */
+static ssize_t sftp_read_some(sftp_ctx_t* x, LIBSSH2_SFTP_HANDLE* fh,
+                              uint8_t* buf, size_t len, int* dirs) {
+    ssize_t n;
+    sftp_conn_lock(x->conn);
+    libssh2_session_set_blocking(x->conn->ssh, 0);
+    do {
+        n = libssh2_sftp_read(fh, (char*)buf, len);
+    } while (n == LIBSSH2_ERROR_EAGAIN && sftp_conn_outbound_wait(x->conn));
+    *dirs = libssh2_session_block_directions(x->conn->ssh);
+    libssh2_session_set_blocking(x->conn->ssh, 1);
+    sftp_conn_unlock(x->conn);
+    return n;
+}
+
+static void handle_read_file(sftp_ctx_t* x, fp_out_t out, uint32_t rid,
                              const char* path) {
     LIBSSH2_SFTP_ATTRIBUTES attrs;
-    if (libssh2_sftp_stat(sftp, path, &attrs) != 0) {
-        send_sftp_error(sftp, fd, rid);
+    int rc;
+    SFTP_LOCKED(x, rc = libssh2_sftp_stat(x->sftp, path, &attrs));
+    if (rc != 0) {
+        send_sftp_error(x->sftp, out, rid);
         return;
     }
     uint64_t total_size = attrs.filesize;
 
-    LIBSSH2_SFTP_HANDLE* fh = libssh2_sftp_open(sftp, path, LIBSSH2_FXF_READ, 0);
+    LIBSSH2_SFTP_HANDLE* fh;
+    SFTP_LOCKED(x, fh = libssh2_sftp_open(x->sftp, path, LIBSSH2_FXF_READ, 0));
     if (!fh) {
-        send_sftp_error(sftp, fd, rid);
+        send_sftp_error(x->sftp, out, rid);
         return;
     }
 
-    uint8_t* chunk = malloc(FP_CHUNK_SIZE);
-    if (!chunk) {
-        fp_send_error(fd, rid, "Out of memory", -1);
-        libssh2_sftp_close(fh);
+    uint8_t* frame = malloc(FP_FILE_DATA_HEADER + FP_CHUNK_SIZE);
+    if (!frame) {
+        fp_send_error(out, rid, "Out of memory", -1);
+        SFTP_LOCKED(x, libssh2_sftp_close(fh));
         return;
     }
-    for (;;) {
-        ssize_t n = libssh2_sftp_read(fh, (char*)chunk, FP_CHUNK_SIZE);
-        if (n < 0) {
-            send_sftp_error(sftp, fd, rid);
-            free(chunk);
-            libssh2_sftp_close(fh);
-            return;
+    uint8_t* data = frame + FP_FILE_DATA_HEADER;
+
+    /* Chunks are read straight behind their header. A partly filled chunk is
+     * sent whenever the transport runs dry, once it is large enough to be
+     * worth a frame, so the client write overlaps the reads in flight. */
+    bool read_error = false, send_error = false, eof = false;
+    size_t filled = 0;
+    while (!eof) {
+        int dirs = 0;
+        ssize_t n = sftp_read_some(x, fh, data + filled, FP_CHUNK_SIZE - filled, &dirs);
+        if (n > 0) filled += (size_t)n;
+        else if (n == 0) eof = true;
+        else if (n != LIBSSH2_ERROR_EAGAIN) {
+            read_error = true;
+            break;
         }
-        if (n == 0) break;
-        if (fp_send_file_data(fd, rid, chunk, (size_t)n, total_size) != 0) {
-            LOG_WARN("SFTP: failed to send file data chunk");
-            free(chunk);
-            libssh2_sftp_close(fh);
-            return;
+
+        bool idle = n == LIBSSH2_ERROR_EAGAIN;
+        if (filled == FP_CHUNK_SIZE || (eof && filled > 0) ||
+            (idle && filled >= SFTP_READ_MIN_FRAME)) {
+            fp_file_data_header(frame, rid, filled, total_size);
+            if (sftp_send_file_frame(out, frame, FP_FILE_DATA_HEADER + filled) != 0) {
+                send_error = true;
+                break;
+            }
+            filled = 0;
+            continue;
         }
+
+        if (idle)
+            sftp_conn_wait(x->conn, dirs, SFTP_SHARED_POLL_MS);
+    }
+
+    free(frame);
+    SFTP_LOCKED(x, libssh2_sftp_close(fh));
+
+    if (send_error) {
+        LOG_WARN("SFTP: failed to send file data chunk");
+        return;
+    }
+    if (read_error) {
+        send_sftp_error(x->sftp, out, rid);
+        return;
     }
 
-    free(chunk);
-    libssh2_sftp_close(fh);
-    fp_send_file_end(fd, rid);
+    fp_send_file_end(out, rid);
+}
+
+static int read_fully(sftp_ctx_t* x, LIBSSH2_SFTP_HANDLE* fh,
+                      uint8_t* buf, size_t len, size_t* got) {
+    *got = 0;
+    while (*got < len) {
+        size_t want = len - *got < FP_CHUNK_SIZE ? len - *got : FP_CHUNK_SIZE;
+        ssize_t n;
+        SFTP_LOCKED(x, n = libssh2_sftp_read(fh, (char*)buf + *got, want));
+        if (n < 0) return -1;
+        if (n == 0) break;
+        *got += (size_t)n;
+    }
+    return 0;
 }
 
-static void handle_thumbnail(LIBSSH2_SFTP* sftp, int fd, uint32_t rid,
+/* Cache first, then the file head (EXIF preview, or a size we would refuse
+ * anyway), and only then the whole file. */
+static void handle_thumbnail(sftp_ctx_t* x, fp_out_t out, uint32_t rid,
                              const char* path, uint32_t size) {
     LIBSSH2_SFTP_ATTRIBUTES attrs;
-    if (libssh2_sftp_stat(sftp, path, &attrs) != 0) {
-        send_sftp_error(sftp, fd, rid);
+    int rc;
+    SFTP_LOCKED(x, rc = libssh2_sftp_stat(x->sftp, path, &attrs));
+    if (rc != 0) {
+        send_sftp_error(x->sftp, out, rid);
         return;
     }
     if (attrs.filesize == 0 || attrs.filesize > FP_THUMB_MAX_BYTES) {
-        fp_send_error(fd, rid, "Image too large for thumbnail", -1);
+        fp_send_error(out, rid, "Image too large for thumbnail", -1);
+        return;
+    }
+
+    uint8_t* jpeg = NULL;
+    size_t jpeg_len = 0;
+    int ow = 0, oh = 0;
+
+    char key[THUMB_CACHE_KEY_LEN];
+    bool cacheable = x->conn->origin[0] &&
+        nexterm_thumb_cache_key(key, x->conn->origin, path, attrs.filesize,
+                                (uint32_t)attrs.mtime, (int)size) == 0;
+    if (cacheable && nexterm_thumb_cache_get(key, &jpeg, &jpeg_len, &ow, &oh) == 0) {
+        fp_send_thumbnail(out, rid, jpeg, jpeg_len, (uint32_t)ow, (uint32_t)oh);
+        free(jpeg);
         return;
     }
 
     size_t flen = (size_t)attrs.filesize;
-    uint8_t* filebuf = malloc(flen);
-    if (!filebuf) { fp_send_error(fd, rid, "Out of memory", -1); return; }
+    size_t head = flen < NEXTERM_THUMB_HEAD_BYTES ? flen : NEXTERM_THUMB_HEAD_BYTES;
+    uint8_t* filebuf = malloc(head);
+    if (!filebuf) { fp_send_error(out, rid, "Out of memory", -1); return; }
 
-    LIBSSH2_SFTP_HANDLE* fh = libssh2_sftp_open(sftp, path, LIBSSH2_FXF_READ, 0);
+    LIBSSH2_SFTP_HANDLE* fh;
+    SFTP_LOCKED(x, fh = libssh2_sftp_open(x->sftp, path, LIBSSH2_FXF_READ, 0));
     if (!fh) {
-        send_sftp_error(sftp, fd, rid);
+        send_sftp_error(x->sftp, out, rid);
         free(filebuf);
         return;
     }
 
     size_t got = 0;
-    while (got < flen) {
-        ssize_t n = libssh2_sftp_read(fh, (char*)filebuf + got, flen - got);
-        if (n < 0) {
-            send_sftp_error(sftp, fd, rid);
-            libssh2_sftp_close(fh);
-            free(filebuf);
-            return;
-        }
-        if (n == 0) break;
-        got += (size_t)n;
+    const char* error = NULL;
+    if (read_fully(x, fh, filebuf, head, &got) != 0) {
+        send_sftp_error(x->sftp, out, rid);
+        goto done;
     }
-    libssh2_sftp_close(fh);
 
-    uint8_t* jpeg = NULL;
-    size_t jpeg_len = 0;
-    int ow = 0, oh = 0;
-    if (nexterm_make_thumbnail(filebuf, got, (int)size, &jpeg, &jpeg_len, &ow, &oh) != 0) {
-        free(filebuf);
-        fp_send_error(fd, rid, "Failed to generate thumbnail", -1);
-        return;
+    rc = -1;
+    if (got == head && head < flen) {
+        if (nexterm_thumbnail_check_head(filebuf, got) != 0) {
+            error = "Image too large for thumbnail";
+            goto done;
+        }
+        rc = nexterm_thumbnail_from_head(filebuf, got, (int)size, &jpeg, &jpeg_len, &ow, &oh);
+
+        if (rc != 0) {
+            uint8_t* grown = realloc(filebuf, flen);
+            if (!grown) { error = "Out of memory"; goto done; }
+            filebuf = grown;
+
+            size_t more = 0;
+            if (read_fully(x, fh, filebuf + got, flen - got, &more) != 0) {
+                send_sftp_error(x->sftp, out, rid);
+                goto done;
+            }
+            got += more;
+        }
+    }
+    if (rc != 0 &&
+        nexterm_make_thumbnail(filebuf, got, (int)size, &jpeg, &jpeg_len, &ow, &oh) != 0) {
+        error = "Failed to generate thumbnail";
+        goto done;
     }
-    free(filebuf);
 
-    fp_send_thumbnail(fd, rid, jpeg, jpeg_len, (uint32_t)ow, (uint32_t)oh);
+    if (cacheable) nexterm_thumb_cache_put(key, jpeg, jpeg_len, ow, oh);
+    fp_send_thumbnail(out, rid, jpeg, jpeg_len, (uint32_t)ow, (uint32_t)oh);
     free(jpeg);
+
+done:
+    SFTP_LOCKED(x, libssh2_sftp_close(fh));
+    free(filebuf);
+    if (error) fp_send_error(out, rid, error, -1);
 }
 
-static void handle_exec(LIBSSH2_SESSION* ssh, int fd, uint32_t rid,
+static void handle_exec(sftp_conn_t* c, fp_out_t out, uint32_t rid,
                         const char* command, const char* stdin_data,
                         uint32_t timeout_ms) {
-    char* out = malloc(SFTP_EXEC_BUF);
+    char* out_buf = malloc(SFTP_EXEC_BUF);
     char* err_buf = malloc(SFTP_EXEC_BUF);
-    if (!out || !err_buf) {
-        free(out);
+    if (!out_buf || !err_buf) {
+        free(out_buf);
         free(err_buf);
-        fp_send_error(fd, rid, "Out of memory", -1);
+        fp_send_error(out, rid, "Out of memory", -1);
         return;
     }
 
     int exit_code = -1;
     bool timed_out = false;
-    if (exec_command(ssh, command, stdin_data, out, SFTP_EXEC_BUF,
+    if (exec_command(c, command, stdin_data, out_buf, SFTP_EXEC_BUF,
                      err_buf, SFTP_EXEC_BUF, &exit_code, timeout_ms, &timed_out) != 0) {
-        free(out);
+        free(out_buf);
         free(err_buf);
-        fp_send_error(fd, rid, "Failed to execute command", -1);
+        fp_send_error(out, rid, "Failed to execute command", -1);
         return;
     }
 
@@ -503,12 +810,12 @@ static void handle_exec(LIBSSH2_SESSION* ssh, int fd, uint32_t rid,
                  el ? "\n" : "", timeout_ms / 1000);
     }
 
-    fp_send_exec_result(fd, rid, out, err_buf, exit_code);
-    free(out);
+    fp_send_exec_result(out, rid, out_buf, err_buf, exit_code);
+    free(out_buf);
     free(err_buf);
 }
 
-static void handle_search_dirs(LIBSSH2_SFTP* sftp, int fd, uint32_t rid,
+static void handle_search_dirs(sftp_ctx_t* x, fp_out_t out, uint32_t rid,
                                const char* search_path, uint32_t max_results,
                                uint32_t timeout_ms) {
     if (max_results == 0 || max_results > FP_SEARCH_MAX)
@@ -526,54 +833,97 @@ static void handle_search_dirs(LIBSSH2_SFTP* sftp, int fd, uint32_t rid,
     ctx.deadline = fp_monotonic_ms() + (int64_t)timeout_ms;
 
     const char* bp = base_path[0] ? base_path : "/";
-    search_list_level(sftp, bp, search_term, inside, &ctx);
+    search_list_level(x, bp, search_term, inside, &ctx);
 
     if (ctx.timed_out)
         LOG_WARN("SFTP: search timed out after %u ms, returning %d partial result(s)",
                  timeout_ms, ctx.count);
 
-    fp_send_search_result(fd, rid, &ctx);
+    fp_send_search_result(out, rid, &ctx);
 }
 
 typedef struct {
     LIBSSH2_SFTP_HANDLE* handle;
     uint32_t rid;
+    char path[FP_MAX_PATH];
     uint8_t* buf;
+    size_t buf_off;
     size_t buf_len;
     size_t buf_cap;
+    uint64_t committed;
+    uint64_t reported;
+    int dirs;
 } sftp_write_state_t;
 
-static int sftp_write_raw(LIBSSH2_SFTP* sftp, int data_fd,
-                          sftp_write_state_t* ws,
-                          const uint8_t* data, size_t dlen) {
-    size_t written = 0;
-    while (written < dlen) {
-        ssize_t n = libssh2_sftp_write(ws->handle,
-            (const char*)data + written, dlen - written);
-        if (n < 0) {
-            send_sftp_error(sftp, data_fd, ws->rid);
-            libssh2_sftp_close(ws->handle);
-            ws->handle = NULL;
-            return -1;
-        }
-        written += (size_t)n;
-    }
-    return 0;
+static bool sftp_write_pending(const sftp_write_state_t* ws) {
+    return ws->handle && ws->buf_len > ws->buf_off;
 }
 
-static int sftp_flush_write(LIBSSH2_SFTP* sftp, int data_fd,
+static void sftp_write_fail(sftp_ctx_t* x, fp_out_t out,
                             sftp_write_state_t* ws) {
-    if (!ws->handle || ws->buf_len == 0) return 0;
-    int rc = sftp_write_raw(sftp, data_fd, ws, ws->buf, ws->buf_len);
+    send_sftp_error(x->sftp, out, ws->rid);
+    SFTP_LOCKED(x, libssh2_sftp_close(ws->handle));
+    ws->handle = NULL;
+    ws->buf_off = 0;
     ws->buf_len = 0;
-    return rc;
 }
 
-static int sftp_handle_write_data(LIBSSH2_SFTP* sftp, int data_fd,
+/* Writes buffered upload data without blocking the transport. With block
+ * set, keeps going (yielding the transport while it waits) until the
+ * buffer is empty. */
+static int sftp_write_pump(sftp_ctx_t* x, fp_out_t out,
+                           sftp_write_state_t* ws, bool block) {
+    if (!sftp_write_pending(ws)) return 0;
+
+    sftp_conn_t* c = x->conn;
+    int rc = 0;
+    for (;;) {
+        sftp_conn_lock(c);
+        libssh2_session_set_blocking(c->ssh, 0);
+        while (ws->buf_off < ws->buf_len) {
+            ssize_t n = libssh2_sftp_write(ws->handle,
+                (const char*)ws->buf + ws->buf_off, ws->buf_len - ws->buf_off);
+            if (n == LIBSSH2_ERROR_EAGAIN) {
+                if (sftp_conn_outbound_wait(c)) continue;
+                break;
+            }
+            if (n < 0) { rc = -1; break; }
+            ws->buf_off += (size_t)n;
+            ws->committed += (uint64_t)n;
+        }
+        ws->dirs = libssh2_session_block_directions(c->ssh);
+        libssh2_session_set_blocking(c->ssh, 1);
+        sftp_conn_unlock(c);
+
+        if (rc != 0 || !block || ws->buf_off == ws->buf_len) break;
+        sftp_conn_wait(c, ws->dirs, SFTP_SHARED_POLL_MS);
+    }
+
+    if (rc != 0) {
+        sftp_write_fail(x, out, ws);
+        return -1;
+    }
+
+    if (ws->buf_off == ws->buf_len) {
+        ws->buf_off = 0;
+        ws->buf_len = 0;
+    }
+
+    /* The window is the fixed buffer size, not its free space: the client
+     * measures it from `committed`, which already accounts for what is
+     * still buffered here. */
+    if (ws->committed != ws->reported) {
+        fp_send_write_ack(out, ws->rid, ws->committed, (uint32_t)ws->buf_cap);
+        ws->reported = ws->committed;
+    }
+    return 0;
+}
+
+static int sftp_handle_write_data(sftp_ctx_t* x, fp_out_t out,
                                    sftp_write_state_t* ws,
                                    Nexterm_SftpProtocol_SftpMessage_table_t msg) {
     if (!ws->handle) {
-        fp_send_error(data_fd, Nexterm_SftpProtocol_SftpMessage_request_id(msg),
+        fp_send_error(out, Nexterm_SftpProtocol_SftpMessage_request_id(msg),
                       "No write in progress", -1);
         return 0;
     }
@@ -584,24 +934,28 @@ static int sftp_handle_write_data(LIBSSH2_SFTP* sftp, int data_fd,
 
     flatbuffers_uint8_vec_t data = Nexterm_SftpProtocol_WriteDataReq_data(req);
     size_t dlen = flatbuffers_uint8_vec_len(data);
-    if (dlen == 0) return 0;
-
-    if (dlen >= ws->buf_cap) {
-        if (sftp_flush_write(sftp, data_fd, ws) != 0) return 0;
-        sftp_write_raw(sftp, data_fd, ws, data, dlen);
-        return 0;
-    }
 
-    if (ws->buf_len + dlen > ws->buf_cap) {
-        if (sftp_flush_write(sftp, data_fd, ws) != 0) return 0;
-    }
+    while (dlen > 0) {
+        if (ws->buf_len == ws->buf_cap && ws->buf_off > 0) {
+            memmove(ws->buf, ws->buf + ws->buf_off, ws->buf_len - ws->buf_off);
+            ws->buf_len -= ws->buf_off;
+            ws->buf_off = 0;
+        }
 
-    memcpy(ws->buf + ws->buf_len, data, dlen);
-    ws->buf_len += dlen;
+        size_t room = ws->buf_cap - ws->buf_len;
+        if (room == 0) {
+            if (sftp_write_pump(x, out, ws, true) != 0) return 0;
+            continue;
+        }
 
-    if (ws->buf_len >= SFTP_WRITE_BUF)
-        sftp_flush_write(sftp, data_fd, ws);
+        size_t take = dlen < room ? dlen : room;
+        memcpy(ws->buf + ws->buf_len, data, take);
+        ws->buf_len += take;
+        data += take;
+        dlen -= take;
+    }
 
+    sftp_write_pump(x, out, ws, false);
     return 0;
 }
 
@@ -611,138 +965,146 @@ static const char* extract_path_req(Nexterm_SftpProtocol_SftpMessage_table_t msg
 }
 
 static void dispatch_path_op(Nexterm_SftpProtocol_SftpMsgType_enum_t mt,
-                              LIBSSH2_SFTP* sftp, LIBSSH2_SESSION* ssh,
-                              int data_fd, uint32_t rid,
+                              sftp_ctx_t* x, fp_out_t out, uint32_t rid,
                               Nexterm_SftpProtocol_SftpMessage_table_t msg) {
     const char* path = extract_path_req(msg);
-    if (!path) { fp_send_error(data_fd, rid, "Missing path", -1); return; }
+    if (!path) { fp_send_error(out, rid, "Missing path", -1); return; }
 
     switch (mt) {
         case Nexterm_SftpProtocol_SftpMsgType_ListDir:
-            handle_list_dir(sftp, data_fd, rid, path); return;
+            handle_list_dir(x, out, rid, path); return;
         case Nexterm_SftpProtocol_SftpMsgType_Stat:
-            handle_stat(sftp, ssh, data_fd, rid, path); return;
+            handle_stat(x, out, rid, path); return;
         case Nexterm_SftpProtocol_SftpMsgType_Mkdir:
-            handle_mkdir(sftp, data_fd, rid, path); return;
+            handle_mkdir(x, out, rid, path); return;
         case Nexterm_SftpProtocol_SftpMsgType_Unlink:
-            handle_unlink(sftp, data_fd, rid, path); return;
+            handle_unlink(x, out, rid, path); return;
         case Nexterm_SftpProtocol_SftpMsgType_Realpath:
-            handle_realpath(sftp, data_fd, rid, path); return;
+            handle_realpath(x, out, rid, path); return;
         case Nexterm_SftpProtocol_SftpMsgType_ReadFile:
-            handle_read_file(sftp, data_fd, rid, path); return;
+            handle_read_file(x, out, rid, path); return;
         default: return;
     }
 }
 
 static void dispatch_write_op(Nexterm_SftpProtocol_SftpMsgType_enum_t mt,
-                               LIBSSH2_SFTP* sftp, int data_fd, uint32_t rid,
+                               sftp_ctx_t* x, fp_out_t out, uint32_t rid,
                                Nexterm_SftpProtocol_SftpMessage_table_t msg,
                                sftp_write_state_t* ws) {
     if (mt == Nexterm_SftpProtocol_SftpMsgType_WriteData) {
-        sftp_handle_write_data(sftp, data_fd, ws, msg);
+        sftp_handle_write_data(x, out, ws, msg);
         return;
     }
 
     if (mt == Nexterm_SftpProtocol_SftpMsgType_WriteEnd) {
         if (ws->handle) {
-            if (sftp_flush_write(sftp, data_fd, ws) != 0) return;
-            libssh2_sftp_close(ws->handle);
+            if (sftp_write_pump(x, out, ws, true) != 0) return;
+            SFTP_LOCKED(x, libssh2_sftp_close(ws->handle));
             ws->handle = NULL;
-            fp_send_ok(data_fd, ws->rid);
+            fp_send_ok(out, ws->rid);
         }
         return;
     }
 
     if (ws->handle) {
-        sftp_flush_write(sftp, data_fd, ws);
-        libssh2_sftp_close(ws->handle);
+        sftp_write_pump(x, out, ws, true);
+        if (ws->handle) SFTP_LOCKED(x, libssh2_sftp_close(ws->handle));
         ws->handle = NULL;
     }
+    ws->buf_off = 0;
     ws->buf_len = 0;
     if (!ws->buf) {
-        ws->buf = malloc(SFTP_WRITE_BUF);
-        if (!ws->buf) { fp_send_error(data_fd, rid, "Out of memory", -1); return; }
-        ws->buf_cap = SFTP_WRITE_BUF;
+        ws->buf = malloc(SFTP_WRITE_WINDOW);
+        if (!ws->buf) { fp_send_error(out, rid, "Out of memory", -1); return; }
+        ws->buf_cap = SFTP_WRITE_WINDOW;
     }
     Nexterm_SftpProtocol_WriteBeginReq_table_t req =
         Nexterm_SftpProtocol_SftpMessage_write_begin_req(msg);
     const char* path = req ? Nexterm_SftpProtocol_WriteBeginReq_path(req) : NULL;
-    if (!path) { fp_send_error(data_fd, rid, "Missing path", -1); return; }
+    uint64_t offset = req ? Nexterm_SftpProtocol_WriteBeginReq_offset(req) : 0;
+    if (!path) { fp_send_error(out, rid, "Missing path", -1); return; }
+
+    unsigned long flags = LIBSSH2_FXF_WRITE | LIBSSH2_FXF_CREAT;
+    if (offset == 0) flags |= LIBSSH2_FXF_TRUNC;
 
-    ws->handle = libssh2_sftp_open(sftp, path,
-        LIBSSH2_FXF_WRITE | LIBSSH2_FXF_CREAT | LIBSSH2_FXF_TRUNC,
+    SFTP_LOCKED(x, ws->handle = libssh2_sftp_open(x->sftp, path, flags,
         LIBSSH2_SFTP_S_IRUSR | LIBSSH2_SFTP_S_IWUSR |
-        LIBSSH2_SFTP_S_IRGRP | LIBSSH2_SFTP_S_IROTH);
+        LIBSSH2_SFTP_S_IRGRP | LIBSSH2_SFTP_S_IROTH));
     if (!ws->handle) {
-        send_sftp_error(sftp, data_fd, rid);
-    } else {
-        ws->rid = rid;
-        fp_send_ok(data_fd, rid);
+        send_sftp_error(x->sftp, out, rid);
+        return;
     }
+
+    if (offset > 0)
+        libssh2_sftp_seek64(ws->handle, offset);
+
+    snprintf(ws->path, sizeof(ws->path), "%s", path);
+    ws->rid = rid;
+    ws->committed = offset;
+    ws->reported = offset;
+    fp_send_ok(out, rid);
 }
 
-static void dispatch_rmdir(LIBSSH2_SFTP* sftp, int data_fd, uint32_t rid,
+static void dispatch_rmdir(sftp_ctx_t* x, fp_out_t out, uint32_t rid,
                            Nexterm_SftpProtocol_SftpMessage_table_t msg) {
     Nexterm_SftpProtocol_RmdirReq_table_t req = Nexterm_SftpProtocol_SftpMessage_rmdir_req(msg);
     const char* path = req ? Nexterm_SftpProtocol_RmdirReq_path(req) : NULL;
     bool rec = req ? Nexterm_SftpProtocol_RmdirReq_recursive(req) : false;
-    if (!path) { fp_send_error(data_fd, rid, "Missing path", -1); return; }
-    handle_rmdir(sftp, data_fd, rid, path, rec);
+    if (!path) { fp_send_error(out, rid, "Missing path", -1); return; }
+    handle_rmdir(x, out, rid, path, rec);
 }
 
-static void dispatch_rename(LIBSSH2_SFTP* sftp, int data_fd, uint32_t rid,
+static void dispatch_rename(sftp_ctx_t* x, fp_out_t out, uint32_t rid,
                              Nexterm_SftpProtocol_SftpMessage_table_t msg) {
     Nexterm_SftpProtocol_RenameReq_table_t req = Nexterm_SftpProtocol_SftpMessage_rename_req(msg);
     const char* old = req ? Nexterm_SftpProtocol_RenameReq_old_path(req) : NULL;
     const char* new_p = req ? Nexterm_SftpProtocol_RenameReq_new_path(req) : NULL;
-    if (!old || !new_p) { fp_send_error(data_fd, rid, "Missing paths", -1); return; }
-    handle_rename(sftp, data_fd, rid, old, new_p);
+    if (!old || !new_p) { fp_send_error(out, rid, "Missing paths", -1); return; }
+    handle_rename(x, out, rid, old, new_p);
 }
 
-static void dispatch_chmod(LIBSSH2_SFTP* sftp, int data_fd, uint32_t rid,
+static void dispatch_chmod(sftp_ctx_t* x, fp_out_t out, uint32_t rid,
                             Nexterm_SftpProtocol_SftpMessage_table_t msg) {
     Nexterm_SftpProtocol_ChmodReq_table_t req = Nexterm_SftpProtocol_SftpMessage_chmod_req(msg);
     const char* path = req ? Nexterm_SftpProtocol_ChmodReq_path(req) : NULL;
     uint32_t mode = req ? Nexterm_SftpProtocol_ChmodReq_mode(req) : 0;
-    if (!path) { fp_send_error(data_fd, rid, "Missing path", -1); return; }
-    handle_chmod(sftp, data_fd, rid, path, mode);
+    if (!path) { fp_send_error(out, rid, "Missing path", -1); return; }
+    handle_chmod(x, out, rid, path, mode);
 }
 
-static void dispatch_exec(LIBSSH2_SESSION* ssh, int data_fd, uint32_t rid,
+static void dispatch_exec(sftp_conn_t* c, fp_out_t out, uint32_t rid,
                            Nexterm_SftpProtocol_SftpMessage_table_t msg) {
     Nexterm_SftpProtocol_ExecReq_table_t req = Nexterm_SftpProtocol_SftpMessage_exec_req(msg);
     const char* command = req ? Nexterm_SftpProtocol_ExecReq_command(req) : NULL;
     const char* stdin_data = req ? Nexterm_SftpProtocol_ExecReq_stdin_data(req) : NULL;
     uint32_t timeout_ms = req ? Nexterm_SftpProtocol_ExecReq_timeout_ms(req) : 0;
-    if (!command) { fp_send_error(data_fd, rid, "Missing command", -1); return; }
+    if (!command) { fp_send_error(out, rid, "Missing command", -1); return; }
     if (timeout_ms == 0) timeout_ms = 300000;
-    handle_exec(ssh, data_fd, rid, command, stdin_data, timeout_ms);
+    handle_exec(c, out, rid, command, stdin_data, timeout_ms);
 }
 
-static void dispatch_search(LIBSSH2_SFTP* sftp, int data_fd, uint32_t rid,
+static void dispatch_search(sftp_ctx_t* x, fp_out_t out, uint32_t rid,
                              Nexterm_SftpProtocol_SftpMessage_table_t msg) {
     Nexterm_SftpProtocol_SearchReq_table_t req = Nexterm_SftpProtocol_SftpMessage_search_req(msg);
     const char* sp = req ? Nexterm_SftpProtocol_SearchReq_search_path(req) : NULL;
     uint32_t max = req ? Nexterm_SftpProtocol_SearchReq_max_results(req) : FP_SEARCH_MAX;
     uint32_t timeout_ms = req ? Nexterm_SftpProtocol_SearchReq_timeout_ms(req) : 0;
-    if (!sp) { fp_send_error(data_fd, rid, "Missing search path", -1); return; }
+    if (!sp) { fp_send_error(out, rid, "Missing search path", -1); return; }
     if (timeout_ms == 0) timeout_ms = 30000;
-    handle_search_dirs(sftp, data_fd, rid, sp, max, timeout_ms);
+    handle_search_dirs(x, out, rid, sp, max, timeout_ms);
 }
 
-static void dispatch_thumbnail(LIBSSH2_SFTP* sftp, int data_fd, uint32_t rid,
+static void dispatch_thumbnail(sftp_ctx_t* x, fp_out_t out, uint32_t rid,
                                Nexterm_SftpProtocol_SftpMessage_table_t msg) {
     Nexterm_SftpProtocol_ThumbnailReq_table_t req = Nexterm_SftpProtocol_SftpMessage_thumbnail_req(msg);
     const char* path = req ? Nexterm_SftpProtocol_ThumbnailReq_path(req) : NULL;
     uint32_t size = req ? Nexterm_SftpProtocol_ThumbnailReq_size(req) : 100;
-    if (!path) { fp_send_error(data_fd, rid, "Missing path", -1); return; }
-    handle_thumbnail(sftp, data_fd, rid, path, size);
+    if (!path) { fp_send_error(out, rid, "Missing path", -1); return; }
+    handle_thumbnail(x, out, rid, path, size);
 }
 
-static int sftp_dispatch_message(LIBSSH2_SFTP* sftp, LIBSSH2_SESSION* ssh,
-                                  int data_fd,
-                                  Nexterm_SftpProtocol_SftpMessage_table_t msg,
-                                  sftp_write_state_t* ws) {
+static void sftp_run_request(sftp_ctx_t* x, fp_out_t out,
+                             Nexterm_SftpProtocol_SftpMessage_table_t msg) {
     Nexterm_SftpProtocol_SftpMsgType_enum_t mt =
         Nexterm_SftpProtocol_SftpMessage_msg_type(msg);
     uint32_t rid = Nexterm_SftpProtocol_SftpMessage_request_id(msg);
@@ -754,47 +1116,382 @@ static int sftp_dispatch_message(LIBSSH2_SFTP* sftp, LIBSSH2_SESSION* ssh,
         case Nexterm_SftpProtocol_SftpMsgType_Unlink:
         case Nexterm_SftpProtocol_SftpMsgType_Realpath:
         case Nexterm_SftpProtocol_SftpMsgType_ReadFile:
-            dispatch_path_op(mt, sftp, ssh, data_fd, rid, msg);
-            return 0;
-
-        case Nexterm_SftpProtocol_SftpMsgType_WriteBegin:
-        case Nexterm_SftpProtocol_SftpMsgType_WriteData:
-        case Nexterm_SftpProtocol_SftpMsgType_WriteEnd:
-            dispatch_write_op(mt, sftp, data_fd, rid, msg, ws);
-            return 0;
-
+            dispatch_path_op(mt, x, out, rid, msg); return;
         case Nexterm_SftpProtocol_SftpMsgType_Rmdir:
-            dispatch_rmdir(sftp, data_fd, rid, msg); return 0;
+            dispatch_rmdir(x, out, rid, msg); return;
         case Nexterm_SftpProtocol_SftpMsgType_Rename:
-            dispatch_rename(sftp, data_fd, rid, msg); return 0;
+            dispatch_rename(x, out, rid, msg); return;
         case Nexterm_SftpProtocol_SftpMsgType_Chmod:
-            dispatch_chmod(sftp, data_fd, rid, msg); return 0;
+            dispatch_chmod(x, out, rid, msg); return;
         case Nexterm_SftpProtocol_SftpMsgType_Exec:
-            dispatch_exec(ssh, data_fd, rid, msg); return 0;
+            dispatch_exec(x->conn, out, rid, msg); return;
         case Nexterm_SftpProtocol_SftpMsgType_SearchDirs:
-            dispatch_search(sftp, data_fd, rid, msg); return 0;
+            dispatch_search(x, out, rid, msg); return;
         case Nexterm_SftpProtocol_SftpMsgType_Thumbnail:
-            dispatch_thumbnail(sftp, data_fd, rid, msg); return 0;
+            dispatch_thumbnail(x, out, rid, msg); return;
 
         default:
             LOG_WARN("SFTP: unknown msg_type %d", mt);
-            fp_send_error(data_fd, rid, "Unknown operation", -1);
-            return 0;
+            fp_send_error(out, rid, "Unknown operation", -1);
+            return;
     }
 }
 
+typedef struct sftp_job {
+    struct sftp_job* next;
+    uint8_t* payload;
+    Nexterm_SftpProtocol_SftpMessage_table_t msg;
+    const char* paths[2];
+    bool mutates;
+    bool running;
+} sftp_job_t;
+
+static void sftp_job_classify(sftp_job_t* job) {
+    Nexterm_SftpProtocol_SftpMessage_table_t msg = job->msg;
+
+    switch (Nexterm_SftpProtocol_SftpMessage_msg_type(msg)) {
+        case Nexterm_SftpProtocol_SftpMsgType_Mkdir:
+        case Nexterm_SftpProtocol_SftpMsgType_Unlink:
+            job->mutates = true;
+            /* fall through */
+        case Nexterm_SftpProtocol_SftpMsgType_ListDir:
+        case Nexterm_SftpProtocol_SftpMsgType_Stat:
+        case Nexterm_SftpProtocol_SftpMsgType_Realpath:
+        case Nexterm_SftpProtocol_SftpMsgType_ReadFile:
+            job->paths[0] = extract_path_req(msg);
+            return;
+        case Nexterm_SftpProtocol_SftpMsgType_Rmdir: {
+            Nexterm_SftpProtocol_RmdirReq_table_t req = Nexterm_SftpProtocol_SftpMessage_rmdir_req(msg);
+            job->paths[0] = req ? Nexterm_SftpProtocol_RmdirReq_path(req) : NULL;
+            job->mutates = true;
+            return;
+        }
+        case Nexterm_SftpProtocol_SftpMsgType_Rename: {
+            Nexterm_SftpProtocol_RenameReq_table_t req = Nexterm_SftpProtocol_SftpMessage_rename_req(msg);
+            job->paths[0] = req ? Nexterm_SftpProtocol_RenameReq_old_path(req) : NULL;
+            job->paths[1] = req ? Nexterm_SftpProtocol_RenameReq_new_path(req) : NULL;
+            job->mutates = true;
+            return;
+        }
+        case Nexterm_SftpProtocol_SftpMsgType_Chmod: {
+            Nexterm_SftpProtocol_ChmodReq_table_t req = Nexterm_SftpProtocol_SftpMessage_chmod_req(msg);
+            job->paths[0] = req ? Nexterm_SftpProtocol_ChmodReq_path(req) : NULL;
+            job->mutates = true;
+            return;
+        }
+        case Nexterm_SftpProtocol_SftpMsgType_Exec:
+            job->mutates = true;
+            return;
+        case Nexterm_SftpProtocol_SftpMsgType_SearchDirs: {
+            Nexterm_SftpProtocol_SearchReq_table_t req = Nexterm_SftpProtocol_SftpMessage_search_req(msg);
+            job->paths[0] = req ? Nexterm_SftpProtocol_SearchReq_search_path(req) : NULL;
+            return;
+        }
+        case Nexterm_SftpProtocol_SftpMsgType_Thumbnail: {
+            Nexterm_SftpProtocol_ThumbnailReq_table_t req = Nexterm_SftpProtocol_SftpMessage_thumbnail_req(msg);
+            job->paths[0] = req ? Nexterm_SftpProtocol_ThumbnailReq_path(req) : NULL;
+            return;
+        }
+        default:
+            return;
+    }
+}
+
+static void sftp_job_free(sftp_job_t* job) {
+    free(job->payload);
+    free(job);
+}
+
+/* True if one path is the other or lies below it. */
+static bool sftp_paths_overlap(const char* a, const char* b) {
+    size_t la = strlen(a), lb = strlen(b);
+    size_t n = la < lb ? la : lb;
+    if (strncmp(a, b, n) != 0) return false;
+    if (la == lb) return true;
+    const char* longer = la > lb ? a : b;
+    return longer[n] == '/' || (n > 0 && longer[n - 1] == '/');
+}
+
+/* Reads never order against reads. A mutation without a path (exec, or a
+ * request missing one) orders against every other mutation. */
+static bool sftp_jobs_conflict(const sftp_job_t* a, const sftp_job_t* b) {
+    if (!a->mutates && !b->mutates) return false;
+    if ((a->mutates && !a->paths[0]) || (b->mutates && !b->paths[0]))
+        return a->mutates && b->mutates;
+
+    for (int i = 0; i < 2; i++)
+        for (int j = 0; j < 2; j++)
+            if (a->paths[i] && b->paths[j] &&
+                sftp_paths_overlap(a->paths[i], b->paths[j]))
+                return true;
+    return false;
+}
+
+typedef struct sftp_pool sftp_pool_t;
+
+typedef struct {
+    sftp_pool_t* pool;
+    sftp_ctx_t ctx;
+    pthread_t thread;
+} sftp_worker_t;
+
+/* Requests in arrival order, queued or running. A job starts once no
+ * earlier one conflicts with it, so changes to a path apply in order while
+ * everything else runs side by side and answers as soon as it is done. */
+struct sftp_pool {
+    fp_out_t out;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    sftp_job_t* head;
+    sftp_job_t* tail;
+    int count;
+    bool stopping;
+    sftp_worker_t workers[SFTP_WORKERS];
+    int nworkers;
+};
+
+static bool sftp_pool_blocked(const sftp_pool_t* p, const sftp_job_t* job) {
+    for (const sftp_job_t* e = p->head; e && e != job; e = e->next)
+        if (sftp_jobs_conflict(e, job)) return true;
+    return false;
+}
+
+static sftp_job_t* sftp_pool_take(sftp_pool_t* p) {
+    for (sftp_job_t* j = p->head; j; j = j->next)
+        if (!j->running && !sftp_pool_blocked(p, j)) return j;
+    return NULL;
+}
+
+static void sftp_pool_remove(sftp_pool_t* p, sftp_job_t* job) {
+    sftp_job_t** link = &p->head;
+    sftp_job_t* prev = NULL;
+    while (*link != job) {
+        prev = *link;
+        link = &prev->next;
+    }
+    *link = job->next;
+    if (p->tail == job) p->tail = prev;
+    p->count--;
+}
+
+static void* sftp_worker_main(void* arg) {
+    sftp_worker_t* w = arg;
+    sftp_pool_t* p = w->pool;
+
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        sftp_job_t* job = NULL;
+        while (!p->stopping && !(job = sftp_pool_take(p)))
+            pthread_cond_wait(&p->cond, &p->lock);
+        if (!job) break;
+
+        job->running = true;
+        pthread_mutex_unlock(&p->lock);
+
+        sftp_run_request(&w->ctx, p->out, job->msg);
+
+        pthread_mutex_lock(&p->lock);
+        sftp_pool_remove(p, job);
+        pthread_cond_broadcast(&p->cond);
+        sftp_job_free(job);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+static void sftp_pool_start(sftp_pool_t* p, sftp_conn_t* conn, fp_out_t out) {
+    memset(p, 0, sizeof(*p));
+    p->out = out;
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->cond, NULL);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, SFTP_WORKER_STACK);
+
+    /* Servers cap channels per connection (MaxSessions); make do with what
+     * we get, down to running everything on the loop thread. */
+    for (int i = 0; i < SFTP_WORKERS; i++) {
+        sftp_worker_t* w = &p->workers[p->nworkers];
+        w->pool = p;
+        w->ctx.conn = conn;
+        SFTP_LOCKED(&w->ctx, w->ctx.sftp = libssh2_sftp_init(conn->ssh));
+        if (!w->ctx.sftp) break;
+        if (pthread_create(&w->thread, &attr, sftp_worker_main, w) != 0) {
+            SFTP_LOCKED(&w->ctx, libssh2_sftp_shutdown(w->ctx.sftp));
+            break;
+        }
+        p->nworkers++;
+    }
+    pthread_attr_destroy(&attr);
+
+    LOG_DEBUG("SFTP: %d request worker(s)", p->nworkers);
+}
+
+static void sftp_pool_stop(sftp_pool_t* p) {
+    pthread_mutex_lock(&p->lock);
+    p->stopping = true;
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+
+    for (int i = 0; i < p->nworkers; i++) {
+        pthread_join(p->workers[i].thread, NULL);
+        libssh2_sftp_shutdown(p->workers[i].ctx.sftp);
+    }
+
+    while (p->head) {
+        sftp_job_t* job = p->head;
+        p->head = job->next;
+        sftp_job_free(job);
+    }
+    pthread_cond_destroy(&p->cond);
+    pthread_mutex_destroy(&p->lock);
+}
+
+static void sftp_pool_submit(sftp_pool_t* p, sftp_job_t* job) {
+    pthread_mutex_lock(&p->lock);
+    while (p->count >= SFTP_QUEUE_MAX)
+        pthread_cond_wait(&p->cond, &p->lock);
+    if (p->tail) p->tail->next = job;
+    else p->head = job;
+    p->tail = job;
+    p->count++;
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+}
+
+static void sftp_pool_wait_clear(sftp_pool_t* p, const sftp_job_t* probe) {
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        bool blocked = false;
+        for (const sftp_job_t* e = p->head; e && !blocked; e = e->next)
+            blocked = sftp_jobs_conflict(e, probe);
+        if (!blocked) break;
+        pthread_cond_wait(&p->cond, &p->lock);
+    }
+    pthread_mutex_unlock(&p->lock);
+}
+
+/* Uploads stay on the loop thread, which owns the write state; everything
+ * else goes to the pool. Takes ownership of payload. */
+static void sftp_dispatch_message(sftp_pool_t* pool, sftp_ctx_t* x, fp_out_t out,
+                                  uint8_t* payload,
+                                  Nexterm_SftpProtocol_SftpMessage_table_t msg,
+                                  sftp_write_state_t* ws) {
+    Nexterm_SftpProtocol_SftpMsgType_enum_t mt =
+        Nexterm_SftpProtocol_SftpMessage_msg_type(msg);
+    uint32_t rid = Nexterm_SftpProtocol_SftpMessage_request_id(msg);
+
+    switch (mt) {
+        case Nexterm_SftpProtocol_SftpMsgType_WriteBegin: {
+            Nexterm_SftpProtocol_WriteBeginReq_table_t req =
+                Nexterm_SftpProtocol_SftpMessage_write_begin_req(msg);
+            sftp_job_t probe = {
+                .paths = { req ? Nexterm_SftpProtocol_WriteBeginReq_path(req) : NULL },
+                .mutates = true,
+            };
+            sftp_pool_wait_clear(pool, &probe);
+        }
+            /* fall through */
+        case Nexterm_SftpProtocol_SftpMsgType_WriteData:
+        case Nexterm_SftpProtocol_SftpMsgType_WriteEnd:
+            dispatch_write_op(mt, x, out, rid, msg, ws);
+            free(payload);
+            return;
+        default:
+            break;
+    }
+
+    sftp_job_t* job = calloc(1, sizeof(*job));
+    if (!job) {
+        fp_send_error(out, rid, "Out of memory", -1);
+        free(payload);
+        return;
+    }
+    job->payload = payload;
+    job->msg = msg;
+    sftp_job_classify(job);
+
+    if (ws->handle) {
+        sftp_job_t upload = { .paths = { ws->path }, .mutates = true };
+        if (sftp_jobs_conflict(job, &upload))
+            sftp_write_pump(x, out, ws, true);
+    }
+
+    if (pool->nworkers == 0) {
+        sftp_run_request(x, out, msg);
+        sftp_job_free(job);
+        return;
+    }
+    sftp_pool_submit(pool, job);
+}
+
+/* Scopes cached thumbnails to the Nexterm account and identity and to the
+ * exact route to the files, so nobody is served a thumbnail they could not
+ * have read themselves. Left empty, disabling the cache, when the account is
+ * unknown or the route does not fit. */
+static void sftp_make_origin(char* origin, const nexterm_session_t* session,
+                             const jump_host_t* jump_hosts, int jump_count) {
+    const char* account  = nexterm_session_get_param(session, "accountId");
+    const char* identity = nexterm_session_get_param(session, "identityId");
+    const char* username = nexterm_session_get_param(session, "username");
+    origin[0] = '\0';
+    if (!account || !account[0]) return;
+
+    int n = snprintf(origin, SFTP_ORIGIN_LEN, "%s|%s|%s@%s:%u", account,
+                     identity ? identity : "", username ? username : "",
+                     session->host, session->port);
+    for (int i = 0; i < jump_count && n > 0 && n < SFTP_ORIGIN_LEN; i++) {
+        const jump_host_t* j = &jump_hosts[i];
+        n += snprintf(origin + n, SFTP_ORIGIN_LEN - (size_t)n, "|%s@%s:%u",
+                      j->username, j->host, j->port);
+    }
+    if (n <= 0 || n >= SFTP_ORIGIN_LEN) origin[0] = '\0';
+}
+
 static void sftp_request_loop(nexterm_session_t* session,
                                LIBSSH2_SFTP* sftp, LIBSSH2_SESSION* ssh,
-                               int data_fd) {
-    sftp_write_state_t ws = { .handle = NULL, .rid = 0,
-                              .buf = NULL, .buf_len = 0, .buf_cap = 0 };
+                               int ssh_sock, int data_fd, const char* origin) {
+    sftp_conn_t conn;
+    memset(&conn, 0, sizeof(conn));
+    conn.ssh = ssh;
+    conn.sock = ssh_sock;
+    pthread_mutex_init(&conn.mu, NULL);
+    pthread_cond_init(&conn.turn, NULL);
+    pthread_mutex_init(&conn.names_lock, NULL);
+    pthread_mutex_init(&conn.send_lock, NULL);
+    snprintf(conn.origin, sizeof(conn.origin), "%s", origin);
+
+    sftp_ctx_t x = { .conn = &conn, .sftp = sftp };
+    fp_out_t out = { .fd = data_fd, .lock = &conn.send_lock };
+    sftp_write_state_t ws;
+    memset(&ws, 0, sizeof(ws));
+
+    sftp_pool_t pool;
+    sftp_pool_start(&pool, &conn, out);
 
     while (session->state == SESSION_STATE_ACTIVE) {
-        struct pollfd pfd = { .fd = data_fd, .events = POLLIN };
-        int ret = poll(&pfd, 1, 1000);
-        if (ret == 0) continue;
+        struct pollfd pfds[2] = {
+            { .fd = data_fd, .events = POLLIN },
+            { .fd = ssh_sock, .events = 0 },
+        };
+        nfds_t nfds = 1;
+        int timeout = 1000;
+        if (sftp_write_pending(&ws)) {
+            pfds[1].events = sftp_poll_events(ws.dirs);
+            nfds = 2;
+            if (pool.nworkers > 0) timeout = SFTP_SHARED_POLL_MS;
+        }
+
+        int ret = poll(pfds, nfds, timeout);
         if (ret < 0) { if (errno == EINTR) continue; break; }
-        if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) break;
+
+        if (nfds == 2 && (ret == 0 || pfds[1].revents))
+            sftp_write_pump(&x, out, &ws, false);
+        if (ret == 0) continue;
+
+        if (pfds[0].revents & (POLLERR | POLLNVAL)) break;
+        if (!(pfds[0].revents & (POLLIN | POLLHUP))) continue;
 
         uint32_t payload_len;
         uint8_t* payload = nexterm_read_frame(data_fd, FP_MAX_FRAME, &payload_len);
@@ -812,15 +1509,21 @@ static void sftp_request_loop(nexterm_session_t* session,
             continue;
         }
 
-        sftp_dispatch_message(sftp, ssh, data_fd, msg, &ws);
-        free(payload);
+        sftp_dispatch_message(&pool, &x, out, payload, msg, &ws);
     }
 
+    sftp_pool_stop(&pool);
+
     if (ws.handle) {
-        sftp_flush_write(sftp, data_fd, &ws);
-        libssh2_sftp_close(ws.handle);
+        sftp_write_pump(&x, out, &ws, true);
+        if (ws.handle) libssh2_sftp_close(ws.handle);
     }
     free(ws.buf);
+    pthread_mutex_destroy(&conn.send_lock);
+    sftp_names_free(&conn.names);
+    pthread_mutex_destroy(&conn.names_lock);
+    pthread_cond_destroy(&conn.turn);
+    pthread_mutex_destroy(&conn.mu);
 }
 
 static void* sftp_session_thread(void* arg) {
@@ -889,7 +1592,8 @@ static void* sftp_session_thread(void* arg) {
     session->state = SESSION_STATE_ACTIVE;
     nexterm_cp_send_session_result(cp, session->session_id, true, NULL, NULL);
 
-    if (fp_send_ready(data_fd) != 0) {
+    /* No worker is running yet, so Ready needs no lock */
+    if (fp_send_ready((fp_out_t){ .fd = data_fd, .lock = NULL }) != 0) {
         LOG_ERROR("SFTP session %s: failed to send Ready", session->session_id);
         goto cleanup;
     }
@@ -897,7 +1601,9 @@ static void* sftp_session_thread(void* arg) {
     LOG_INFO("SFTP session %s active (target=%s:%u, user=%s)",
              session->session_id, session->host, session->port, username);
 
-    sftp_request_loop(session, sftp, ssh, data_fd);
+    char origin[SFTP_ORIGIN_LEN];
+    sftp_make_origin(origin, session, jump_hosts, jump_count);
+    sftp_request_loop(session, sftp, ssh, ssh_sock, data_fd, origin);
 
     LOG_INFO("SFTP session %s ending", session->session_id);
 
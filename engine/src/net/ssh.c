@@ -1,8 +1,10 @@
 #include "ssh.h"
 #include "ssh_common.h"
+#include "ssh_pool.h"
 #include "control_plane.h"
 #include "io.h"
 #include "log.h"
+#include "reactor.h"
 #include "session.h"
 
 extern nexterm_session_manager_t g_session_manager;
@@ -17,8 +19,10 @@ extern nexterm_session_manager_t g_session_manager;
 #include <string.h>
 #include <unistd.h>
 
-#define SSH_READ_BUF_SIZE  16384
 #define SSH_EXEC_BUF_SIZE  (256 * 1024)
+#define SSH_BATCH_MAX_PARALLEL    10
+#define SSH_EXEC_IDLE_MS          30000
+#define SSH_EXEC_STREAM_IDLE_MS   300000
 
 int nexterm_extract_jump_hosts(const nexterm_session_t* session,
                                jump_host_t* jump_hosts,
@@ -63,60 +67,10 @@ typedef struct {
     nexterm_control_plane_t* cp;
 } ssh_thread_args_t;
 
-static void nanosleep_ms(unsigned int ms) {
-    struct timespec ts = {
-        .tv_sec = ms / 1000,
-        .tv_nsec = (ms % 1000) * 1000000L
-    };
-    nanosleep(&ts, NULL);
-}
-
-static int ssh_write_to_channel(LIBSSH2_CHANNEL* channel,
-                                const char* buf, size_t len) {
-    size_t written = 0;
-    while (written < len) {
-        ssize_t w = libssh2_channel_write(channel, buf + written, len - written);
-        if (w == LIBSSH2_ERROR_EAGAIN) {
-            nanosleep_ms(1);
-            continue;
-        }
-        if (w < 0) return -1;
-        written += (size_t)w;
-    }
-    return 0;
-}
-
-static int ssh_read_channel_to_fd(LIBSSH2_CHANNEL* channel, int fd) {
-    char buf[SSH_READ_BUF_SIZE];
-    for (;;) {
-        ssize_t n = libssh2_channel_read(channel, buf, sizeof(buf));
-        if (n == LIBSSH2_ERROR_EAGAIN) return 0;
-        if (n < 0) return -1;
-        if (n == 0) return 0;
-        if (nexterm_write_exact(fd, (const uint8_t*)buf, (size_t)n) != 0) return -1;
-    }
-}
-
-static void ssh_drain_channel(LIBSSH2_CHANNEL* channel, int fd) {
-    char buf[SSH_READ_BUF_SIZE];
-    for (;;) {
-        ssize_t n = libssh2_channel_read(channel, buf, sizeof(buf));
-        if (n <= 0) break;
-        nexterm_write_exact(fd, (const uint8_t*)buf, (size_t)n);
-    }
-}
-
 static void ssh_apply_pending_resize(nexterm_session_t* session,
                                      LIBSSH2_CHANNEL* channel) {
     uint16_t cols, rows;
-    nexterm_sm_lock(&g_session_manager);
-    bool pending = session->resize_pending;
-    cols = session->pending_cols;
-    rows = session->pending_rows;
-    session->resize_pending = false;
-    nexterm_sm_unlock(&g_session_manager);
-
-    if (!pending) return;
+    if (!nexterm_session_take_resize(session, &cols, &rows)) return;
 
     int rc = libssh2_channel_request_pty_size(channel, cols, rows);
     if (rc && rc != LIBSSH2_ERROR_EAGAIN)
@@ -125,52 +79,100 @@ static void ssh_apply_pending_resize(nexterm_session_t* session,
         LOG_DEBUG("SSH session %s: resized to %ux%u", session->session_id, cols, rows);
 }
 
-static bool ssh_bridge_poll(nexterm_session_t* session, int data_fd, int ssh_sock,
-                           LIBSSH2_CHANNEL* channel) {
-    char buf[SSH_READ_BUF_SIZE];
-    struct pollfd fds[2] = {
-        { .fd = data_fd,  .events = POLLIN },
-        { .fd = ssh_sock, .events = POLLIN },
-    };
+typedef struct {
+    nexterm_session_t* session;
+    nexterm_control_plane_t* cp;
+    jump_chain_t jump_chain;
+    ssh_pump_t pump;
+    const char* kind;
+    const char* reason;
+    const char* closed_reason;
+} ssh_bridge_t;
 
-    ssh_apply_pending_resize(session, channel);
+static int ssh_bridge_event(nexterm_reactor_source_t* src,
+                            const nexterm_reactor_events_t* ev, void* data) {
+    ssh_bridge_t* bridge = (ssh_bridge_t*)data;
 
-    int ret = poll(fds, 2, 200);
-    if (ret < 0)
-        return errno == EINTR;
-    if (ret == 0)
-        return true;
+    if (bridge->session->state != SESSION_STATE_ACTIVE)
+        return NEXTERM_REACTOR_CLOSE;
 
-    if (fds[0].revents & POLLIN) {
-        ssize_t n = read(data_fd, buf, sizeof(buf));
-        if (n <= 0) return false;
-        if (ssh_write_to_channel(channel, buf, (size_t)n) != 0) return false;
-    }
+    if (ev->woken)
+        ssh_apply_pending_resize(bridge->session, bridge->pump.channel);
+
+    return nexterm_ssh_pump(&bridge->pump, src, ev);
+}
 
-    if ((fds[1].revents & POLLIN)
-            && ssh_read_channel_to_fd(channel, data_fd) != 0)
-        return false;
+/* Disconnecting the target and every jump host waits on the network, so it
+ * runs on its own thread rather than holding up a reactor worker. */
+static void* ssh_bridge_teardown_thread(void* data) {
+    ssh_bridge_t* bridge = (ssh_bridge_t*)data;
+    nexterm_ssh_full_cleanup(bridge->pump.session, bridge->pump.channel, bridge->pump.sock,
+                             &bridge->jump_chain, bridge->reason);
+    free(bridge);
+    return NULL;
+}
 
-    if (fds[0].revents & (POLLERR | POLLHUP))
-        return false;
+static void ssh_bridge_close(nexterm_reactor_source_t* src, void* data) {
+    ssh_bridge_t* bridge = (ssh_bridge_t*)data;
+    nexterm_session_t* session = bridge->session;
 
-    if (libssh2_channel_eof(channel)) {
-        ssh_drain_channel(channel, data_fd);
-        return false;
-    }
+    LOG_INFO("%s session %s ending", bridge->kind, session->session_id);
 
-    if (fds[1].revents & (POLLERR | POLLHUP)) {
-        ssh_drain_channel(channel, data_fd);
-        return false;
-    }
+    nexterm_sm_lock(&g_session_manager);
+    session->ssh_session = NULL;
+    session->ssh_channel = NULL;
+    session->ssh_sock = -1;
+    session->reactor_source = NULL;
+    nexterm_sm_unlock(&g_session_manager);
+    nexterm_reactor_release(src);
+    close(bridge->pump.fd);
 
-    return true;
+    char sid[MAX_SESSION_ID_LEN];
+    snprintf(sid, sizeof(sid), "%s", session->session_id);
+    nexterm_cp_send_session_closed(bridge->cp, sid, bridge->closed_reason);
+    nexterm_sm_finish(&g_session_manager, sid);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, ssh_bridge_teardown_thread, bridge) == 0)
+        pthread_detach(thread);
+    else
+        ssh_bridge_teardown_thread(bridge);
 }
 
-static void ssh_bridge_data(const nexterm_session_t* session, int data_fd,
-                            LIBSSH2_CHANNEL* channel, int ssh_sock) {
-    while (session->state == SESSION_STATE_ACTIVE
-            && ssh_bridge_poll(session, data_fd, ssh_sock, channel));
+static int ssh_bridge_start(nexterm_session_t* session, nexterm_control_plane_t* cp,
+                            int data_fd, LIBSSH2_SESSION* ssh_session,
+                            LIBSSH2_CHANNEL* channel, int ssh_sock,
+                            const jump_chain_t* jump_chain,
+                            const char* kind, const char* reason,
+                            const char* closed_reason) {
+    ssh_bridge_t* bridge = malloc(sizeof(ssh_bridge_t));
+    if (!bridge) return -1;
+
+    bridge->session = session;
+    bridge->cp = cp;
+    bridge->jump_chain = *jump_chain;
+    bridge->kind = kind;
+    bridge->reason = reason;
+    bridge->closed_reason = closed_reason;
+    nexterm_ssh_pump_init(&bridge->pump, ssh_session, channel, data_fd, ssh_sock);
+
+    int fds[2] = { data_fd, ssh_sock };
+    uint32_t events[2] = { NEXTERM_EV_READ, NEXTERM_EV_READ };
+
+    nexterm_sm_lock(&g_session_manager);
+    nexterm_reactor_source_t* src = nexterm_reactor_add(fds, events, 2,
+            ssh_bridge_event, ssh_bridge_close, bridge);
+    session->reactor_source = src;
+    nexterm_sm_unlock(&g_session_manager);
+
+    if (!src) {
+        LOG_ERROR("%s session %s: failed to register with reactor", kind, session->session_id);
+        free(bridge);
+        return -1;
+    }
+
+    nexterm_reactor_notify(src);
+    return 0;
 }
 
 static void* ssh_session_thread(void* arg) {
@@ -255,9 +257,11 @@ static void* ssh_session_thread(void* arg) {
     LOG_INFO("SSH session %s active (target=%s:%d, user=%s)",
              session->session_id, session->host, session->port, username);
 
-    ssh_bridge_data(session, data_fd, channel, ssh_sock);
-
-    LOG_INFO("SSH session %s ending", session->session_id);
+    if (ssh_bridge_start(session, cp, data_fd, ssh_session, channel, ssh_sock,
+                         &jump_chain, "SSH", "Session ended", "session ended") == 0) {
+        free(args);
+        return NULL;
+    }
 
 cleanup:
     session->ssh_session = NULL;
@@ -393,9 +397,11 @@ static void* tunnel_session_thread(void* arg) {
     LOG_INFO("Tunnel session %s active (%s:%u -> %s:%ld)",
              session->session_id, session->host, session->port, remote_host, remote_port);
 
-    ssh_bridge_data(session, data_fd, channel, ssh_sock);
-
-    LOG_INFO("Tunnel session %s ending", session->session_id);
+    if (ssh_bridge_start(session, cp, data_fd, ssh_session, channel, ssh_sock,
+                         &jump_chain, "Tunnel", "Tunnel ended", "tunnel ended") == 0) {
+        free(args);
+        return NULL;
+    }
 
 cleanup:
     session->ssh_session = NULL;
@@ -447,6 +453,7 @@ typedef struct {
     char* command;
     jump_host_t jump_hosts[MAX_JUMP_HOSTS];
     int jump_count;
+    bool stream;
 } exec_cmd_args_t;
 
 static void exec_cmd_free(exec_cmd_args_t* args) {
@@ -463,70 +470,203 @@ static void exec_cmd_free(exec_cmd_args_t* args) {
     free(args);
 }
 
-static void* exec_command_thread(void* arg) {
-    exec_cmd_args_t* args = (exec_cmd_args_t*)arg;
-    int ssh_sock = -1;
-    LIBSSH2_SESSION* ssh = NULL;
-    LIBSSH2_CHANNEL* channel = NULL;
-    jump_chain_t jump_chain = {0};
-
-    if (nexterm_ssh_setup_with_jumphosts(args->host, args->port,
-            args->jump_hosts, args->jump_count, &ssh_sock, &ssh, &jump_chain) != 0) {
-        nexterm_cp_send_exec_result(args->cp, args->request_id, false,
-                                    NULL, NULL, -1, "Failed to connect to SSH host");
-        exec_cmd_free(args);
-        return NULL;
+typedef struct {
+    char* data;
+    size_t len;
+    size_t cap;
+} exec_buf_t;
+
+typedef int (*exec_sink_fn)(void* ctx, bool is_stderr, const char* data, size_t len);
+
+static int exec_buf_append(exec_buf_t* b, const char* data, size_t len) {
+    size_t room = SSH_EXEC_BUF_SIZE - 1 - b->len;
+    if (len > room) len = room;
+    if (len == 0 && b->data) return 0;
+
+    if (b->len + len + 1 > b->cap) {
+        size_t cap = b->cap ? b->cap : 4096;
+        while (cap < b->len + len + 1) cap *= 2;
+        if (cap > SSH_EXEC_BUF_SIZE) cap = SSH_EXEC_BUF_SIZE;
+        char* p = realloc(b->data, cap);
+        if (!p) return -1;
+        b->data = p;
+        b->cap = cap;
     }
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+    b->data[b->len] = '\0';
+    return 0;
+}
 
-    if (nexterm_ssh_auth(ssh, args->username, args->password,
-                         args->private_key, args->passphrase) != 0) {
-        nexterm_cp_send_exec_result(args->cp, args->request_id, false,
-                                    NULL, NULL, -1, "SSH authentication failed");
-        goto cleanup;
+static bool exec_drain(LIBSSH2_CHANNEL* channel, bool use_stderr, bool* eof,
+                       exec_sink_fn sink, void* ctx, bool* failed) {
+    char tmp[SSH_PUMP_BUF_SIZE];
+    bool progress = false;
+
+    while (!*eof) {
+        ssize_t n = use_stderr
+            ? libssh2_channel_read_stderr(channel, tmp, sizeof(tmp))
+            : libssh2_channel_read(channel, tmp, sizeof(tmp));
+        if (n == LIBSSH2_ERROR_EAGAIN) return progress;
+        if (n < 0) { *failed = true; return true; }
+        if (n == 0) {
+            if (libssh2_channel_eof(channel)) *eof = true;
+            return progress;
+        }
+        progress = true;
+        if (sink(ctx, use_stderr, tmp, (size_t)n) != 0) {
+            *failed = true;
+            return true;
+        }
     }
+    return progress;
+}
 
-    channel = libssh2_channel_open_session(ssh);
-    if (!channel) {
-        nexterm_cp_send_exec_result(args->cp, args->request_id, false,
-                                    NULL, NULL, -1, "Failed to open SSH channel");
-        goto cleanup;
+static int exec_collect(LIBSSH2_SESSION* ssh, int sock, LIBSSH2_CHANNEL* channel,
+                        exec_sink_fn sink, void* ctx, int idle_ms,
+                        const char** err) {
+    bool out_eof = false, err_eof = false, failed = false;
+    int rc = 0;
+
+    libssh2_session_set_blocking(ssh, 0);
+    while (!out_eof || !err_eof) {
+        bool progress = exec_drain(channel, false, &out_eof, sink, ctx, &failed);
+        if (!failed) progress |= exec_drain(channel, true, &err_eof, sink, ctx, &failed);
+        if (failed) {
+            *err = "Failed to read command output";
+            rc = -1;
+            break;
+        }
+        if (progress) continue;
+
+        struct pollfd pfd = { .fd = sock, .events = 0 };
+        int dir = libssh2_session_block_directions(ssh);
+        if (dir & LIBSSH2_SESSION_BLOCK_INBOUND)  pfd.events |= POLLIN;
+        if (dir & LIBSSH2_SESSION_BLOCK_OUTBOUND) pfd.events |= POLLOUT;
+        if (!pfd.events) pfd.events = POLLIN;
+
+        int n = poll(&pfd, 1, idle_ms);
+        if (n < 0 && errno == EINTR) continue;
+        if (n > 0 && !(pfd.revents & (POLLERR | POLLNVAL))) continue;
+
+        *err = n == 0 ? "Command timed out" : "Connection lost";
+        rc = -1;
+        break;
     }
+    libssh2_session_set_blocking(ssh, 1);
+    return rc;
+}
 
-    if (libssh2_channel_exec(channel, args->command) != 0) {
-        nexterm_cp_send_exec_result(args->cp, args->request_id, false,
-                                    NULL, NULL, -1, "Failed to execute command");
-        goto cleanup;
+typedef struct {
+    exec_cmd_args_t* args;
+    nexterm_cp_stream_t* stream;
+    exec_buf_t out;
+    exec_buf_t err;
+} exec_output_t;
+
+static int exec_output_sink(void* ctx, bool is_stderr, const char* data, size_t len) {
+    exec_output_t* o = ctx;
+    if (o->stream)
+        return nexterm_cp_stream_write(o->stream, is_stderr, (const uint8_t*)data, len);
+    return exec_buf_append(is_stderr ? &o->err : &o->out, data, len);
+}
+
+/* Streamed chunks must all be out before the result that ends the request. */
+static void exec_output_finish(exec_output_t* o, bool success, int exit_code,
+                               const char* err) {
+    exec_cmd_args_t* args = o->args;
+    if (o->stream && nexterm_cp_stream_close(o->stream) != 0 && success) {
+        success = false;
+        err = "Failed to send command output";
     }
+    bool buffered = success && !args->stream;
+    nexterm_cp_send_exec_result(args->cp, args->request_id, success,
+                                buffered ? (o->out.data ? o->out.data : "") : NULL,
+                                buffered ? (o->err.data ? o->err.data : "") : NULL,
+                                success ? exit_code : -1, success ? NULL : err);
+    free(o->out.data);
+    free(o->err.data);
+    exec_cmd_free(args);
+}
 
-    {
-        char* stdout_buf = malloc(SSH_EXEC_BUF_SIZE);
-        char* stderr_buf = malloc(SSH_EXEC_BUF_SIZE);
-        if (!stdout_buf || !stderr_buf) {
-            free(stdout_buf);
-            free(stderr_buf);
-            nexterm_cp_send_exec_result(args->cp, args->request_id, false,
-                                        NULL, NULL, -1, "Out of memory");
-            goto cleanup;
+static LIBSSH2_CHANNEL* exec_open_channel(const ssh_pool_target_t* target,
+                                          ssh_pool_conn_t** conn,
+                                          const char** err) {
+    bool fresh = false;
+    for (;;) {
+        int rc = nexterm_ssh_pool_acquire(target, fresh, conn);
+        if (rc != 0) {
+            *err = nexterm_ssh_pool_strerror(rc);
+            return NULL;
         }
 
-        nexterm_ssh_read_stream(channel, stdout_buf, SSH_EXEC_BUF_SIZE, 0);
-        nexterm_ssh_read_stream(channel, stderr_buf, SSH_EXEC_BUF_SIZE, 1);
+        LIBSSH2_CHANNEL* channel =
+            libssh2_channel_open_session(nexterm_ssh_pool_session(*conn));
+        if (channel) return channel;
 
-        libssh2_channel_close(channel);
-        libssh2_channel_wait_closed(channel);
-        int exit_code = libssh2_channel_get_exit_status(channel);
+        bool retry = nexterm_ssh_pool_reused(*conn) && !fresh;
+        nexterm_ssh_pool_release(*conn, false);
+        *conn = NULL;
+        if (!retry) {
+            *err = "Failed to open SSH channel";
+            return NULL;
+        }
+        fresh = true;
+    }
+}
 
-        nexterm_cp_send_exec_result(args->cp, args->request_id, true,
-                                    stdout_buf, stderr_buf, exit_code, NULL);
+static void* exec_command_thread(void* arg) {
+    exec_cmd_args_t* args = (exec_cmd_args_t*)arg;
+    ssh_credentials_t creds = {
+        .username = args->username, .password = args->password,
+        .private_key = args->private_key, .passphrase = args->passphrase,
+    };
+    ssh_pool_target_t target = {
+        .host = args->host, .port = args->port, .creds = &creds,
+        .jump_hosts = args->jump_hosts, .jump_count = args->jump_count,
+    };
+    ssh_pool_conn_t* conn = NULL;
+    const char* err = NULL;
+
+    exec_output_t o = { .args = args };
+    if (args->stream) {
+        o.stream = nexterm_cp_stream_open(args->cp, args->request_id);
+        if (!o.stream) {
+            exec_output_finish(&o, false, -1, "Failed to stream command output");
+            return NULL;
+        }
+    }
 
-        free(stdout_buf);
-        free(stderr_buf);
-        channel = NULL;
+    LIBSSH2_CHANNEL* channel = exec_open_channel(&target, &conn, &err);
+    if (!channel) {
+        exec_output_finish(&o, false, -1, err);
+        return NULL;
     }
 
-cleanup:
-    nexterm_ssh_full_cleanup(ssh, channel, ssh_sock, &jump_chain, "Done");
-    exec_cmd_free(args);
+    if (libssh2_channel_exec(channel, args->command) != 0) {
+        libssh2_channel_free(channel);
+        nexterm_ssh_pool_release(conn, false);
+        exec_output_finish(&o, false, -1, "Failed to execute command");
+        return NULL;
+    }
+
+    if (exec_collect(nexterm_ssh_pool_session(conn), nexterm_ssh_pool_socket(conn),
+                     channel, exec_output_sink, &o,
+                     args->stream ? SSH_EXEC_STREAM_IDLE_MS : SSH_EXEC_IDLE_MS,
+                     &err) != 0) {
+        libssh2_channel_free(channel);
+        nexterm_ssh_pool_release(conn, false);
+        exec_output_finish(&o, false, -1, err);
+        return NULL;
+    }
+
+    libssh2_channel_close(channel);
+    bool healthy = libssh2_channel_wait_closed(channel) == 0;
+    int exit_code = libssh2_channel_get_exit_status(channel);
+    libssh2_channel_free(channel);
+    nexterm_ssh_pool_release(conn, healthy);
+
+    exec_output_finish(&o, true, exit_code, NULL);
     return NULL;
 }
 
@@ -536,7 +676,8 @@ int nexterm_ssh_exec_command(nexterm_control_plane_t* cp,
                              const ssh_credentials_t* creds,
                              const char* command,
                              const jump_host_t* jump_hosts,
-                             int jump_count) {
+                             int jump_count,
+                             bool stream) {
     exec_cmd_args_t* args = calloc(1, sizeof(exec_cmd_args_t));
     if (!args) return -1;
 
@@ -549,6 +690,7 @@ int nexterm_ssh_exec_command(nexterm_control_plane_t* cp,
     args->private_key = strdup(creds->private_key ? creds->private_key : "");
     args->passphrase = strdup(creds->passphrase ? creds->passphrase : "");
     args->command = strdup(command ? command : "");
+    args->stream = stream;
 
     if (!args->username || !args->password || !args->private_key ||
         !args->passphrase || !args->command) {
@@ -590,6 +732,8 @@ typedef struct {
     int command_count;
     jump_host_t jump_hosts[MAX_JUMP_HOSTS];
     int jump_count;
+    int parallelism;
+    bool stream;
 } exec_batch_args_t;
 
 static void exec_batch_free(exec_batch_args_t* args) {
@@ -613,106 +757,292 @@ static void exec_batch_free(exec_batch_args_t* args) {
     free(args);
 }
 
-static void exec_batch_run_one(LIBSSH2_SESSION* ssh, const char* command,
-                               exec_batch_entry_t* entry,
-                               char** out_stdout, char** out_stderr) {
-    *out_stdout = NULL;
-    *out_stderr = NULL;
-    entry->success = false;
-    entry->exit_code = -1;
+typedef enum {
+    BATCH_PENDING,
+    BATCH_OPEN,
+    BATCH_EXEC,
+    BATCH_READ,
+    BATCH_CLOSE,
+    BATCH_WAIT_CLOSED,
+    BATCH_FREE,
+    BATCH_DONE,
+} batch_state_t;
 
-    LIBSSH2_CHANNEL* channel = libssh2_channel_open_session(ssh);
-    if (!channel) {
-        entry->error_message = "Failed to open SSH channel";
-        return;
-    }
+typedef struct {
+    batch_state_t state;
+    LIBSSH2_CHANNEL* channel;
+    exec_buf_t out;
+    exec_buf_t err;
+    bool out_eof;
+    bool err_eof;
+} batch_job_t;
 
-    if (libssh2_channel_exec(channel, command) != 0) {
-        entry->error_message = "Failed to execute command";
-        libssh2_channel_free(channel);
-        return;
+typedef struct {
+    exec_batch_args_t* args;
+    LIBSSH2_SESSION* ssh;
+    batch_job_t* jobs;
+    exec_batch_entry_t* entries;
+    int limit;
+    int active;
+    int done;
+    bool opening;
+    bool opened_any;
+    bool retry_allowed;
+    bool retry;
+} batch_run_t;
+
+static int batch_sink(void* ctx, bool is_stderr, const char* data, size_t len) {
+    batch_job_t* job = ctx;
+    return exec_buf_append(is_stderr ? &job->err : &job->out, data, len);
+}
+
+static void batch_finish(batch_run_t* r, int i) {
+    batch_job_t* job = &r->jobs[i];
+    exec_batch_entry_t* e = &r->entries[i];
+
+    if (job->state != BATCH_PENDING) r->active--;
+    job->state = BATCH_DONE;
+    r->done++;
+
+    if (e->success) {
+        e->stdout_data = job->out.data ? job->out.data : "";
+        e->stderr_data = job->err.data ? job->err.data : "";
     }
+    if (r->args->stream)
+        nexterm_cp_send_exec_batch_entry(r->args->cp, r->args->request_id, e);
+}
 
-    char* stdout_buf = malloc(SSH_EXEC_BUF_SIZE);
-    char* stderr_buf = malloc(SSH_EXEC_BUF_SIZE);
-    if (!stdout_buf || !stderr_buf) {
-        free(stdout_buf);
-        free(stderr_buf);
-        entry->error_message = "Out of memory";
-        libssh2_channel_free(channel);
-        return;
+static void batch_fail(batch_run_t* r, int i, const char* message) {
+    r->entries[i].success = false;
+    r->entries[i].exit_code = -1;
+    r->entries[i].error_message = message;
+    if (r->jobs[i].channel)
+        r->jobs[i].state = BATCH_FREE;
+    else
+        batch_finish(r, i);
+}
+
+static bool batch_step(batch_run_t* r, int i) {
+    batch_job_t* job = &r->jobs[i];
+    int rc;
+
+    switch (job->state) {
+        case BATCH_OPEN:
+            job->channel = libssh2_channel_open_session(r->ssh);
+            if (job->channel) {
+                r->opening = false;
+                r->opened_any = true;
+                job->state = BATCH_EXEC;
+                return true;
+            }
+            if (libssh2_session_last_errno(r->ssh) == LIBSSH2_ERROR_EAGAIN) return false;
+            r->opening = false;
+            if (!r->opened_any && r->retry_allowed) {
+                r->retry = true;
+                return true;
+            }
+            if (r->active > 1) {
+                r->limit = r->active - 1;
+                r->active--;
+                job->state = BATCH_PENDING;
+                LOG_DEBUG("ExecBatch %s: channel limit reached, parallelism now %d",
+                          r->args->request_id, r->limit);
+            } else {
+                batch_fail(r, i, "Failed to open SSH channel");
+            }
+            return true;
+
+        case BATCH_EXEC:
+            rc = libssh2_channel_exec(job->channel, r->args->commands[i]);
+            if (rc == LIBSSH2_ERROR_EAGAIN) return false;
+            if (rc != 0) {
+                batch_fail(r, i, "Failed to execute command");
+                return true;
+            }
+            job->state = BATCH_READ;
+            return true;
+
+        case BATCH_READ: {
+            bool failed = false;
+            bool progress = exec_drain(job->channel, false, &job->out_eof,
+                                       batch_sink, job, &failed);
+            if (!failed)
+                progress |= exec_drain(job->channel, true, &job->err_eof,
+                                       batch_sink, job, &failed);
+            if (failed) {
+                batch_fail(r, i, "Failed to read command output");
+                return true;
+            }
+            if (!job->out_eof || !job->err_eof) return progress;
+            job->state = BATCH_CLOSE;
+            return true;
+        }
+
+        case BATCH_CLOSE:
+            rc = libssh2_channel_close(job->channel);
+            if (rc == LIBSSH2_ERROR_EAGAIN) return false;
+            job->state = BATCH_WAIT_CLOSED;
+            return true;
+
+        case BATCH_WAIT_CLOSED:
+            rc = libssh2_channel_wait_closed(job->channel);
+            if (rc == LIBSSH2_ERROR_EAGAIN) return false;
+            r->entries[i].success = true;
+            r->entries[i].exit_code = libssh2_channel_get_exit_status(job->channel);
+            r->entries[i].error_message = NULL;
+            job->state = BATCH_FREE;
+            return true;
+
+        case BATCH_FREE:
+            rc = libssh2_channel_free(job->channel);
+            if (rc == LIBSSH2_ERROR_EAGAIN) return false;
+            job->channel = NULL;
+            batch_finish(r, i);
+            return true;
+
+        default:
+            return false;
     }
+}
 
-    nexterm_ssh_read_stream(channel, stdout_buf, SSH_EXEC_BUF_SIZE, 0);
-    nexterm_ssh_read_stream(channel, stderr_buf, SSH_EXEC_BUF_SIZE, 1);
+static int batch_run(batch_run_t* r, int sock) {
+    int count = r->args->command_count;
+    int rc = 0;
 
-    libssh2_channel_close(channel);
-    libssh2_channel_wait_closed(channel);
-    entry->exit_code = libssh2_channel_get_exit_status(channel);
-    libssh2_channel_free(channel);
+    libssh2_session_set_blocking(r->ssh, 0);
+
+    while (r->done < count && !r->retry) {
+        bool progress = false;
+
+        if (!r->opening && r->active < r->limit) {
+            for (int i = 0; i < count; i++) {
+                if (r->jobs[i].state != BATCH_PENDING) continue;
+                r->jobs[i].state = BATCH_OPEN;
+                r->opening = true;
+                r->active++;
+                progress = true;
+                break;
+            }
+        }
 
-    *out_stdout = stdout_buf;
-    *out_stderr = stderr_buf;
-    entry->success = true;
-    entry->stdout_data = stdout_buf;
-    entry->stderr_data = stderr_buf;
-    entry->error_message = NULL;
+        for (int i = 0; i < count; i++)
+            progress |= batch_step(r, i);
+
+        if (progress) continue;
+
+        struct pollfd pfd = { .fd = sock, .events = 0 };
+        int dir = libssh2_session_block_directions(r->ssh);
+        if (dir & LIBSSH2_SESSION_BLOCK_INBOUND)  pfd.events |= POLLIN;
+        if (dir & LIBSSH2_SESSION_BLOCK_OUTBOUND) pfd.events |= POLLOUT;
+        if (!pfd.events) pfd.events = POLLIN;
+
+        int n = poll(&pfd, 1, SSH_EXEC_IDLE_MS);
+        if (n < 0 && errno == EINTR) continue;
+        if (n > 0 && !(pfd.revents & (POLLERR | POLLNVAL))) continue;
+
+        for (int i = 0; i < count; i++) {
+            if (r->jobs[i].state == BATCH_DONE) continue;
+            r->entries[i].success = false;
+            r->entries[i].exit_code = -1;
+            r->entries[i].error_message = n == 0 ? "Command timed out" : "Connection lost";
+            batch_finish(r, i);
+        }
+        rc = -1;
+    }
+    if (r->retry) rc = -1;
+
+    libssh2_session_set_blocking(r->ssh, 1);
+    return rc;
+}
+
+static void batch_reset(batch_run_t* r) {
+    for (int i = 0; i < r->args->command_count; i++) {
+        free(r->jobs[i].out.data);
+        free(r->jobs[i].err.data);
+        memset(&r->jobs[i], 0, sizeof(batch_job_t));
+        memset(&r->entries[i], 0, sizeof(exec_batch_entry_t));
+        r->entries[i].id = r->args->ids[i];
+        r->entries[i].exit_code = -1;
+    }
+    r->active = 0;
+    r->done = 0;
+    r->opening = false;
+    r->opened_any = false;
+    r->retry_allowed = false;
+    r->retry = false;
 }
 
 static void* exec_batch_thread(void* arg) {
     exec_batch_args_t* a = (exec_batch_args_t*)arg;
-    int ssh_sock = -1;
-    LIBSSH2_SESSION* ssh = NULL;
-    jump_chain_t jump_chain = {0};
-
-    if (nexterm_ssh_setup_with_jumphosts(a->host, a->port,
-            a->jump_hosts, a->jump_count, &ssh_sock, &ssh, &jump_chain) != 0) {
-        nexterm_cp_send_exec_batch_result(a->cp, a->request_id, false,
-                                          "Failed to connect to SSH host", NULL, 0);
-        exec_batch_free(a);
-        return NULL;
-    }
+    ssh_credentials_t creds = {
+        .username = a->username, .password = a->password,
+        .private_key = a->private_key, .passphrase = a->passphrase,
+    };
+    ssh_pool_target_t target = {
+        .host = a->host, .port = a->port, .creds = &creds,
+        .jump_hosts = a->jump_hosts, .jump_count = a->jump_count,
+    };
+    ssh_pool_conn_t* conn = NULL;
 
-    if (nexterm_ssh_auth(ssh, a->username, a->password,
-                         a->private_key, a->passphrase) != 0) {
+    int rc = nexterm_ssh_pool_acquire(&target, false, &conn);
+    if (rc != 0) {
         nexterm_cp_send_exec_batch_result(a->cp, a->request_id, false,
-                                          "SSH authentication failed", NULL, 0);
-        nexterm_ssh_full_cleanup(ssh, NULL, ssh_sock, &jump_chain, "Auth failed");
+                                          nexterm_ssh_pool_strerror(rc), NULL, 0);
         exec_batch_free(a);
         return NULL;
     }
 
-    exec_batch_entry_t* entries = calloc(a->command_count, sizeof(exec_batch_entry_t));
-    char** outs = calloc(a->command_count, sizeof(char*));
-    char** errs = calloc(a->command_count, sizeof(char*));
-    if (!entries || !outs || !errs) {
-        free(entries);
-        free(outs);
-        free(errs);
+    batch_run_t run = {
+        .args = a,
+        .jobs = calloc(a->command_count, sizeof(batch_job_t)),
+        .entries = calloc(a->command_count, sizeof(exec_batch_entry_t)),
+    };
+    if (!run.jobs || !run.entries) {
+        free(run.jobs);
+        free(run.entries);
         nexterm_cp_send_exec_batch_result(a->cp, a->request_id, false,
                                           "Out of memory", NULL, 0);
-        nexterm_ssh_full_cleanup(ssh, NULL, ssh_sock, &jump_chain, "OOM");
+        nexterm_ssh_pool_release(conn, true);
         exec_batch_free(a);
         return NULL;
     }
 
-    for (int i = 0; i < a->command_count; i++) {
-        entries[i].id = a->ids[i];
-        exec_batch_run_one(ssh, a->commands[i], &entries[i], &outs[i], &errs[i]);
+    batch_reset(&run);
+    run.ssh = nexterm_ssh_pool_session(conn);
+    run.limit = a->parallelism;
+    run.retry_allowed = nexterm_ssh_pool_reused(conn);
+
+    bool healthy = batch_run(&run, nexterm_ssh_pool_socket(conn)) == 0;
+
+    if (run.retry) {
+        nexterm_ssh_pool_release(conn, false);
+        conn = NULL;
+        rc = nexterm_ssh_pool_acquire(&target, true, &conn);
+        if (rc == 0) {
+            batch_reset(&run);
+            run.ssh = nexterm_ssh_pool_session(conn);
+            run.limit = a->parallelism;
+            healthy = batch_run(&run, nexterm_ssh_pool_socket(conn)) == 0;
+        }
     }
 
-    nexterm_cp_send_exec_batch_result(a->cp, a->request_id, true, NULL,
-                                      entries, (size_t)a->command_count);
+    if (conn) {
+        nexterm_cp_send_exec_batch_result(a->cp, a->request_id, true, NULL,
+                                          a->stream ? NULL : run.entries,
+                                          a->stream ? 0 : (size_t)a->command_count);
+        nexterm_ssh_pool_release(conn, healthy);
+    } else {
+        nexterm_cp_send_exec_batch_result(a->cp, a->request_id, false,
+                                          nexterm_ssh_pool_strerror(rc), NULL, 0);
+    }
 
     for (int i = 0; i < a->command_count; i++) {
-        free(outs[i]);
-        free(errs[i]);
+        free(run.jobs[i].out.data);
+        free(run.jobs[i].err.data);
     }
-    free(outs);
-    free(errs);
-    free(entries);
+    free(run.jobs);
+    free(run.entries);
 
-    nexterm_ssh_full_cleanup(ssh, NULL, ssh_sock, &jump_chain, "Batch done");
     exec_batch_free(a);
     return NULL;
 }
@@ -725,7 +1055,9 @@ int nexterm_ssh_exec_batch(nexterm_control_plane_t* cp,
                            const char* const* commands,
                            int command_count,
                            const jump_host_t* jump_hosts,
-                           int jump_count) {
+                           int jump_count,
+                           int parallelism,
+                           bool stream) {
     if (command_count <= 0) {
         nexterm_cp_send_exec_batch_result(cp, request_id, false,
                                           "No commands supplied", NULL, 0);
@@ -745,6 +1077,9 @@ int nexterm_ssh_exec_batch(nexterm_control_plane_t* cp,
     args->passphrase = strdup(creds->passphrase ? creds->passphrase : "");
 
     args->command_count = command_count;
+    args->parallelism = parallelism < 1 ? 1 : parallelism;
+    if (args->parallelism > SSH_BATCH_MAX_PARALLEL) args->parallelism = SSH_BATCH_MAX_PARALLEL;
+    args->stream = stream;
     args->ids = calloc(command_count, sizeof(char*));
     args->commands = calloc(command_count, sizeof(char*));
     if (!args->username || !args->password || !args->private_key ||
@@ -28,7 +28,8 @@ int nexterm_ssh_exec_command(struct nexterm_control_plane* cp,
                              const ssh_credentials_t* creds,
                              const char* command,
                              const jump_host_t* jump_hosts,
-                             int jump_count);
+                             int jump_count,
+                             bool stream);
 
 int nexterm_ssh_exec_batch(struct nexterm_control_plane* cp,
                            const char* request_id,
@@ -38,7 +39,9 @@ int nexterm_ssh_exec_batch(struct nexterm_control_plane* cp,
                            const char* const* commands,
                            int command_count,
                            const jump_host_t* jump_hosts,
-                           int jump_count);
+                           int jump_count,
+                           int parallelism,
+                           bool stream);
 
 int nexterm_extract_jump_hosts(const nexterm_session_t* session,
                                jump_host_t* jump_hosts,
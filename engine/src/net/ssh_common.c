@@ -11,6 +11,8 @@
 #include <sys/socket.h>
 #include <poll.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
 #include <stdlib.h>
 
 int nexterm_ssh_setup(const char* host, uint16_t port,
@@ -40,93 +42,178 @@ int nexterm_ssh_setup(const char* host, uint16_t port,
     return 0;
 }
 
-typedef struct {
-    LIBSSH2_SESSION* parent_session;
-    LIBSSH2_CHANNEL* channel;
-    int sockfd;
-    int parent_sock;
-    volatile int* stop;
-} channel_proxy_ctx_t;
-
-static void* channel_proxy_thread(void* arg) {
-    channel_proxy_ctx_t* ctx = (channel_proxy_ctx_t*)arg;
-    LIBSSH2_SESSION* parent_session = ctx->parent_session;
-    LIBSSH2_CHANNEL* channel = ctx->channel;
-    int sockfd = ctx->sockfd;
-    int parent_sock = ctx->parent_sock;
-    volatile int* stop = ctx->stop;
-    free(ctx);
-
-    char buf[16384];
-    int was_blocking = libssh2_session_get_blocking(parent_session);
-    libssh2_session_set_blocking(parent_session, 0);
+#define SSH_PUMP_MAX_ROUNDS 32
+
+static void ssh_pump_set_blocking(int fd, bool blocking) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0) return;
+    fcntl(fd, F_SETFL, blocking ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK));
+}
+
+static bool ssh_pump_would_block(ssize_t n) {
+    return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+}
+
+/* After channel EOF or transport hangup, flushes what libssh2 still holds
+ * to fd without ever blocking the reactor worker: a slow reader just keeps
+ * the source parked on EV_WRITE until the tail is out. */
+static int ssh_pump_drain(ssh_pump_t* pump, nexterm_reactor_source_t* src,
+                          const nexterm_reactor_events_t* ev) {
+    if ((ev->revents[0] & NEXTERM_EV_HUP) && pump->down_len > 0)
+        return NEXTERM_REACTOR_CLOSE;
+
+    for (int round = 0; round < SSH_PUMP_MAX_ROUNDS; round++) {
+        if (pump->down_len == 0) {
+            ssize_t n = libssh2_channel_read(pump->channel, pump->down, sizeof(pump->down));
+            if (n <= 0) return NEXTERM_REACTOR_CLOSE;
+            pump->down_len = (size_t)n;
+            pump->down_off = 0;
+        }
+
+        ssize_t w = write(pump->fd, pump->down + pump->down_off,
+                          pump->down_len - pump->down_off);
+        if (w < 0 && !ssh_pump_would_block(w))
+            return NEXTERM_REACTOR_CLOSE;
+        if (w <= 0) {
+            nexterm_reactor_watch(src, 0, NEXTERM_EV_WRITE);
+            nexterm_reactor_watch(src, 1, 0);
+            return NEXTERM_REACTOR_CONTINUE;
+        }
+        pump->down_off += (size_t)w;
+        if (pump->down_off == pump->down_len)
+            pump->down_len = pump->down_off = 0;
+    }
+
+    nexterm_reactor_watch(src, 0, pump->down_len > 0 ? NEXTERM_EV_WRITE : 0);
+    nexterm_reactor_watch(src, 1, 0);
+    nexterm_reactor_notify(src);
+    return NEXTERM_REACTOR_CONTINUE;
+}
+
+static void ssh_pump_watch(ssh_pump_t* pump, nexterm_reactor_source_t* src) {
+    uint32_t fd_events = 0;
+    if (pump->up_len == 0) fd_events |= NEXTERM_EV_READ;
+    if (pump->down_len > 0) fd_events |= NEXTERM_EV_WRITE;
+
+    int dirs = libssh2_session_block_directions(pump->session);
+    uint32_t sock_events = 0;
+    if (pump->down_len == 0 || (dirs & LIBSSH2_SESSION_BLOCK_INBOUND))
+        sock_events |= NEXTERM_EV_READ;
+    if (dirs & LIBSSH2_SESSION_BLOCK_OUTBOUND)
+        sock_events |= NEXTERM_EV_WRITE;
+
+    nexterm_reactor_watch(src, 0, fd_events);
+    nexterm_reactor_watch(src, 1, sock_events);
+}
+
+void nexterm_ssh_pump_init(ssh_pump_t* pump, LIBSSH2_SESSION* session,
+                           LIBSSH2_CHANNEL* channel, int fd, int sock) {
+    pump->session = session;
+    pump->channel = channel;
+    pump->fd = fd;
+    pump->sock = sock;
+    pump->up_len = pump->up_off = 0;
+    pump->down_len = pump->down_off = 0;
+    pump->draining = false;
+    ssh_pump_set_blocking(fd, false);
+}
+
+int nexterm_ssh_pump(ssh_pump_t* pump, nexterm_reactor_source_t* src,
+                     const nexterm_reactor_events_t* ev) {
+    bool progress = true;
+    int round = 0;
+
+    if (pump->draining)
+        return ssh_pump_drain(pump, src, ev);
+
+    for (; progress && round < SSH_PUMP_MAX_ROUNDS; round++) {
+        progress = false;
 
-    while (!*stop) {
-        for (;;) {
-            ssize_t n = libssh2_channel_read(channel, buf, sizeof(buf));
+        if (pump->up_len == 0) {
+            ssize_t n = read(pump->fd, pump->up, sizeof(pump->up));
+            if (n == 0 || (n < 0 && !ssh_pump_would_block(n)))
+                return NEXTERM_REACTOR_CLOSE;
             if (n > 0) {
-                ssize_t off = 0;
-                while (off < n) {
-                    ssize_t w = write(sockfd, buf + off, (size_t)(n - off));
-                    if (w <= 0) goto done;
-                    off += w;
-                }
-                continue;
+                pump->up_len = (size_t)n;
+                pump->up_off = 0;
+                progress = true;
             }
-            if (n == 0) {
-                if (libssh2_channel_eof(channel)) goto done;
-                break;
-            }
-            if (n == LIBSSH2_ERROR_EAGAIN) break;
-            goto done;
         }
 
-        struct pollfd fds[2] = {
-            { .fd = sockfd,      .events = POLLIN, .revents = 0 },
-            { .fd = parent_sock, .events = POLLIN, .revents = 0 },
-        };
-        int ret = poll(fds, 2, 200);
-        if (ret < 0) {
-            if (errno == EINTR) continue;
-            goto done;
+        if (pump->up_len > 0) {
+            ssize_t w = libssh2_channel_write(pump->channel, pump->up + pump->up_off,
+                                              pump->up_len - pump->up_off);
+            if (w < 0 && w != LIBSSH2_ERROR_EAGAIN)
+                return NEXTERM_REACTOR_CLOSE;
+            if (w > 0) {
+                pump->up_off += (size_t)w;
+                if (pump->up_off == pump->up_len)
+                    pump->up_len = pump->up_off = 0;
+                progress = true;
+            }
         }
 
-        if (fds[0].revents & POLLIN) {
-            ssize_t nr = read(sockfd, buf, sizeof(buf));
-            if (nr <= 0) goto done;
-            ssize_t off = 0;
-            while (off < nr) {
-                ssize_t w = libssh2_channel_write(channel, buf + off, (size_t)(nr - off));
-                if (w == LIBSSH2_ERROR_EAGAIN) {
-                    struct pollfd wp = { .fd = parent_sock, .events = POLLOUT, .revents = 0 };
-                    poll(&wp, 1, 1000);
-                    continue;
-                }
-                if (w < 0) goto done;
-                off += w;
+        if (pump->down_len == 0) {
+            ssize_t n = libssh2_channel_read(pump->channel, pump->down, sizeof(pump->down));
+            if (n < 0 && n != LIBSSH2_ERROR_EAGAIN)
+                return NEXTERM_REACTOR_CLOSE;
+            if (n > 0) {
+                pump->down_len = (size_t)n;
+                pump->down_off = 0;
+                progress = true;
             }
         }
 
-        if (fds[0].revents & (POLLHUP | POLLERR)) goto done;
-        if (fds[1].revents & (POLLHUP | POLLERR)) {
-            for (;;) {
-                ssize_t n = libssh2_channel_read(channel, buf, sizeof(buf));
-                if (n <= 0) break;
-                ssize_t off = 0;
-                while (off < n) {
-                    ssize_t w = write(sockfd, buf + off, (size_t)(n - off));
-                    if (w <= 0) goto done;
-                    off += w;
-                }
+        if (pump->down_len > 0) {
+            ssize_t w = write(pump->fd, pump->down + pump->down_off,
+                              pump->down_len - pump->down_off);
+            if (w < 0 && !ssh_pump_would_block(w))
+                return NEXTERM_REACTOR_CLOSE;
+            if (w > 0) {
+                pump->down_off += (size_t)w;
+                if (pump->down_off == pump->down_len)
+                    pump->down_len = pump->down_off = 0;
+                progress = true;
             }
-            goto done;
+        }
+
+        if (libssh2_channel_eof(pump->channel)) {
+            pump->draining = true;
+            return ssh_pump_drain(pump, src, ev);
         }
     }
 
-done:
-    libssh2_session_set_blocking(parent_session, was_blocking);
-    close(sockfd);
-    return NULL;
+    if (!progress && (ev->revents[1] & NEXTERM_EV_HUP)) {
+        pump->draining = true;
+        return ssh_pump_drain(pump, src, ev);
+    }
+    if (!progress && (ev->revents[0] & NEXTERM_EV_HUP) && pump->down_len > 0)
+        return NEXTERM_REACTOR_CLOSE;
+
+    ssh_pump_watch(pump, src);
+    if (progress)
+        nexterm_reactor_notify(src);
+
+    return NEXTERM_REACTOR_CONTINUE;
+}
+
+typedef struct {
+    ssh_pump_t pump;
+    int was_blocking;
+} channel_proxy_t;
+
+static int channel_proxy_event(nexterm_reactor_source_t* src,
+                               const nexterm_reactor_events_t* ev, void* data) {
+    channel_proxy_t* proxy = (channel_proxy_t*)data;
+    return nexterm_ssh_pump(&proxy->pump, src, ev);
+}
+
+static void channel_proxy_close(nexterm_reactor_source_t* src, void* data) {
+    (void)src;
+    channel_proxy_t* proxy = (channel_proxy_t*)data;
+    libssh2_session_set_blocking(proxy->pump.session, proxy->was_blocking);
+    close(proxy->pump.fd);
+    free(proxy);
 }
 
 static int ssh_setup_on_channel(jump_chain_t* chain,
@@ -141,27 +228,30 @@ static int ssh_setup_on_channel(jump_chain_t* chain,
         return -1;
     }
 
-    channel_proxy_ctx_t* ctx = malloc(sizeof(channel_proxy_ctx_t));
-    if (!ctx) {
+    channel_proxy_t* proxy = malloc(sizeof(channel_proxy_t));
+    if (!proxy) {
         close(sv[0]);
         close(sv[1]);
         return -1;
     }
-    ctx->parent_session = parent_session;
-    ctx->channel = channel;
-    ctx->sockfd = sv[1];
-    ctx->parent_sock = parent_sock;
-    ctx->stop = &chain->stop_proxies;
-
-    pthread_t tid;
-    if (pthread_create(&tid, NULL, channel_proxy_thread, ctx) != 0) {
-        LOG_ERROR("Failed to create channel proxy thread");
-        free(ctx);
+    proxy->was_blocking = libssh2_session_get_blocking(parent_session);
+    libssh2_session_set_blocking(parent_session, 0);
+    nexterm_ssh_pump_init(&proxy->pump, parent_session, channel, sv[1], parent_sock);
+
+    int fds[2] = { sv[1], parent_sock };
+    uint32_t events[2] = { NEXTERM_EV_READ, NEXTERM_EV_READ };
+    nexterm_reactor_source_t* src = nexterm_reactor_add(fds, events, 2,
+            channel_proxy_event, channel_proxy_close, proxy);
+    if (!src) {
+        LOG_ERROR("Failed to register channel proxy");
+        libssh2_session_set_blocking(parent_session, proxy->was_blocking);
+        free(proxy);
         close(sv[0]);
         close(sv[1]);
         return -1;
     }
-    chain->proxies[chain->proxy_count++] = tid;
+    chain->proxies[chain->proxy_count++] = src;
+    nexterm_reactor_notify(src);
 
     LIBSSH2_SESSION* session = libssh2_session_init();
     if (!session) {
@@ -308,7 +398,9 @@ void nexterm_ssh_teardown(LIBSSH2_SESSION* session, LIBSSH2_CHANNEL* channel,
 void nexterm_jump_chain_teardown(jump_chain_t* chain) {
     if (!chain) return;
 
-    chain->stop_proxies = 1;
+    for (int i = 0; i < chain->proxy_count; i++)
+        nexterm_reactor_remove(chain->proxies[i]);
+    chain->proxy_count = 0;
 
     for (int i = chain->count - 1; i >= 0; i--) {
         if (chain->sockets[i] >= 0) {
@@ -317,10 +409,6 @@ void nexterm_jump_chain_teardown(jump_chain_t* chain) {
         }
     }
 
-    for (int i = 0; i < chain->proxy_count; i++)
-        pthread_join(chain->proxies[i], NULL);
-    chain->proxy_count = 0;
-
     for (int i = chain->count - 1; i >= 0; i--) {
         if (chain->channels[i]) {
             libssh2_channel_free(chain->channels[i]);
@@ -344,21 +432,3 @@ void nexterm_ssh_full_cleanup(LIBSSH2_SESSION* session, LIBSSH2_CHANNEL* channel
         if (sock >= 0) close(sock);
     }
 }
-
-void nexterm_ssh_read_stream(LIBSSH2_CHANNEL* channel, char* buf,
-                             size_t buf_sz, int use_stderr) {
-    char tmp[4096];
-    size_t len = 0;
-
-    while (len < buf_sz - 1) {
-        ssize_t n = use_stderr
-            ? libssh2_channel_read_stderr(channel, tmp, sizeof(tmp))
-            : libssh2_channel_read(channel, tmp, sizeof(tmp));
-        if (n <= 0) break;
-        size_t remaining = buf_sz - 1 - len;
-        size_t copy = ((size_t)n <= remaining) ? (size_t)n : remaining;
-        memcpy(buf + len, tmp, copy);
-        len += copy;
-    }
-    buf[len] = '\0';
-}
@@ -1,11 +1,16 @@
 #ifndef NEXTERM_SSH_COMMON_H
 #define NEXTERM_SSH_COMMON_H
 
+#include "reactor.h"
+
 #include <libssh2.h>
 #include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #define MAX_JUMP_HOSTS 8
+#define SSH_PUMP_BUF_SIZE 16384
 
 typedef struct {
     char host[256];
@@ -20,12 +25,23 @@ typedef struct {
     LIBSSH2_SESSION* sessions[MAX_JUMP_HOSTS];
     LIBSSH2_CHANNEL* channels[MAX_JUMP_HOSTS];
     int sockets[MAX_JUMP_HOSTS];
-    pthread_t proxies[MAX_JUMP_HOSTS];
+    nexterm_reactor_source_t* proxies[MAX_JUMP_HOSTS];
     int proxy_count;
-    volatile int stop_proxies;
     int count;
 } jump_chain_t;
 
+typedef struct {
+    LIBSSH2_SESSION* session;
+    LIBSSH2_CHANNEL* channel;
+    int fd;
+    int sock;
+    char up[SSH_PUMP_BUF_SIZE];
+    size_t up_len, up_off;
+    char down[SSH_PUMP_BUF_SIZE];
+    size_t down_len, down_off;
+    bool draining;
+} ssh_pump_t;
+
 int nexterm_ssh_setup(const char* host, uint16_t port,
                       int* out_sock, LIBSSH2_SESSION** out_session);
 
@@ -46,7 +62,10 @@ void nexterm_jump_chain_teardown(jump_chain_t* chain);
 void nexterm_ssh_full_cleanup(LIBSSH2_SESSION* session, LIBSSH2_CHANNEL* channel,
                              int sock, jump_chain_t* chain, const char* reason);
 
-void nexterm_ssh_read_stream(LIBSSH2_CHANNEL* channel, char* buf,
-                             size_t buf_sz, int use_stderr);
+void nexterm_ssh_pump_init(ssh_pump_t* pump, LIBSSH2_SESSION* session,
+                           LIBSSH2_CHANNEL* channel, int fd, int sock);
+
+int nexterm_ssh_pump(ssh_pump_t* pump, nexterm_reactor_source_t* src,
+                     const nexterm_reactor_events_t* ev);
 
 #endif
@@ -0,0 +1,344 @@
+#include "ssh_pool.h"
+
+#include <stdio.h>
+
+#include "log.h"
+
+#include <openssl/evp.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SSH_POOL_KEY_LEN       2048
+#define SSH_POOL_REAP_INTERVAL 5
+
+struct ssh_pool_conn {
+    char key[SSH_POOL_KEY_LEN];
+    uint8_t secret[32];
+    int sock;
+    LIBSSH2_SESSION* ssh;
+    jump_chain_t chain;
+    bool pooled;
+    bool in_use;
+    bool reused;
+    int64_t idle_since;
+    struct ssh_pool_conn* next;
+    struct ssh_pool_conn* ping_next;
+    bool ping_failed;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    ssh_pool_conn_t* conns;
+    pthread_t reaper;
+    bool running;
+} g_pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static int64_t pool_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec;
+}
+
+static void pool_digest_field(EVP_MD_CTX* md, const char* s) {
+    uint32_t len = s ? (uint32_t)strlen(s) : 0;
+    EVP_DigestUpdate(md, &len, sizeof(len));
+    if (len) EVP_DigestUpdate(md, s, len);
+}
+
+static int pool_make_key(const ssh_pool_target_t* t, char* key, uint8_t* secret) {
+    const ssh_credentials_t* c = t->creds;
+    int n = snprintf(key, SSH_POOL_KEY_LEN, "%s@%s:%u",
+                     c->username ? c->username : "", t->host, t->port);
+    for (int i = 0; i < t->jump_count && n > 0 && n < SSH_POOL_KEY_LEN; i++) {
+        const jump_host_t* j = &t->jump_hosts[i];
+        n += snprintf(key + n, SSH_POOL_KEY_LEN - (size_t)n, "|%s@%s:%u",
+                      j->username, j->host, j->port);
+    }
+    if (n <= 0 || n >= SSH_POOL_KEY_LEN) return -1;
+
+    EVP_MD_CTX* md = EVP_MD_CTX_new();
+    if (!md) return -1;
+    unsigned int md_len = 0;
+    int ok = EVP_DigestInit_ex(md, EVP_sha256(), NULL);
+    if (ok) {
+        pool_digest_field(md, c->password);
+        pool_digest_field(md, c->private_key);
+        pool_digest_field(md, c->passphrase);
+        for (int i = 0; i < t->jump_count; i++) {
+            pool_digest_field(md, t->jump_hosts[i].password);
+            pool_digest_field(md, t->jump_hosts[i].private_key);
+            pool_digest_field(md, t->jump_hosts[i].passphrase);
+        }
+        ok = EVP_DigestFinal_ex(md, secret, &md_len);
+    }
+    EVP_MD_CTX_free(md);
+    return (ok && md_len == 32) ? 0 : -1;
+}
+
+static bool pool_matches(const ssh_pool_conn_t* conn, const char* key,
+                         const uint8_t* secret) {
+    return strcmp(conn->key, key) == 0 && memcmp(conn->secret, secret, 32) == 0;
+}
+
+static void pool_unlink(ssh_pool_conn_t* conn) {
+    for (ssh_pool_conn_t** p = &g_pool.conns; *p; p = &(*p)->next) {
+        if (*p == conn) {
+            *p = conn->next;
+            conn->next = NULL;
+            return;
+        }
+    }
+}
+
+static void pool_destroy(ssh_pool_conn_t* conn) {
+    if (conn->ssh || conn->sock >= 0)
+        nexterm_ssh_full_cleanup(conn->ssh, NULL, conn->sock, &conn->chain,
+                                 "Connection closed");
+    free(conn);
+}
+
+static bool pool_conn_alive(ssh_pool_conn_t* conn) {
+    char probe;
+    ssize_t n = recv(conn->sock, &probe, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (n == 0) return false;
+    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) return false;
+
+    int next = 0;
+    return libssh2_keepalive_send(conn->ssh, &next) == 0;
+}
+
+static int pool_connect(ssh_pool_conn_t* conn, const ssh_pool_target_t* t) {
+    if (nexterm_ssh_setup_with_jumphosts(t->host, t->port, t->jump_hosts,
+            t->jump_count, &conn->sock, &conn->ssh, &conn->chain) != 0)
+        return SSH_POOL_ERR_CONNECT;
+
+    const ssh_credentials_t* c = t->creds;
+    if (nexterm_ssh_auth(conn->ssh, c->username, c->password,
+                         c->private_key, c->passphrase) != 0)
+        return SSH_POOL_ERR_AUTH;
+
+    libssh2_keepalive_config(conn->ssh, 1, SSH_POOL_KEEPALIVE_SEC);
+    return 0;
+}
+
+static void* pool_reaper_thread(void* arg) {
+    (void)arg;
+
+    pthread_mutex_lock(&g_pool.lock);
+    while (g_pool.running) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += SSH_POOL_REAP_INTERVAL;
+        pthread_cond_timedwait(&g_pool.cond, &g_pool.lock, &ts);
+
+        ssh_pool_conn_t* expired = NULL;
+        ssh_pool_conn_t* ping = NULL;
+        int64_t now = pool_now();
+        ssh_pool_conn_t** p = &g_pool.conns;
+        while (*p) {
+            ssh_pool_conn_t* conn = *p;
+            if (conn->in_use) {
+                p = &conn->next;
+            } else if (!g_pool.running || now - conn->idle_since >= SSH_POOL_IDLE_TTL_SEC) {
+                *p = conn->next;
+                conn->next = expired;
+                expired = conn;
+            } else {
+                /* Leased to the reaper while its keepalive is out */
+                conn->in_use = true;
+                conn->ping_next = ping;
+                ping = conn;
+                p = &conn->next;
+            }
+        }
+
+        if (!expired && !ping) continue;
+        pthread_mutex_unlock(&g_pool.lock);
+
+        /* Idle transports get their keepalive here so NAT and firewalls
+         * keep the mapping; libssh2 only sends once per interval. A slow
+         * host holds up only the reaper, never acquire or release. */
+        for (ssh_pool_conn_t* conn = ping; conn; conn = conn->ping_next) {
+            int next = 0;
+            conn->ping_failed = libssh2_keepalive_send(conn->ssh, &next) != 0;
+        }
+
+        pthread_mutex_lock(&g_pool.lock);
+        while (ping) {
+            ssh_pool_conn_t* conn = ping;
+            ping = conn->ping_next;
+            conn->in_use = false;
+            if (!conn->ping_failed && g_pool.running) continue;
+            pool_unlink(conn);
+            conn->next = expired;
+            expired = conn;
+        }
+        pthread_cond_broadcast(&g_pool.cond);
+        pthread_mutex_unlock(&g_pool.lock);
+
+        while (expired) {
+            ssh_pool_conn_t* next = expired->next;
+            LOG_DEBUG("SSH pool: closing idle connection %s", expired->key);
+            pool_destroy(expired);
+            expired = next;
+        }
+        pthread_mutex_lock(&g_pool.lock);
+    }
+    pthread_mutex_unlock(&g_pool.lock);
+    return NULL;
+}
+
+int nexterm_ssh_pool_init(void) {
+    pthread_mutex_lock(&g_pool.lock);
+    g_pool.running = true;
+    pthread_mutex_unlock(&g_pool.lock);
+
+    if (pthread_create(&g_pool.reaper, NULL, pool_reaper_thread, NULL) != 0) {
+        pthread_mutex_lock(&g_pool.lock);
+        g_pool.running = false;
+        pthread_mutex_unlock(&g_pool.lock);
+        return -1;
+    }
+    return 0;
+}
+
+void nexterm_ssh_pool_shutdown(void) {
+    pthread_mutex_lock(&g_pool.lock);
+    if (!g_pool.running) {
+        pthread_mutex_unlock(&g_pool.lock);
+        return;
+    }
+    g_pool.running = false;
+    pthread_cond_broadcast(&g_pool.cond);
+    pthread_mutex_unlock(&g_pool.lock);
+
+    pthread_join(g_pool.reaper, NULL);
+}
+
+int nexterm_ssh_pool_acquire(const ssh_pool_target_t* target, bool fresh,
+                             ssh_pool_conn_t** out) {
+    *out = NULL;
+
+    ssh_pool_conn_t* conn = calloc(1, sizeof(ssh_pool_conn_t));
+    if (!conn) return SSH_POOL_ERR_CONNECT;
+    conn->sock = -1;
+
+    bool keyed = pool_make_key(target, conn->key, conn->secret) == 0;
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += SSH_POOL_ACQUIRE_TIMEOUT_MS / 1000;
+
+    pthread_mutex_lock(&g_pool.lock);
+    while (keyed && g_pool.running) {
+        ssh_pool_conn_t* idle = NULL;
+        int count = 0;
+        for (ssh_pool_conn_t* c = g_pool.conns; c; c = c->next) {
+            if (!pool_matches(c, conn->key, conn->secret)) continue;
+            count++;
+            if (!c->in_use && !idle) idle = c;
+        }
+
+        if (idle && !fresh) {
+            idle->in_use = true;
+            pthread_mutex_unlock(&g_pool.lock);
+
+            if (pool_conn_alive(idle)) {
+                free(conn);
+                idle->reused = true;
+                *out = idle;
+                return 0;
+            }
+
+            pthread_mutex_lock(&g_pool.lock);
+            pool_unlink(idle);
+            pthread_mutex_unlock(&g_pool.lock);
+            pool_destroy(idle);
+            pthread_mutex_lock(&g_pool.lock);
+            continue;
+        }
+
+        if (count < SSH_POOL_MAX_PER_HOST) {
+            conn->pooled = true;
+            conn->in_use = true;
+            conn->next = g_pool.conns;
+            g_pool.conns = conn;
+            break;
+        }
+
+        if (idle) {
+            pool_unlink(idle);
+            pthread_mutex_unlock(&g_pool.lock);
+            pool_destroy(idle);
+            pthread_mutex_lock(&g_pool.lock);
+            continue;
+        }
+
+        if (pthread_cond_timedwait(&g_pool.cond, &g_pool.lock, &deadline) == ETIMEDOUT) {
+            pthread_mutex_unlock(&g_pool.lock);
+            free(conn);
+            return SSH_POOL_ERR_BUSY;
+        }
+    }
+    pthread_mutex_unlock(&g_pool.lock);
+
+    int rc = pool_connect(conn, target);
+    if (rc != 0) {
+        nexterm_ssh_pool_release(conn, false);
+        return rc;
+    }
+
+    *out = conn;
+    return 0;
+}
+
+void nexterm_ssh_pool_release(ssh_pool_conn_t* conn, bool healthy) {
+    if (!conn) return;
+
+    pthread_mutex_lock(&g_pool.lock);
+    if (conn->pooled && healthy && g_pool.running) {
+        conn->in_use = false;
+        conn->reused = false;
+        conn->idle_since = pool_now();
+        pthread_cond_broadcast(&g_pool.cond);
+        pthread_mutex_unlock(&g_pool.lock);
+        return;
+    }
+
+    if (conn->pooled) {
+        pool_unlink(conn);
+        pthread_cond_broadcast(&g_pool.cond);
+    }
+    pthread_mutex_unlock(&g_pool.lock);
+    pool_destroy(conn);
+}
+
+LIBSSH2_SESSION* nexterm_ssh_pool_session(const ssh_pool_conn_t* conn) {
+    return conn->ssh;
+}
+
+int nexterm_ssh_pool_socket(const ssh_pool_conn_t* conn) {
+    return conn->sock;
+}
+
+bool nexterm_ssh_pool_reused(const ssh_pool_conn_t* conn) {
+    return conn->reused;
+}
+
+const char* nexterm_ssh_pool_strerror(int err) {
+    switch (err) {
+        case SSH_POOL_ERR_AUTH: return "SSH authentication failed";
+        case SSH_POOL_ERR_BUSY: return "Too many connections to SSH host";
+        default:                return "Failed to connect to SSH host";
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef NEXTERM_SSH_POOL_H
+#define NEXTERM_SSH_POOL_H
+
+#include "ssh.h"
+#include "ssh_common.h"
+
+#include <libssh2.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SSH_POOL_IDLE_TTL_SEC       60
+#define SSH_POOL_KEEPALIVE_SEC      15
+#define SSH_POOL_MAX_PER_HOST       4
+#define SSH_POOL_ACQUIRE_TIMEOUT_MS 30000
+
+#define SSH_POOL_ERR_CONNECT -1
+#define SSH_POOL_ERR_AUTH    -2
+#define SSH_POOL_ERR_BUSY    -3
+
+typedef struct ssh_pool_conn ssh_pool_conn_t;
+
+typedef struct {
+    const char* host;
+    uint16_t port;
+    const ssh_credentials_t* creds;
+    const jump_host_t* jump_hosts;
+    int jump_count;
+} ssh_pool_target_t;
+
+int nexterm_ssh_pool_init(void);
+
+void nexterm_ssh_pool_shutdown(void);
+
+/* Leases are exclusive: a libssh2 session is not thread-safe, so concurrent
+ * requests to one host spread over up to SSH_POOL_MAX_PER_HOST transports
+ * rather than sharing one. A batch multiplexes its channels over its lease. */
+int nexterm_ssh_pool_acquire(const ssh_pool_target_t* target, bool fresh,
+                             ssh_pool_conn_t** out);
+
+void nexterm_ssh_pool_release(ssh_pool_conn_t* conn, bool healthy);
+
+LIBSSH2_SESSION* nexterm_ssh_pool_session(const ssh_pool_conn_t* conn);
+
+int nexterm_ssh_pool_socket(const ssh_pool_conn_t* conn);
+
+bool nexterm_ssh_pool_reused(const ssh_pool_conn_t* conn);
+
+const char* nexterm_ssh_pool_strerror(int err);
+
+#endif
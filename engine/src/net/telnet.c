@@ -2,12 +2,13 @@
 #include "control_plane.h"
 #include "io.h"
 #include "log.h"
+#include "reactor.h"
 #include "session.h"
 
 extern nexterm_session_manager_t g_session_manager;
 
 #include <errno.h>
-#include <poll.h>
+#include <fcntl.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -29,60 +30,86 @@ extern nexterm_session_manager_t g_session_manager;
 #define TELOPT_TTYPE  24
 #define TELOPT_NAWS   31
 
+#define TELNET_CTRL_SIZE 512
+#define TELNET_MAX_ROUNDS 32
+
 typedef struct {
     nexterm_session_t* session;
     nexterm_control_plane_t* cp;
 } telnet_thread_args_t;
 
-static int telnet_send_cmd(int fd, uint8_t cmd, uint8_t option) {
+typedef struct {
+    nexterm_session_t* session;
+    nexterm_control_plane_t* cp;
+    int data_fd;
+    int telnet_fd;
+    uint8_t up[TELNET_BUF_SIZE];
+    size_t up_len, up_off;
+    uint8_t down[TELNET_BUF_SIZE];
+    size_t down_len, down_off;
+    uint8_t ctrl[TELNET_CTRL_SIZE];
+    size_t ctrl_len;
+} telnet_bridge_t;
+
+static void telnet_queue(telnet_bridge_t* b, const uint8_t* buf, size_t len) {
+    if (b->ctrl_len + len > sizeof(b->ctrl)) {
+        LOG_WARN("Telnet session %s: control queue full, dropping %zu bytes",
+                 b->session->session_id, len);
+        return;
+    }
+    memcpy(b->ctrl + b->ctrl_len, buf, len);
+    b->ctrl_len += len;
+}
+
+static void telnet_send_cmd(telnet_bridge_t* b, uint8_t cmd, uint8_t option) {
     uint8_t buf[3] = { IAC, cmd, option };
-    return nexterm_write_exact(fd, buf, 3);
+    telnet_queue(b, buf, 3);
 }
 
-static int telnet_send_naws(int fd, uint16_t cols, uint16_t rows) {
+static void telnet_send_naws(telnet_bridge_t* b, uint16_t cols, uint16_t rows) {
     uint8_t buf[9] = {
         IAC, SB, TELOPT_NAWS,
         (cols >> 8) & 0xFF, cols & 0xFF,
         (rows >> 8) & 0xFF, rows & 0xFF,
         IAC, SE
     };
-    return nexterm_write_exact(fd, buf, 9);
+    telnet_queue(b, buf, 9);
 }
 
-static int telnet_send_ttype(int fd) {
+static void telnet_send_ttype(telnet_bridge_t* b) {
     static const char term[] = "xterm-256color";
     uint8_t buf[6 + sizeof(term) - 1] = { IAC, SB, TELOPT_TTYPE, 0 };
     memcpy(buf + 4, term, sizeof(term) - 1);
     buf[4 + sizeof(term) - 1] = IAC;
     buf[5 + sizeof(term) - 1] = SE;
-    return nexterm_write_exact(fd, buf, sizeof(buf));
+    telnet_queue(b, buf, sizeof(buf));
 }
 
-static void handle_do(int fd, uint8_t opt) {
+static void handle_do(telnet_bridge_t* b, uint8_t opt) {
     if (opt == TELOPT_NAWS || opt == TELOPT_TTYPE)
-        telnet_send_cmd(fd, WILL, opt);
+        telnet_send_cmd(b, WILL, opt);
     else
-        telnet_send_cmd(fd, WONT, opt);
+        telnet_send_cmd(b, WONT, opt);
 }
 
-static void handle_will(int fd, uint8_t opt) {
+static void handle_will(telnet_bridge_t* b, uint8_t opt) {
     if (opt == TELOPT_ECHO || opt == TELOPT_SGA)
-        telnet_send_cmd(fd, DO, opt);
+        telnet_send_cmd(b, DO, opt);
     else
-        telnet_send_cmd(fd, DONT, opt);
+        telnet_send_cmd(b, DONT, opt);
 }
 
-static void handle_negotiation(int fd, uint8_t cmd, uint8_t opt) {
+static void handle_negotiation(telnet_bridge_t* b, uint8_t cmd, uint8_t opt) {
     switch (cmd) {
-        case DO:   handle_do(fd, opt);                  break;
-        case DONT: telnet_send_cmd(fd, WONT, opt);      break;
-        case WILL: handle_will(fd, opt);                break;
-        case WONT: telnet_send_cmd(fd, DONT, opt);      break;
+        case DO:   handle_do(b, opt);                  break;
+        case DONT: telnet_send_cmd(b, WONT, opt);      break;
+        case WILL: handle_will(b, opt);                break;
+        case WONT: telnet_send_cmd(b, DONT, opt);      break;
         default: break;
     }
 }
 
-static size_t handle_subnegotiation(int fd, const uint8_t* buf,
+static size_t handle_subnegotiation(telnet_bridge_t* b, const uint8_t* buf,
                                     size_t i, size_t len) {
     size_t j = i + 3;
     while (j + 1 < len && !(buf[j] == IAC && buf[j + 1] == SE))
@@ -92,20 +119,19 @@ static size_t handle_subnegotiation(int fd, const uint8_t* buf,
         return len;
 
     if (buf[i + 2] == TELOPT_TTYPE)
-        telnet_send_ttype(fd);
+        telnet_send_ttype(b);
 
     return j + 2;
 }
 
-static int telnet_process_and_forward(int telnet_fd, int data_fd,
-                                      const uint8_t* buf, size_t len) {
-    uint8_t out[TELNET_BUF_SIZE];
+static size_t telnet_process(telnet_bridge_t* b, const uint8_t* buf, size_t len) {
+    uint8_t* out = b->down;
     size_t out_pos = 0;
     size_t i = 0;
 
     while (i < len) {
         if (buf[i] != IAC || i + 1 >= len) {
-            if (out_pos < sizeof(out))
+            if (out_pos < sizeof(b->down))
                 out[out_pos++] = buf[i];
             i++;
             continue;
@@ -114,70 +140,180 @@ static int telnet_process_and_forward(int telnet_fd, int data_fd,
         uint8_t cmd = buf[i + 1];
 
         if (cmd == IAC) {
-            if (out_pos < sizeof(out)) out[out_pos++] = IAC;
+            if (out_pos < sizeof(b->down)) out[out_pos++] = IAC;
             i += 2;
         } else if ((cmd >= WILL && cmd <= DONT) && i + 2 < len) {
-            handle_negotiation(telnet_fd, cmd, buf[i + 2]);
+            handle_negotiation(b, cmd, buf[i + 2]);
             i += 3;
         } else if (cmd == SB && i + 2 < len) {
-            i = handle_subnegotiation(telnet_fd, buf, i, len);
+            i = handle_subnegotiation(b, buf, i, len);
         } else {
             i += 2;
         }
     }
 
-    if (out_pos > 0)
-        return nexterm_write_exact(data_fd, out, out_pos);
+    return out_pos;
+}
 
-    return 0;
+static void telnet_apply_pending_resize(telnet_bridge_t* b) {
+    nexterm_session_t* session = b->session;
+    uint16_t cols, rows;
+    if (!nexterm_session_take_resize(session, &cols, &rows)) return;
+
+    telnet_send_naws(b, cols, rows);
+    LOG_DEBUG("Telnet session %s: resized to %ux%u", session->session_id, cols, rows);
 }
 
-static void telnet_apply_pending_resize(nexterm_session_t* session, int telnet_fd) {
-    if (!session->resize_pending) return;
-    uint16_t cols = session->pending_cols;
-    uint16_t rows = session->pending_rows;
-    session->resize_pending = false;
+static bool telnet_would_block(ssize_t n) {
+    return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+}
 
-    if (telnet_send_naws(telnet_fd, cols, rows) != 0)
-        LOG_WARN("Telnet session %s: NAWS resize failed", session->session_id);
-    else
-        LOG_DEBUG("Telnet session %s: resized to %ux%u", session->session_id, cols, rows);
+static int telnet_flush(int fd, uint8_t* buf, size_t* len, size_t* off, bool* progress) {
+    ssize_t w = write(fd, buf + *off, *len - *off);
+    if (w < 0 && !telnet_would_block(w)) return -1;
+    if (w > 0) {
+        *off += (size_t)w;
+        if (*off == *len)
+            *len = *off = 0;
+        *progress = true;
+    }
+    return 0;
 }
 
-static bool telnet_bridge_poll(nexterm_session_t* session, int data_fd, int telnet_fd) {
+static int telnet_bridge_event(nexterm_reactor_source_t* src,
+                               const nexterm_reactor_events_t* ev, void* data) {
+    telnet_bridge_t* b = (telnet_bridge_t*)data;
     uint8_t buf[TELNET_BUF_SIZE];
-    struct pollfd fds[2] = {
-        { .fd = data_fd,   .events = POLLIN },
-        { .fd = telnet_fd, .events = POLLIN },
-    };
+    bool progress = true;
+    int round = 0;
+
+    if (b->session->state != SESSION_STATE_ACTIVE)
+        return NEXTERM_REACTOR_CLOSE;
+
+    if (ev->woken)
+        telnet_apply_pending_resize(b);
+
+    for (; progress && round < TELNET_MAX_ROUNDS; round++) {
+        progress = false;
+
+        if (b->ctrl_len > 0 && b->up_len == 0) {
+            size_t off = 0;
+            if (telnet_flush(b->telnet_fd, b->ctrl, &b->ctrl_len, &off, &progress) != 0)
+                return NEXTERM_REACTOR_CLOSE;
+            if (off > 0) {
+                memmove(b->ctrl, b->ctrl + off, b->ctrl_len - off);
+                b->ctrl_len -= off;
+            }
+        }
 
-    telnet_apply_pending_resize(session, telnet_fd);
+        if (b->up_len == 0 && b->ctrl_len == 0) {
+            ssize_t n = read(b->data_fd, b->up, sizeof(b->up));
+            if (n == 0 || (n < 0 && !telnet_would_block(n)))
+                return NEXTERM_REACTOR_CLOSE;
+            if (n > 0) {
+                b->up_len = (size_t)n;
+                b->up_off = 0;
+                progress = true;
+            }
+        }
 
-    int ret = poll(fds, 2, 200);
-    if (ret < 0)
-        return errno == EINTR;
-    if (ret == 0)
-        return true;
+        if (b->up_len > 0
+                && telnet_flush(b->telnet_fd, b->up, &b->up_len, &b->up_off, &progress) != 0)
+            return NEXTERM_REACTOR_CLOSE;
+
+        if (b->down_len == 0) {
+            ssize_t n = read(b->telnet_fd, buf, sizeof(buf));
+            if (n == 0 || (n < 0 && !telnet_would_block(n)))
+                return NEXTERM_REACTOR_CLOSE;
+            if (n > 0) {
+                b->down_len = telnet_process(b, buf, (size_t)n);
+                b->down_off = 0;
+                progress = true;
+            }
+        }
 
-    if (fds[0].revents & POLLIN) {
-        ssize_t n = read(data_fd, buf, sizeof(buf));
-        if (n <= 0) return false;
-        if (nexterm_write_exact(telnet_fd, buf, (size_t)n) != 0) return false;
+        if (b->down_len > 0
+                && telnet_flush(b->data_fd, b->down, &b->down_len, &b->down_off, &progress) != 0)
+            return NEXTERM_REACTOR_CLOSE;
     }
 
-    if (fds[1].revents & POLLIN) {
-        ssize_t n = read(telnet_fd, buf, sizeof(buf));
-        if (n <= 0) return false;
-        if (telnet_process_and_forward(telnet_fd, data_fd, buf, (size_t)n) != 0)
-            return false;
-    }
+    if (!progress && (ev->revents[0] & NEXTERM_EV_HUP))
+        return NEXTERM_REACTOR_CLOSE;
+    if (!progress && (ev->revents[1] & NEXTERM_EV_HUP))
+        return NEXTERM_REACTOR_CLOSE;
+
+    uint32_t data_events = 0;
+    if (b->up_len == 0 && b->ctrl_len == 0) data_events |= NEXTERM_EV_READ;
+    if (b->down_len > 0) data_events |= NEXTERM_EV_WRITE;
+
+    uint32_t telnet_events = 0;
+    if (b->down_len == 0) telnet_events |= NEXTERM_EV_READ;
+    if (b->up_len > 0 || b->ctrl_len > 0) telnet_events |= NEXTERM_EV_WRITE;
+
+    nexterm_reactor_watch(src, 0, data_events);
+    nexterm_reactor_watch(src, 1, telnet_events);
 
-    if (fds[0].revents & (POLLERR | POLLHUP))
-        return false;
-    if (fds[1].revents & (POLLERR | POLLHUP))
-        return false;
+    if (progress)
+        nexterm_reactor_notify(src);
 
-    return true;
+    return NEXTERM_REACTOR_CONTINUE;
+}
+
+static void telnet_bridge_close(nexterm_reactor_source_t* src, void* data) {
+    telnet_bridge_t* b = (telnet_bridge_t*)data;
+    nexterm_session_t* session = b->session;
+
+    LOG_INFO("Telnet session %s ending", session->session_id);
+
+    nexterm_sm_lock(&g_session_manager);
+    session->telnet_sock = -1;
+    session->reactor_source = NULL;
+    nexterm_sm_unlock(&g_session_manager);
+    nexterm_reactor_release(src);
+
+    close(b->telnet_fd);
+    close(b->data_fd);
+
+    char sid[MAX_SESSION_ID_LEN];
+    snprintf(sid, sizeof(sid), "%s", session->session_id);
+    nexterm_cp_send_session_closed(b->cp, sid, "session ended");
+    nexterm_sm_finish(&g_session_manager, sid);
+
+    free(b);
+}
+
+static int telnet_bridge_start(nexterm_session_t* session, nexterm_control_plane_t* cp,
+                               int data_fd, int telnet_fd) {
+    telnet_bridge_t* b = calloc(1, sizeof(telnet_bridge_t));
+    if (!b) return -1;
+
+    b->session = session;
+    b->cp = cp;
+    b->data_fd = data_fd;
+    b->telnet_fd = telnet_fd;
+
+    int flags = fcntl(data_fd, F_GETFL, 0);
+    if (flags >= 0) fcntl(data_fd, F_SETFL, flags | O_NONBLOCK);
+    flags = fcntl(telnet_fd, F_GETFL, 0);
+    if (flags >= 0) fcntl(telnet_fd, F_SETFL, flags | O_NONBLOCK);
+
+    int fds[2] = { data_fd, telnet_fd };
+    uint32_t events[2] = { NEXTERM_EV_READ, NEXTERM_EV_READ };
+
+    nexterm_sm_lock(&g_session_manager);
+    nexterm_reactor_source_t* src = nexterm_reactor_add(fds, events, 2,
+            telnet_bridge_event, telnet_bridge_close, b);
+    session->reactor_source = src;
+    nexterm_sm_unlock(&g_session_manager);
+
+    if (!src) {
+        LOG_ERROR("Telnet session %s: failed to register with reactor", session->session_id);
+        free(b);
+        return -1;
+    }
+
+    nexterm_reactor_notify(src);
+    return 0;
 }
 
 static void* telnet_session_thread(void* arg) {
@@ -213,10 +349,10 @@ static void* telnet_session_thread(void* arg) {
     LOG_INFO("Telnet session %s active (target=%s:%u)",
              session->session_id, session->host, session->port);
 
-    while (session->state == SESSION_STATE_ACTIVE
-            && telnet_bridge_poll(session, data_fd, telnet_fd));
-
-    LOG_INFO("Telnet session %s ending", session->session_id);
+    if (telnet_bridge_start(session, cp, data_fd, telnet_fd) == 0) {
+        free(args);
+        return NULL;
+    }
 
 cleanup:
     session->telnet_sock = -1;
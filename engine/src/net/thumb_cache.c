@@ -0,0 +1,438 @@
+#include "thumb_cache.h"
+#include "log.h"
+
+#include <openssl/evp.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define THUMB_CACHE_BUCKETS   4096
+#define THUMB_DISK_MAGIC      "NXT1"
+#define THUMB_DISK_NAME_LEN   64
+#define THUMB_DISK_MAX_FILE   (4 * 1024 * 1024)
+
+/* Memory entries carry the full key and the JPEG; disk entries only the
+ * digest that names their file. */
+typedef struct thumb_entry {
+    char* key;
+    uint64_t hash;
+    uint8_t* data;
+    size_t len;
+    size_t cost;
+    int w, h;
+    struct thumb_entry* prev;
+    struct thumb_entry* next;
+    struct thumb_entry* chain;
+} thumb_entry_t;
+
+typedef struct {
+    thumb_entry_t* buckets[THUMB_CACHE_BUCKETS];
+    thumb_entry_t* head;
+    thumb_entry_t* tail;
+    size_t bytes;
+    size_t budget;
+} thumb_lru_t;
+
+static struct {
+    pthread_mutex_t lock;
+    thumb_lru_t mem;
+    thumb_lru_t disk;
+    char dir[512];
+    uint64_t hits, disk_hits, misses;
+} g_thumbs = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .mem = { .budget = (size_t)32 * 1024 * 1024 },
+};
+
+static uint64_t thumb_hash(const char* s) {
+    uint64_t h = 14695981039346656037ULL;
+    for (const unsigned char* p = (const unsigned char*)s; *p; p++) {
+        h ^= *p;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static thumb_entry_t* lru_find(thumb_lru_t* l, const char* key, uint64_t hash) {
+    for (thumb_entry_t* e = l->buckets[hash % THUMB_CACHE_BUCKETS]; e; e = e->chain)
+        if (e->hash == hash && strcmp(e->key, key) == 0) return e;
+    return NULL;
+}
+
+static void lru_unlink(thumb_lru_t* l, thumb_entry_t* e) {
+    if (e->prev) e->prev->next = e->next; else l->head = e->next;
+    if (e->next) e->next->prev = e->prev; else l->tail = e->prev;
+    e->prev = e->next = NULL;
+}
+
+static void lru_push_front(thumb_lru_t* l, thumb_entry_t* e) {
+    e->prev = NULL;
+    e->next = l->head;
+    if (l->head) l->head->prev = e; else l->tail = e;
+    l->head = e;
+}
+
+static void lru_touch(thumb_lru_t* l, thumb_entry_t* e) {
+    lru_unlink(l, e);
+    lru_push_front(l, e);
+}
+
+static void lru_insert(thumb_lru_t* l, thumb_entry_t* e) {
+    thumb_entry_t** b = &l->buckets[e->hash % THUMB_CACHE_BUCKETS];
+    e->chain = *b;
+    *b = e;
+    lru_push_front(l, e);
+    l->bytes += e->cost;
+}
+
+static void lru_remove(thumb_lru_t* l, thumb_entry_t* e) {
+    for (thumb_entry_t** p = &l->buckets[e->hash % THUMB_CACHE_BUCKETS]; *p; p = &(*p)->chain) {
+        if (*p == e) {
+            *p = e->chain;
+            break;
+        }
+    }
+    lru_unlink(l, e);
+    l->bytes -= e->cost;
+}
+
+static void entry_free(thumb_entry_t* e) {
+    free(e->key);
+    free(e->data);
+    free(e);
+}
+
+static void disk_file(char* out, size_t out_sz, const char* name, const char* ext) {
+    snprintf(out, out_sz, "%s/%s%s", g_thumbs.dir, name, ext);
+}
+
+static void lru_evict(thumb_lru_t* l, bool on_disk) {
+    while (l->bytes > l->budget && l->tail) {
+        thumb_entry_t* e = l->tail;
+        if (on_disk) {
+            char path[600];
+            disk_file(path, sizeof(path), e->key, ".thumb");
+            unlink(path);
+        }
+        lru_remove(l, e);
+        entry_free(e);
+    }
+}
+
+static void lru_clear(thumb_lru_t* l) {
+    while (l->tail) {
+        thumb_entry_t* e = l->tail;
+        lru_remove(l, e);
+        entry_free(e);
+    }
+}
+
+static int disk_name(const char* key, char* name) {
+    uint8_t md[32];
+    unsigned int md_len = 0;
+    if (!EVP_Digest(key, strlen(key), md, &md_len, EVP_sha256(), NULL) || md_len != 32)
+        return -1;
+    for (int i = 0; i < 32; i++)
+        snprintf(name + i * 2, 3, "%02x", md[i]);
+    return 0;
+}
+
+static thumb_entry_t* disk_entry_add_locked(const char* name, size_t size) {
+    uint64_t hash = thumb_hash(name);
+    thumb_entry_t* e = lru_find(&g_thumbs.disk, name, hash);
+    if (e) {
+        lru_remove(&g_thumbs.disk, e);
+        e->cost = size;
+        lru_insert(&g_thumbs.disk, e);
+        return e;
+    }
+
+    e = calloc(1, sizeof(*e));
+    if (!e || !(e->key = strdup(name))) {
+        free(e);
+        return NULL;
+    }
+    e->hash = hash;
+    e->cost = size;
+    lru_insert(&g_thumbs.disk, e);
+    return e;
+}
+
+typedef struct {
+    char name[THUMB_DISK_NAME_LEN + 1];
+    size_t size;
+    time_t mtime;
+} disk_scan_t;
+
+static int disk_scan_cmp(const void* a, const void* b) {
+    time_t ta = ((const disk_scan_t*)a)->mtime, tb = ((const disk_scan_t*)b)->mtime;
+    return (ta > tb) - (ta < tb);
+}
+
+/* Rebuilds the disk index, oldest first so the LRU order survives a
+ * restart (hits bump the file's mtime). */
+static void disk_scan_locked(void) {
+    DIR* d = opendir(g_thumbs.dir);
+    if (!d) return;
+
+    disk_scan_t* files = NULL;
+    size_t count = 0, cap = 0;
+    struct dirent* de;
+    while ((de = readdir(d)) != NULL) {
+        const char* dot = strchr(de->d_name, '.');
+        if (!dot || (size_t)(dot - de->d_name) != THUMB_DISK_NAME_LEN) continue;
+
+        char path[600];
+        snprintf(path, sizeof(path), "%s/%s", g_thumbs.dir, de->d_name);
+        if (strcmp(dot, ".tmp") == 0) {
+            unlink(path);
+            continue;
+        }
+        struct stat st;
+        if (strcmp(dot, ".thumb") != 0 || stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+            continue;
+
+        if (count == cap) {
+            size_t nc = cap ? cap * 2 : 256;
+            disk_scan_t* grown = realloc(files, nc * sizeof(*files));
+            if (!grown) break;
+            files = grown;
+            cap = nc;
+        }
+        memcpy(files[count].name, de->d_name, THUMB_DISK_NAME_LEN);
+        files[count].name[THUMB_DISK_NAME_LEN] = '\0';
+        files[count].size = (size_t)st.st_size;
+        files[count].mtime = st.st_mtime;
+        count++;
+    }
+    closedir(d);
+
+    if (count) qsort(files, count, sizeof(*files), disk_scan_cmp);
+    for (size_t i = 0; i < count; i++)
+        disk_entry_add_locked(files[i].name, files[i].size);
+    free(files);
+
+    lru_evict(&g_thumbs.disk, true);
+}
+
+static int disk_read(const char* path, const char* key, uint8_t** jpeg,
+                     size_t* len, int* w, int* h) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    uint8_t* buf = NULL;
+    int rc = -1;
+    if (fstat(fd, &st) == 0 && st.st_size > 16 && st.st_size <= THUMB_DISK_MAX_FILE &&
+        (buf = malloc((size_t)st.st_size)) != NULL) {
+        size_t size = (size_t)st.st_size, got = 0;
+        while (got < size) {
+            ssize_t n = read(fd, buf + got, size - got);
+            if (n <= 0) break;
+            got += (size_t)n;
+        }
+
+        uint32_t hdr[3];
+        size_t klen = strlen(key);
+        if (got == size && memcmp(buf, THUMB_DISK_MAGIC, 4) == 0) {
+            memcpy(hdr, buf + 4, sizeof(hdr));
+            size_t off = 16 + klen;
+            if (hdr[2] == klen && off < size && memcmp(buf + 16, key, klen) == 0) {
+                memmove(buf, buf + off, size - off);
+                *jpeg = buf;
+                *len = size - off;
+                *w = (int)hdr[0];
+                *h = (int)hdr[1];
+                buf = NULL;
+                rc = 0;
+            }
+        }
+    }
+    free(buf);
+    close(fd);
+    return rc;
+}
+
+static int disk_write(const char* name, const char* key, const uint8_t* jpeg,
+                      size_t len, int w, int h, size_t* written) {
+    char tmp[600], path[600];
+    disk_file(tmp, sizeof(tmp), name, ".tmp");
+    disk_file(path, sizeof(path), name, ".thumb");
+
+    FILE* f = fopen(tmp, "wbx");
+    if (!f) return -1;
+
+    uint32_t hdr[3] = { (uint32_t)w, (uint32_t)h, (uint32_t)strlen(key) };
+    bool ok = fwrite(THUMB_DISK_MAGIC, 1, 4, f) == 4 &&
+              fwrite(hdr, sizeof(hdr), 1, f) == 1 &&
+              fwrite(key, 1, hdr[2], f) == hdr[2] &&
+              fwrite(jpeg, 1, len, f) == len;
+    if (fclose(f) != 0) ok = false;
+
+    if (!ok || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    *written = 16 + hdr[2] + len;
+    return 0;
+}
+
+static void mem_put_locked(const char* key, uint64_t hash, const uint8_t* jpeg,
+                           size_t len, int w, int h) {
+    size_t cost = sizeof(thumb_entry_t) + strlen(key) + 1 + len;
+    if (cost > g_thumbs.mem.budget || lru_find(&g_thumbs.mem, key, hash)) return;
+
+    thumb_entry_t* e = calloc(1, sizeof(*e));
+    if (!e) return;
+    e->key = strdup(key);
+    e->data = malloc(len);
+    if (!e->key || !e->data) {
+        entry_free(e);
+        return;
+    }
+    memcpy(e->data, jpeg, len);
+    e->hash = hash;
+    e->len = len;
+    e->cost = cost;
+    e->w = w;
+    e->h = h;
+    lru_insert(&g_thumbs.mem, e);
+    lru_evict(&g_thumbs.mem, false);
+}
+
+int nexterm_thumb_cache_init(size_t mem_bytes, const char* dir, size_t disk_bytes) {
+    int rc = 0;
+
+    pthread_mutex_lock(&g_thumbs.lock);
+    g_thumbs.mem.budget = mem_bytes;
+    lru_evict(&g_thumbs.mem, false);
+
+    if (dir && *dir && disk_bytes > 0) {
+        if (strlen(dir) >= sizeof(g_thumbs.dir) ||
+            (mkdir(dir, 0700) != 0 && errno != EEXIST)) {
+            LOG_WARN("Thumbnail cache: cannot use directory %s", dir);
+            rc = -1;
+        } else {
+            snprintf(g_thumbs.dir, sizeof(g_thumbs.dir), "%s", dir);
+            g_thumbs.disk.budget = disk_bytes;
+            disk_scan_locked();
+        }
+    }
+
+    LOG_INFO("Thumbnail cache: %zu KiB in memory, %zu KiB on disk%s%s",
+             g_thumbs.mem.budget / 1024,
+             g_thumbs.dir[0] ? g_thumbs.disk.bytes / 1024 : 0,
+             g_thumbs.dir[0] ? " in " : "", g_thumbs.dir);
+    pthread_mutex_unlock(&g_thumbs.lock);
+    return rc;
+}
+
+void nexterm_thumb_cache_shutdown(void) {
+    pthread_mutex_lock(&g_thumbs.lock);
+    LOG_INFO("Thumbnail cache: %" PRIu64 " memory hits, %" PRIu64 " disk hits, "
+             "%" PRIu64 " misses", g_thumbs.hits, g_thumbs.disk_hits, g_thumbs.misses);
+    lru_clear(&g_thumbs.mem);
+    lru_clear(&g_thumbs.disk);
+    g_thumbs.dir[0] = '\0';
+    g_thumbs.disk.budget = 0;
+    g_thumbs.hits = g_thumbs.disk_hits = g_thumbs.misses = 0;
+    pthread_mutex_unlock(&g_thumbs.lock);
+}
+
+int nexterm_thumb_cache_key(char* key, const char* origin, const char* path,
+                            uint64_t size, uint32_t mtime, int target) {
+    int n = snprintf(key, THUMB_CACHE_KEY_LEN, "%s\n%s\n%" PRIu64 "\n%u\n%d",
+                     origin, path, size, mtime, target);
+    return (n > 0 && n < THUMB_CACHE_KEY_LEN) ? 0 : -1;
+}
+
+int nexterm_thumb_cache_get(const char* key, uint8_t** jpeg, size_t* len,
+                            int* w, int* h) {
+    uint64_t hash = thumb_hash(key);
+    char name[THUMB_DISK_NAME_LEN + 1];
+    char path[600];
+    bool on_disk = false;
+
+    pthread_mutex_lock(&g_thumbs.lock);
+    thumb_entry_t* e = lru_find(&g_thumbs.mem, key, hash);
+    if (e) {
+        uint8_t* copy = malloc(e->len);
+        if (copy) {
+            memcpy(copy, e->data, e->len);
+            *jpeg = copy;
+            *len = e->len;
+            *w = e->w;
+            *h = e->h;
+            lru_touch(&g_thumbs.mem, e);
+            g_thumbs.hits++;
+        }
+        pthread_mutex_unlock(&g_thumbs.lock);
+        return copy ? 0 : -1;
+    }
+
+    if (g_thumbs.dir[0] && disk_name(key, name) == 0) {
+        thumb_entry_t* de = lru_find(&g_thumbs.disk, name, thumb_hash(name));
+        if (de) {
+            lru_touch(&g_thumbs.disk, de);
+            disk_file(path, sizeof(path), name, ".thumb");
+            on_disk = true;
+        }
+    }
+    if (!on_disk) g_thumbs.misses++;
+    pthread_mutex_unlock(&g_thumbs.lock);
+
+    if (!on_disk) return -1;
+
+    if (disk_read(path, key, jpeg, len, w, h) != 0) {
+        pthread_mutex_lock(&g_thumbs.lock);
+        thumb_entry_t* de = lru_find(&g_thumbs.disk, name, thumb_hash(name));
+        if (de) {
+            lru_remove(&g_thumbs.disk, de);
+            entry_free(de);
+        }
+        unlink(path);
+        g_thumbs.misses++;
+        pthread_mutex_unlock(&g_thumbs.lock);
+        return -1;
+    }
+    utimensat(AT_FDCWD, path, NULL, 0);
+
+    pthread_mutex_lock(&g_thumbs.lock);
+    g_thumbs.disk_hits++;
+    mem_put_locked(key, hash, *jpeg, *len, *w, *h);
+    pthread_mutex_unlock(&g_thumbs.lock);
+    return 0;
+}
+
+void nexterm_thumb_cache_put(const char* key, const uint8_t* jpeg, size_t len,
+                             int w, int h) {
+    if (!key || !jpeg || len == 0) return;
+
+    char name[THUMB_DISK_NAME_LEN + 1];
+    bool to_disk = false;
+
+    pthread_mutex_lock(&g_thumbs.lock);
+    mem_put_locked(key, thumb_hash(key), jpeg, len, w, h);
+    if (g_thumbs.dir[0] && disk_name(key, name) == 0)
+        to_disk = !lru_find(&g_thumbs.disk, name, thumb_hash(name));
+    pthread_mutex_unlock(&g_thumbs.lock);
+
+    size_t written = 0;
+    if (!to_disk || disk_write(name, key, jpeg, len, w, h, &written) != 0) return;
+
+    pthread_mutex_lock(&g_thumbs.lock);
+    if (g_thumbs.dir[0]) {
+        disk_entry_add_locked(name, written);
+        lru_evict(&g_thumbs.disk, true);
+    }
+    pthread_mutex_unlock(&g_thumbs.lock);
+}
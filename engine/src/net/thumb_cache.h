@@ -0,0 +1,27 @@
+#ifndef NEXTERM_THUMB_CACHE_H
+#define NEXTERM_THUMB_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define THUMB_CACHE_KEY_LEN 5120
+
+/* Finished thumbnails keyed by origin, path, size, mtime and target, so a
+ * changed file misses on its own. Memory tier always on; disk tier only
+ * when dir is set. Both are LRU within their byte budget. */
+int nexterm_thumb_cache_init(size_t mem_bytes, const char* dir, size_t disk_bytes);
+
+void nexterm_thumb_cache_shutdown(void);
+
+/* Returns -1 if the key does not fit in THUMB_CACHE_KEY_LEN. */
+int nexterm_thumb_cache_key(char* key, const char* origin, const char* path,
+                            uint64_t size, uint32_t mtime, int target);
+
+/* On a hit, *jpeg is a malloc'd copy the caller frees. */
+int nexterm_thumb_cache_get(const char* key, uint8_t** jpeg, size_t* len,
+                            int* w, int* h);
+
+void nexterm_thumb_cache_put(const char* key, const uint8_t* jpeg, size_t len,
+                             int w, int h);
+
+#endif
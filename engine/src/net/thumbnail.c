@@ -1,6 +1,7 @@
 #include "thumbnail.h"
 #include "log.h"
 
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -36,6 +37,11 @@
 #include <webp/decode.h>
 #endif
 
+#ifdef HAVE_LIBJPEG
+#include <jpeglib.h>
+#include <setjmp.h>
+#endif
+
 #define THUMB_MAX_PIXELS   (100 * 1000 * 1000)
 #define THUMB_JPEG_QUALITY 80
 #define THUMB_MIN          16
@@ -63,54 +69,167 @@ static void jpg_write_cb(void* context, void* data, int size) {
     s->len += (size_t)size;
 }
 
-int nexterm_make_thumbnail(const uint8_t* in, size_t in_len, int target,
-                           uint8_t** out, size_t* out_len, int* ow, int* oh) {
-    if (!in || in_len == 0 || !out || !out_len) return -1;
-    if (target < THUMB_MIN) target = 100;
-    if (target > THUMB_MAX) target = THUMB_MAX;
+enum { RGB_STB, RGB_WEBP, RGB_MALLOC };
 
-    int w = 0, h = 0;
-    unsigned char* rgb = NULL;
-    int from_webp = 0;
+static void rgb_free(unsigned char* rgb, int source) {
+    if (!rgb) return;
+#ifdef HAVE_WEBP
+    if (source == RGB_WEBP) { WebPFree(rgb); return; }
+#endif
+    if (source == RGB_MALLOC) free(rgb);
+    else stbi_image_free(rgb);
+}
+
+static int clamp_target(int target) {
+    if (target < THUMB_MIN) return 100;
+    return target > THUMB_MAX ? THUMB_MAX : target;
+}
+
+static bool is_jpeg(const uint8_t* in, size_t len) {
+    return len > 3 && in[0] == 0xFF && in[1] == 0xD8 && in[2] == 0xFF;
+}
+
+#ifdef HAVE_LIBJPEG
+typedef struct {
+    struct jpeg_error_mgr pub;
+    jmp_buf jump;
+} jpeg_err_t;
+
+static void jpeg_fail(j_common_ptr cinfo) {
+    longjmp(((jpeg_err_t*)cinfo->err)->jump, 1);
+}
+
+static void jpeg_quiet(j_common_ptr cinfo, int level) {
+    (void)cinfo;
+    (void)level;
+}
+
+/* Decodes at the smallest DCT scale (1/8, 1/4, 1/2) whose short side still
+ * covers target, so a camera photo is never expanded to full size. */
+static unsigned char* jpeg_decode_scaled(const uint8_t* in, size_t in_len, int target,
+                                         int* w, int* h) {
+    struct jpeg_decompress_struct cinfo;
+    jpeg_err_t err;
+    unsigned char* volatile rgb = NULL;
+
+    cinfo.err = jpeg_std_error(&err.pub);
+    err.pub.error_exit = jpeg_fail;
+    err.pub.emit_message = jpeg_quiet;
+    if (setjmp(err.jump)) {
+        jpeg_destroy_decompress(&cinfo);
+        free(rgb);
+        return NULL;
+    }
 
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, (unsigned char*)in, (unsigned long)in_len);
+    jpeg_read_header(&cinfo, TRUE);
+
+    if ((long long)cinfo.image_width * cinfo.image_height > THUMB_MAX_PIXELS) {
+        LOG_WARN("Thumbnail: image too large (%ux%u)", cinfo.image_width, cinfo.image_height);
+        jpeg_destroy_decompress(&cinfo);
+        return NULL;
+    }
+
+    unsigned int side = cinfo.image_width < cinfo.image_height
+                        ? cinfo.image_width : cinfo.image_height;
+    unsigned int denom = 8;
+    while (denom > 1 && side / denom < (unsigned int)target) denom /= 2;
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = denom;
+    cinfo.out_color_space = JCS_RGB;
+
+    jpeg_start_decompress(&cinfo);
+    if (cinfo.output_components != 3) {
+        jpeg_destroy_decompress(&cinfo);
+        return NULL;
+    }
+
+    size_t stride = (size_t)cinfo.output_width * 3;
+    rgb = malloc(stride * cinfo.output_height);
+    if (!rgb) {
+        jpeg_destroy_decompress(&cinfo);
+        return NULL;
+    }
+    while (cinfo.output_scanline < cinfo.output_height) {
+        JSAMPROW row = rgb + (size_t)cinfo.output_scanline * stride;
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_decompress(&cinfo);
+
+    *w = (int)cinfo.output_width;
+    *h = (int)cinfo.output_height;
+    jpeg_destroy_decompress(&cinfo);
+    return rgb;
+}
+#endif
+
+static unsigned char* decode_rgb(const uint8_t* in, size_t in_len, int target,
+                                 int* w, int* h, int* source) {
 #ifdef HAVE_WEBP
     {
         int ww = 0, wh = 0;
         if (in_len > 12 && WebPGetInfo(in, in_len, &ww, &wh)) {
             if ((long long)ww * wh > THUMB_MAX_PIXELS || ww <= 0 || wh <= 0) {
                 LOG_WARN("Thumbnail: webp too large (%dx%d)", ww, wh);
-                return -1;
+                return NULL;
             }
-            rgb = WebPDecodeRGB(in, in_len, &ww, &wh);
-            if (rgb) { w = ww; h = wh; from_webp = 1; }
+            unsigned char* rgb = WebPDecodeRGB(in, in_len, &ww, &wh);
+            if (rgb) { *w = ww; *h = wh; *source = RGB_WEBP; return rgb; }
         }
     }
 #endif
 
-    if (!rgb) {
-        int iw = 0, ih = 0, ic = 0;
-        if (stbi_info_from_memory(in, (int)in_len, &iw, &ih, &ic)) {
-            if ((long long)iw * ih > THUMB_MAX_PIXELS) {
-                LOG_WARN("Thumbnail: image too large (%dx%d)", iw, ih);
-                return -1;
-            }
-        }
-        int comp = 0;
-        rgb = stbi_load_from_memory(in, (int)in_len, &w, &h, &comp, 3);
+#ifdef HAVE_LIBJPEG
+    if (is_jpeg(in, in_len)) {
+        unsigned char* rgb = jpeg_decode_scaled(in, in_len, target, w, h);
+        if (rgb) { *source = RGB_MALLOC; return rgb; }
     }
-
-    if (!rgb || w <= 0 || h <= 0) {
-        if (rgb) {
-#ifdef HAVE_WEBP
-            if (from_webp) WebPFree(rgb); else stbi_image_free(rgb);
 #else
-            stbi_image_free(rgb);
+    (void)target;
 #endif
+
+    int iw = 0, ih = 0, ic = 0;
+    if (stbi_info_from_memory(in, (int)in_len, &iw, &ih, &ic)) {
+        if ((long long)iw * ih > THUMB_MAX_PIXELS) {
+            LOG_WARN("Thumbnail: image too large (%dx%d)", iw, ih);
+            return NULL;
         }
+    }
+    int comp = 0;
+    *source = RGB_STB;
+    return stbi_load_from_memory(in, (int)in_len, w, h, &comp, 3);
+}
+
+/* Square-crops the centre of the content and scales it to target. With
+ * aspect_w/aspect_h set, the content is that aspect fitted inside the
+ * picture (an EXIF preview letterboxes the real image). */
+static int make_thumbnail_fit(const uint8_t* in, size_t in_len, int target,
+                              int aspect_w, int aspect_h, int min_side,
+                              uint8_t** out, size_t* out_len, int* ow, int* oh) {
+    int w = 0, h = 0;
+    int source = RGB_STB;
+    unsigned char* rgb = decode_rgb(in, in_len, target, &w, &h, &source);
+
+    if (!rgb || w <= 0 || h <= 0) {
+        rgb_free(rgb, source);
         return -1;
     }
 
-    int side = w < h ? w : h;
+    int cw = w, ch = h;
+    if (aspect_w > 0 && aspect_h > 0) {
+        if ((long long)aspect_w * h > (long long)aspect_h * w)
+            ch = (int)((long long)w * aspect_h / aspect_w);
+        else
+            cw = (int)((long long)h * aspect_w / aspect_h);
+    }
+    int side = cw < ch ? cw : ch;
+    /* Stay clear of the compression ringing along a letterbox edge. */
+    if (cw < w || ch < h) side -= side / 25;
+    if (side <= 0 || side < min_side) {
+        rgb_free(rgb, source);
+        return -1;
+    }
     int ox = (w - side) / 2;
     int oy = (h - side) / 2;
     const unsigned char* crop = rgb + ((size_t)oy * (size_t)w + (size_t)ox) * 3;
@@ -134,10 +253,109 @@ int nexterm_make_thumbnail(const uint8_t* in, size_t in_len, int target,
     }
 
     free(resized);
+    rgb_free(rgb, source);
+    return rc;
+}
+
+int nexterm_make_thumbnail(const uint8_t* in, size_t in_len, int target,
+                           uint8_t** out, size_t* out_len, int* ow, int* oh) {
+    if (!in || in_len == 0 || !out || !out_len) return -1;
+    return make_thumbnail_fit(in, in_len, clamp_target(target), 0, 0, 0,
+                              out, out_len, ow, oh);
+}
+
+static uint32_t exif_u16(const uint8_t* p, bool le) {
+    return le ? (uint32_t)(p[0] | p[1] << 8) : (uint32_t)(p[0] << 8 | p[1]);
+}
+
+static uint32_t exif_u32(const uint8_t* p, bool le) {
+    return le ? ((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24)
+              : ((uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | (uint32_t)p[3]);
+}
+
+/* Locates the JPEG preview a camera stores in IFD1 of the EXIF segment.
+ * The segment must lie entirely within the bytes given. */
+static int exif_find_preview(const uint8_t* in, size_t len,
+                             const uint8_t** preview, size_t* preview_len) {
+    if (!is_jpeg(in, len)) return -1;
+
+    size_t pos = 2;
+    while (pos + 4 <= len) {
+        if (in[pos] != 0xFF) return -1;
+        uint8_t marker = in[pos + 1];
+        if (marker == 0xFF) { pos++; continue; }
+        if (marker == 0xDA || marker == 0xD9) return -1;
+
+        size_t seg_len = exif_u16(in + pos + 2, false);
+        if (seg_len < 2 || pos + 2 + seg_len > len) return -1;
+
+        const uint8_t* seg = in + pos + 4;
+        size_t seg_size = seg_len - 2;
+        if (marker == 0xE1 && seg_size > 14 && memcmp(seg, "Exif\0\0", 6) == 0) {
+            const uint8_t* tiff = seg + 6;
+            size_t tlen = seg_size - 6;
+            bool le = tiff[0] == 'I' && tiff[1] == 'I';
+            if (!le && !(tiff[0] == 'M' && tiff[1] == 'M')) return -1;
+            if (exif_u16(tiff + 2, le) != 42) return -1;
+
+            size_t ifd0 = exif_u32(tiff + 4, le);
+            if (ifd0 + 2 > tlen) return -1;
+            size_t count = exif_u16(tiff + ifd0, le);
+            size_t next = ifd0 + 2 + count * 12;
+            if (next + 4 > tlen) return -1;
+            size_t ifd1 = exif_u32(tiff + next, le);
+            if (ifd1 == 0 || ifd1 + 2 > tlen) return -1;
+
+            count = exif_u16(tiff + ifd1, le);
+            if (ifd1 + 2 + count * 12 > tlen) return -1;
+            size_t offset = 0, length = 0;
+            for (size_t i = 0; i < count; i++) {
+                const uint8_t* e = tiff + ifd1 + 2 + i * 12;
+                uint32_t tag = exif_u16(e, le);
+                if (tag == 0x0201) offset = exif_u32(e + 8, le);
+                else if (tag == 0x0202) length = exif_u32(e + 8, le);
+            }
+            if (offset == 0 || length == 0 || offset > tlen || length > tlen - offset)
+                return -1;
+            if (!is_jpeg(tiff + offset, length)) return -1;
+
+            *preview = tiff + offset;
+            *preview_len = length;
+            return 0;
+        }
+        pos += 2 + seg_len;
+    }
+    return -1;
+}
+
+int nexterm_thumbnail_from_head(const uint8_t* head, size_t len, int target,
+                                uint8_t** out, size_t* out_len, int* ow, int* oh) {
+    if (!head || !out || !out_len) return -1;
+
+    const uint8_t* preview;
+    size_t preview_len;
+    if (exif_find_preview(head, len, &preview, &preview_len) != 0) return -1;
+
+    /* The main image's size, when its frame header made it into the head,
+     * tells us how the preview is letterboxed. */
+    int iw = 0, ih = 0, ic = 0;
+    if (!stbi_info_from_memory(head, (int)len, &iw, &ih, &ic)) iw = ih = 0;
+
+    target = clamp_target(target);
+    return make_thumbnail_fit(preview, preview_len, target, iw, ih, target,
+                              out, out_len, ow, oh);
+}
+
+int nexterm_thumbnail_check_head(const uint8_t* head, size_t len) {
+    int w = 0, h = 0, c = 0;
 #ifdef HAVE_WEBP
-    if (from_webp) WebPFree(rgb); else stbi_image_free(rgb);
-#else
-    stbi_image_free(rgb);
+    if (len > 12 && WebPGetInfo(head, len, &w, &h))
+        return (long long)w * h > THUMB_MAX_PIXELS ? -1 : 0;
 #endif
-    return rc;
+    if (stbi_info_from_memory(head, (int)len, &w, &h, &c) &&
+        (long long)w * h > THUMB_MAX_PIXELS) {
+        LOG_WARN("Thumbnail: image too large (%dx%d)", w, h);
+        return -1;
+    }
+    return 0;
 }
@@ -4,7 +4,18 @@
 #include <stddef.h>
 #include <stdint.h>
 
+/* How much of a file is fetched before deciding whether the rest is needed. */
+#define NEXTERM_THUMB_HEAD_BYTES (128 * 1024)
+
 int nexterm_make_thumbnail(const uint8_t* in, size_t in_len, int target,
                            uint8_t** out, size_t* out_len, int* ow, int* oh);
 
+/* Builds the thumbnail from the EXIF preview embedded in the first bytes of a
+ * JPEG; fails if there is none or it is smaller than target. */
+int nexterm_thumbnail_from_head(const uint8_t* head, size_t len, int target,
+                                uint8_t** out, size_t* out_len, int* ow, int* oh);
+
+/* Returns -1 if the header alone shows an image too large to thumbnail. */
+int nexterm_thumbnail_check_head(const uint8_t* head, size_t len);
+
 #endif
@@ -2,18 +2,19 @@
 #include "control_plane.h"
 #include "io.h"
 #include "log.h"
+#include "reactor.h"
 #include "session.h"
 
 extern nexterm_session_manager_t g_session_manager;
 
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <netdb.h>
 #include <openssl/bio.h>
 #include <openssl/err.h>
 #include <openssl/rand.h>
 #include <openssl/ssl.h>
-#include <poll.h>
 #include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -170,66 +171,6 @@ static int ws_send_frame(ws_conn_t* c, int opcode, const uint8_t* data, size_t l
     return 0;
 }
 
-typedef struct {
-    int opcode;
-    uint8_t* payload;
-    size_t payload_len;
-    bool fin;
-} ws_frame_t;
-
-static int ws_read_frame(ws_conn_t* c, ws_frame_t* frame) {
-    uint8_t h[2];
-    int n = ws_read(c, h, 2);
-    if (n <= 0) return -1;
-    if (n < 2) return -1;
-
-    frame->fin = (h[0] & 0x80) != 0;
-    frame->opcode = h[0] & 0x0F;
-    bool masked = (h[1] & 0x80) != 0;
-    uint64_t payload_len = h[1] & 0x7F;
-
-    if (payload_len == 126) {
-        uint8_t ext[2];
-        if (ws_read(c, ext, 2) < 2) return -1;
-        payload_len = ((uint64_t)ext[0] << 8) | ext[1];
-    } else if (payload_len == 127) {
-        uint8_t ext[8];
-        if (ws_read(c, ext, 8) < 8) return -1;
-        payload_len = 0;
-        for (int i = 0; i < 8; i++)
-            payload_len = (payload_len << 8) | ext[i];
-    }
-
-    uint8_t mask_key[4] = {0};
-    if (masked) {
-        if (ws_read(c, mask_key, 4) < 4) return -1;
-    }
-
-    if (payload_len > 16 * 1024 * 1024) return -1;
-
-    frame->payload = NULL;
-    frame->payload_len = (size_t)payload_len;
-
-    if (payload_len > 0) {
-        frame->payload = malloc((size_t)payload_len);
-        if (!frame->payload) return -1;
-
-        size_t total = 0;
-        while (total < (size_t)payload_len) {
-            int r = ws_read(c, frame->payload + total, (size_t)payload_len - total);
-            if (r <= 0) { free(frame->payload); return -1; }
-            total += (size_t)r;
-        }
-
-        if (masked) {
-            for (size_t i = 0; i < (size_t)payload_len; i++)
-                frame->payload[i] ^= mask_key[i % 4];
-        }
-    }
-
-    return 0;
-}
-
 static int ws_handshake(ws_conn_t* c, const char* host, const char* port,
                         const char* path, nexterm_session_t* session) {
     unsigned char nonce[16];
@@ -296,6 +237,345 @@ static int ws_handshake(ws_conn_t* c, const char* host, const char* port,
     return 0;
 }
 
+#define WS_MAX_PAYLOAD (16 * 1024 * 1024)
+#define WS_MAX_ROUNDS 32
+
+typedef struct {
+    uint8_t* data;
+    size_t len;
+    size_t off;
+    size_t cap;
+} ws_buf_t;
+
+typedef struct {
+    nexterm_session_t* session;
+    nexterm_control_plane_t* cp;
+    ws_conn_t conn;
+    SSL_CTX* ssl_ctx;
+    int data_fd;
+    uint32_t tls_want;
+    bool closing;
+    ws_buf_t in;
+    ws_buf_t out;
+    ws_buf_t down;
+} ws_bridge_t;
+
+static int ws_buf_reserve(ws_buf_t* b, size_t extra) {
+    if (b->off > 0 && b->off == b->len)
+        b->off = b->len = 0;
+    if (b->len + extra <= b->cap) return 0;
+
+    if (b->off > 0) {
+        memmove(b->data, b->data + b->off, b->len - b->off);
+        b->len -= b->off;
+        b->off = 0;
+        if (b->len + extra <= b->cap) return 0;
+    }
+
+    size_t cap = b->cap ? b->cap : WS_BUF_SIZE;
+    while (cap < b->len + extra) cap *= 2;
+    uint8_t* data = realloc(b->data, cap);
+    if (!data) return -1;
+    b->data = data;
+    b->cap = cap;
+    return 0;
+}
+
+static size_t ws_buf_pending(const ws_buf_t* b) {
+    return b->len - b->off;
+}
+
+static int ws_queue_frame(ws_bridge_t* br, int opcode, const uint8_t* data, size_t len) {
+    if (ws_buf_reserve(&br->out, len + 14) != 0) return -1;
+
+    uint8_t* p = br->out.data + br->out.len;
+    size_t hlen;
+
+    p[0] = (uint8_t)(0x80 | (opcode & 0x0F));
+    if (len < 126) {
+        p[1] = (uint8_t)(len | 0x80);
+        hlen = 2;
+    } else if (len < 65536) {
+        p[1] = 126 | 0x80;
+        p[2] = (uint8_t)((len >> 8) & 0xFF);
+        p[3] = (uint8_t)(len & 0xFF);
+        hlen = 4;
+    } else {
+        p[1] = 127 | 0x80;
+        for (int i = 0; i < 8; i++)
+            p[2 + i] = (uint8_t)(((uint64_t)len >> (56 - i * 8)) & 0xFF);
+        hlen = 10;
+    }
+
+    uint8_t mask_key[4];
+    RAND_bytes(mask_key, 4);
+    memcpy(p + hlen, mask_key, 4);
+    hlen += 4;
+
+    for (size_t i = 0; i < len; i++)
+        p[hlen + i] = data[i] ^ mask_key[i & 3];
+
+    br->out.len += hlen + len;
+    return 0;
+}
+
+static int ws_parse_frames(ws_bridge_t* br) {
+    while (ws_buf_pending(&br->in) >= 2) {
+        const uint8_t* h = br->in.data + br->in.off;
+        size_t avail = ws_buf_pending(&br->in);
+
+        int opcode = h[0] & 0x0F;
+        bool masked = (h[1] & 0x80) != 0;
+        uint64_t payload_len = h[1] & 0x7F;
+        size_t hlen = 2;
+
+        if (payload_len == 126) {
+            if (avail < 4) return 0;
+            payload_len = ((uint64_t)h[2] << 8) | h[3];
+            hlen = 4;
+        } else if (payload_len == 127) {
+            if (avail < 10) return 0;
+            payload_len = 0;
+            for (int i = 0; i < 8; i++)
+                payload_len = (payload_len << 8) | h[2 + i];
+            hlen = 10;
+        }
+
+        if (payload_len > WS_MAX_PAYLOAD) return -1;
+
+        uint8_t mask_key[4] = {0};
+        if (masked) {
+            if (avail < hlen + 4) return 0;
+            memcpy(mask_key, h + hlen, 4);
+            hlen += 4;
+        }
+
+        if (avail < hlen + (size_t)payload_len) return 0;
+
+        uint8_t* payload = (uint8_t*)h + hlen;
+        if (masked) {
+            for (size_t i = 0; i < (size_t)payload_len; i++)
+                payload[i] ^= mask_key[i & 3];
+        }
+
+        if (opcode == 0x08) {
+            ws_queue_frame(br, 0x08, NULL, 0);
+            br->closing = true;
+        } else if (opcode == 0x09) {
+            if (ws_queue_frame(br, 0x0A, payload, (size_t)payload_len) != 0) return -1;
+        } else if ((opcode == 0x01 || opcode == 0x02 || opcode == 0x00) && payload_len > 0) {
+            if (ws_buf_reserve(&br->down, (size_t)payload_len) != 0) return -1;
+            memcpy(br->down.data + br->down.len, payload, (size_t)payload_len);
+            br->down.len += (size_t)payload_len;
+        }
+
+        br->in.off += hlen + (size_t)payload_len;
+        if (br->closing) break;
+    }
+    return 0;
+}
+
+static bool ws_would_block(ssize_t n) {
+    return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+}
+
+static int ws_ssl_error(ws_bridge_t* br, int ret) {
+    int err = SSL_get_error(br->conn.ssl, ret);
+    if (err == SSL_ERROR_WANT_READ) {
+        br->tls_want |= NEXTERM_EV_READ;
+        return 0;
+    }
+    if (err == SSL_ERROR_WANT_WRITE) {
+        br->tls_want |= NEXTERM_EV_WRITE;
+        return 0;
+    }
+    return -1;
+}
+
+static int ws_flush_out(ws_bridge_t* br, bool* progress) {
+    size_t pending = ws_buf_pending(&br->out);
+    if (pending == 0) return 0;
+
+    ssize_t w;
+    if (br->conn.tls) {
+        int n = SSL_write(br->conn.ssl, br->out.data + br->out.off, (int)pending);
+        if (n <= 0) return ws_ssl_error(br, n);
+        w = n;
+    } else {
+        w = write(br->conn.fd, br->out.data + br->out.off, pending);
+        if (w < 0) return ws_would_block(w) ? 0 : -1;
+    }
+
+    br->out.off += (size_t)w;
+    *progress = true;
+    return 0;
+}
+
+static int ws_fill_in(ws_bridge_t* br, bool* progress) {
+    if (ws_buf_reserve(&br->in, WS_BUF_SIZE) != 0) return -1;
+
+    uint8_t* dst = br->in.data + br->in.len;
+    size_t room = br->in.cap - br->in.len;
+    ssize_t n;
+    if (br->conn.tls) {
+        int r = SSL_read(br->conn.ssl, dst, (int)room);
+        if (r <= 0) return ws_ssl_error(br, r);
+        n = r;
+    } else {
+        n = read(br->conn.fd, dst, room);
+        if (n == 0) return -1;
+        if (n < 0) return ws_would_block(n) ? 0 : -1;
+    }
+
+    br->in.len += (size_t)n;
+    *progress = true;
+    return ws_parse_frames(br);
+}
+
+static int ws_bridge_event(nexterm_reactor_source_t* src,
+                           const nexterm_reactor_events_t* ev, void* data) {
+    ws_bridge_t* br = (ws_bridge_t*)data;
+    uint8_t buf[WS_BUF_SIZE];
+    bool progress = true;
+    int round = 0;
+
+    if (br->session->state != SESSION_STATE_ACTIVE)
+        return NEXTERM_REACTOR_CLOSE;
+
+    for (; progress && round < WS_MAX_ROUNDS; round++) {
+        progress = false;
+        br->tls_want = 0;
+
+        if (!br->closing && ws_buf_pending(&br->out) < WS_BUF_SIZE) {
+            ssize_t n = read(br->data_fd, buf, sizeof(buf));
+            if (n == 0 || (n < 0 && !ws_would_block(n)))
+                return NEXTERM_REACTOR_CLOSE;
+            if (n > 0) {
+                if (ws_queue_frame(br, 0x01, buf, (size_t)n) != 0)
+                    return NEXTERM_REACTOR_CLOSE;
+                progress = true;
+            }
+        }
+
+        if (ws_flush_out(br, &progress) != 0)
+            return NEXTERM_REACTOR_CLOSE;
+
+        if (!br->closing && ws_buf_pending(&br->down) == 0
+                && ws_fill_in(br, &progress) != 0)
+            return NEXTERM_REACTOR_CLOSE;
+
+        size_t pending = ws_buf_pending(&br->down);
+        if (pending > 0) {
+            ssize_t w = write(br->data_fd, br->down.data + br->down.off, pending);
+            if (w < 0 && !ws_would_block(w))
+                return NEXTERM_REACTOR_CLOSE;
+            if (w > 0) {
+                br->down.off += (size_t)w;
+                progress = true;
+            }
+        }
+
+        if (br->closing && ws_buf_pending(&br->out) == 0 && ws_buf_pending(&br->down) == 0)
+            return NEXTERM_REACTOR_CLOSE;
+    }
+
+    if (!progress && (ev->revents[0] & NEXTERM_EV_HUP))
+        return NEXTERM_REACTOR_CLOSE;
+    if (!progress && (ev->revents[1] & NEXTERM_EV_HUP))
+        return NEXTERM_REACTOR_CLOSE;
+
+    uint32_t data_events = 0;
+    if (!br->closing && ws_buf_pending(&br->out) < WS_BUF_SIZE) data_events |= NEXTERM_EV_READ;
+    if (ws_buf_pending(&br->down) > 0) data_events |= NEXTERM_EV_WRITE;
+
+    uint32_t ws_events = br->tls_want;
+    if (!br->closing && ws_buf_pending(&br->down) == 0) ws_events |= NEXTERM_EV_READ;
+    if (ws_buf_pending(&br->out) > 0) ws_events |= NEXTERM_EV_WRITE;
+
+    nexterm_reactor_watch(src, 0, data_events);
+    nexterm_reactor_watch(src, 1, ws_events);
+
+    if (progress)
+        nexterm_reactor_notify(src);
+
+    return NEXTERM_REACTOR_CONTINUE;
+}
+
+static void ws_bridge_close(nexterm_reactor_source_t* src, void* data) {
+    ws_bridge_t* br = (ws_bridge_t*)data;
+    nexterm_session_t* session = br->session;
+
+    LOG_INFO("WebSocket session %s ending", session->session_id);
+
+    nexterm_sm_lock(&g_session_manager);
+    session->data_fd = -1;
+    session->reactor_source = NULL;
+    nexterm_sm_unlock(&g_session_manager);
+    nexterm_reactor_release(src);
+
+    /* Best effort on a reactor worker: one non-blocking attempt at the
+     * close frame and TLS close_notify, never waiting on the peer. */
+    if (!br->closing && ws_queue_frame(br, 0x08, NULL, 0) == 0) {
+        bool progress = false;
+        ws_flush_out(br, &progress);
+    }
+
+    if (br->conn.tls) {
+        SSL_shutdown(br->conn.ssl);
+        SSL_free(br->conn.ssl);
+        SSL_CTX_free(br->ssl_ctx);
+    }
+    close(br->conn.fd);
+    close(br->data_fd);
+
+    char sid[MAX_SESSION_ID_LEN];
+    snprintf(sid, sizeof(sid), "%s", session->session_id);
+    nexterm_cp_send_session_closed(br->cp, sid, "websocket session ended");
+    nexterm_sm_finish(&g_session_manager, sid);
+
+    free(br->in.data);
+    free(br->out.data);
+    free(br->down.data);
+    free(br);
+}
+
+static int ws_bridge_start(nexterm_session_t* session, nexterm_control_plane_t* cp,
+                           const ws_conn_t* conn, SSL_CTX* ssl_ctx, int data_fd) {
+    ws_bridge_t* br = calloc(1, sizeof(ws_bridge_t));
+    if (!br) return -1;
+
+    br->session = session;
+    br->cp = cp;
+    br->conn = *conn;
+    br->ssl_ctx = ssl_ctx;
+    br->data_fd = data_fd;
+
+    int flags = fcntl(data_fd, F_GETFL, 0);
+    if (flags >= 0) fcntl(data_fd, F_SETFL, flags | O_NONBLOCK);
+    flags = fcntl(conn->fd, F_GETFL, 0);
+    if (flags >= 0) fcntl(conn->fd, F_SETFL, flags | O_NONBLOCK);
+
+    int fds[2] = { data_fd, conn->fd };
+    uint32_t events[2] = { NEXTERM_EV_READ, NEXTERM_EV_READ };
+
+    nexterm_sm_lock(&g_session_manager);
+    nexterm_reactor_source_t* src = nexterm_reactor_add(fds, events, 2,
+            ws_bridge_event, ws_bridge_close, br);
+    session->reactor_source = src;
+    nexterm_sm_unlock(&g_session_manager);
+
+    if (!src) {
+        LOG_ERROR("WebSocket session %s: failed to register with reactor", session->session_id);
+        flags = fcntl(conn->fd, F_GETFL, 0);
+        if (flags >= 0) fcntl(conn->fd, F_SETFL, flags & ~O_NONBLOCK);
+        free(br);
+        return -1;
+    }
+
+    nexterm_reactor_notify(src);
+    return 0;
+}
+
 static void* websocket_session_thread(void* arg) {
     ws_thread_args_t* args = (ws_thread_args_t*)arg;
     nexterm_session_t* session = args->session;
@@ -352,6 +632,10 @@ static void* websocket_session_thread(void* arg) {
             return NULL;
         }
 
+        /* The bridge's out buffer may be compacted or grown between a
+         * WANT_WRITE and its retry. */
+        SSL_CTX_set_mode(ssl_ctx, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
         if (insecure)
             SSL_CTX_set_verify(ssl_ctx, SSL_VERIFY_NONE, NULL);
 
@@ -399,60 +683,11 @@ static void* websocket_session_thread(void* arg) {
 
     LOG_INFO("WebSocket session %s active: %s", session->session_id, url);
 
-    uint8_t buf[WS_BUF_SIZE];
-    bool running = true;
-
-    int ws_fd = sock;
-    int ssl_pending;
-
-    while (running && session->state == SESSION_STATE_ACTIVE) {
-        struct pollfd fds[2];
-        fds[0].fd = data_fd;
-        fds[0].events = POLLIN;
-        fds[1].fd = ws_fd;
-        fds[1].events = POLLIN;
-
-        ssl_pending = conn.tls ? SSL_pending(conn.ssl) : 0;
-        int timeout = ssl_pending > 0 ? 0 : 200;
-
-        int ret = poll(fds, 2, timeout);
-        if (ret < 0) {
-            if (errno == EINTR) continue;
-            break;
-        }
-
-        if (fds[0].revents & POLLIN) {
-            ssize_t n = read(data_fd, buf, sizeof(buf));
-            if (n <= 0) break;
-            if (ws_send_frame(&conn, 0x01, buf, (size_t)n, true) != 0) break;
-        }
-        if (fds[0].revents & (POLLERR | POLLHUP | POLLNVAL)) break;
-
-        if ((fds[1].revents & POLLIN) || ssl_pending > 0) {
-            ws_frame_t frame;
-            if (ws_read_frame(&conn, &frame) != 0) break;
-
-            if (frame.opcode == 0x08) {
-                ws_send_frame(&conn, 0x08, NULL, 0, true);
-                free(frame.payload);
-                break;
-            } else if (frame.opcode == 0x09) {
-                ws_send_frame(&conn, 0x0A, frame.payload, frame.payload_len, true);
-            } else if (frame.opcode == 0x01 || frame.opcode == 0x02 || frame.opcode == 0x00) {
-                if (frame.payload && frame.payload_len > 0) {
-                    if (nexterm_write_exact(data_fd, frame.payload, frame.payload_len) != 0) {
-                        free(frame.payload);
-                        break;
-                    }
-                }
-            }
-            free(frame.payload);
-        }
-        if (fds[1].revents & (POLLERR | POLLHUP | POLLNVAL)) break;
+    if (ws_bridge_start(session, cp, &conn, ssl_ctx, data_fd) == 0) {
+        free(args);
+        return NULL;
     }
 
-    LOG_INFO("WebSocket session %s ending", session->session_id);
-
     ws_send_frame(&conn, 0x08, NULL, 0, true);
 
     if (conn.tls) {
@@ -8,17 +8,16 @@
 #include "ftp.h"
 #include "http_fetch.h"
 #include "websocket.h"
+#include "port_scan.h"
 #include "log.h"
 
 #include <errno.h>
+#include <poll.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
-#include <netdb.h>
-#include <fcntl.h>
-#include <poll.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -26,9 +25,56 @@
 #include "control_plane_reader.h"
 
 #define CP_MAX_FRAME_SIZE (16 * 1024 * 1024)
+#define PORT_CHECK_PARTIAL_BATCH 64
+#define PORT_CHECK_PARTIAL_INTERVAL_MS 100
+#define CP_DATA_POOL_RETRY_MS 2000
+#define CP_STREAM_QUEUE_BYTES (256 * 1024)
 
 extern nexterm_session_manager_t g_session_manager;
 
+typedef struct { int fd; SSL* ssl; bool offload; } cp_raw_conn_t;
+
+struct cp_data_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    bool running;
+    cp_raw_conn_t conns[CP_DATA_POOL_MAX];
+    int count;
+};
+
+typedef struct cp_stream_chunk {
+    struct cp_stream_chunk* next;
+    bool is_stderr;
+    size_t len;
+    uint8_t data[];
+} cp_stream_chunk_t;
+
+struct nexterm_cp_stream {
+    nexterm_control_plane_t* cp;
+    char request_id[128];
+    cp_stream_chunk_t* head;
+    cp_stream_chunk_t* tail;
+    size_t queued;
+    bool failed;
+    bool scheduled;
+    nexterm_cp_stream_t* next_ready;
+    pthread_cond_t cond;
+};
+
+struct cp_streams {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    bool running;
+    nexterm_cp_stream_t* ready_head;
+    nexterm_cp_stream_t* ready_tail;
+};
+
+static void cp_close_raw(cp_raw_conn_t* c);
+static void* data_pool_loop(void* arg);
+static void* stream_writer_loop(void* arg);
+
 static int finalize_and_send(flatcc_builder_t* b, int fd, SSL* ssl, pthread_mutex_t* mutex) {
     size_t size;
     uint8_t* buf = (uint8_t*)flatcc_builder_finalize_buffer(b, &size);
@@ -362,11 +408,13 @@ static void handle_exec_command(nexterm_control_plane_t* cp,
         Nexterm_ControlPlane_ExecCommand_jump_hosts(exec_msg),
         jump_hosts, &jump_count);
 
-    LOG_INFO("ExecCommand: req=%s host=%s:%u cmd=%.64s... (jump_hosts=%d)",
-             req_id, host, port, command, jump_count);
+    bool stream = Nexterm_ControlPlane_ExecCommand_stream(exec_msg);
+
+    LOG_INFO("ExecCommand: req=%s host=%s:%u cmd=%.64s... stream=%d (jump_hosts=%d)",
+             req_id, host, port, command, stream, jump_count);
 
     nexterm_ssh_exec_command(cp, req_id, host, port, &creds, command,
-                             jump_hosts, jump_count);
+                             jump_hosts, jump_count, stream);
 }
 
 static void handle_exec_batch(nexterm_control_plane_t* cp,
@@ -423,67 +471,20 @@ static void handle_exec_batch(nexterm_control_plane_t* cp,
         Nexterm_ControlPlane_ExecBatch_jump_hosts(batch_msg),
         jump_hosts, &jump_count);
 
-    LOG_INFO("ExecBatch: req=%s host=%s:%u commands=%zu (jump_hosts=%d)",
-             req_id, host, port, count, jump_count);
+    uint16_t parallelism = Nexterm_ControlPlane_ExecBatch_parallelism(batch_msg);
+    bool stream = Nexterm_ControlPlane_ExecBatch_stream(batch_msg);
+
+    LOG_INFO("ExecBatch: req=%s host=%s:%u commands=%zu parallelism=%u stream=%d (jump_hosts=%d)",
+             req_id, host, port, count, parallelism, stream, jump_count);
 
     nexterm_ssh_exec_batch(cp, req_id, host, port, &creds,
-                           ids, commands, (int)count, jump_hosts, jump_count);
+                           ids, commands, (int)count, jump_hosts, jump_count,
+                           parallelism, stream);
 
     free(ids);
     free(commands);
 }
 
-static bool check_port_open(const char* host, uint16_t port, uint32_t timeout_ms) {
-    struct addrinfo hints = {0};
-    hints.ai_family = AF_UNSPEC;
-    hints.ai_socktype = SOCK_STREAM;
-
-    char port_str[8];
-    snprintf(port_str, sizeof(port_str), "%u", port);
-
-    struct addrinfo* res = NULL;
-    if (getaddrinfo(host, port_str, &hints, &res) != 0 || !res) {
-        if (res) freeaddrinfo(res);
-        return false;
-    }
-
-    int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
-    if (fd < 0) {
-        freeaddrinfo(res);
-        return false;
-    }
-
-    int flags = fcntl(fd, F_GETFL, 0);
-    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
-
-    int rc = connect(fd, res->ai_addr, res->ai_addrlen);
-    freeaddrinfo(res);
-
-    if (rc == 0) {
-        close(fd);
-        return true;
-    }
-
-    if (errno != EINPROGRESS) {
-        close(fd);
-        return false;
-    }
-
-    struct pollfd pfd = { .fd = fd, .events = POLLOUT };
-    rc = poll(&pfd, 1, (int)timeout_ms);
-
-    if (rc <= 0) {
-        close(fd);
-        return false;
-    }
-
-    int err = 0;
-    socklen_t len = sizeof(err);
-    getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
-    close(fd);
-    return err == 0;
-}
-
 typedef struct {
     nexterm_control_plane_t* cp;
     char* request_id;
@@ -492,6 +493,13 @@ typedef struct {
     uint16_t* ports;
     size_t count;
     uint32_t timeout_ms;
+    int concurrency;
+    bool stream;
+    bool* online;
+    const char** partial_ids;
+    bool* partial_online;
+    size_t partial_count;
+    int64_t partial_flushed;
 } port_check_ctx_t;
 
 static void free_port_check_ctx(port_check_ctx_t* ctx) {
@@ -502,24 +510,80 @@ static void free_port_check_ctx(port_check_ctx_t* ctx) {
     free(ctx->ids);
     free(ctx->hosts);
     free(ctx->ports);
+    free(ctx->online);
+    free(ctx->partial_ids);
+    free(ctx->partial_online);
     free(ctx->request_id);
     free(ctx);
 }
 
+static int64_t port_check_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void port_check_flush(port_check_ctx_t* ctx) {
+    if (ctx->partial_count == 0) return;
+    nexterm_cp_send_port_check_result(ctx->cp, ctx->request_id, ctx->partial_ids,
+                                      ctx->partial_online, ctx->partial_count, true);
+    ctx->partial_count = 0;
+    ctx->partial_flushed = port_check_now_ms();
+}
+
+static void port_check_on_result(void* arg, size_t index, bool online) {
+    port_check_ctx_t* ctx = (port_check_ctx_t*)arg;
+    ctx->online[index] = online;
+    if (!ctx->stream) return;
+
+    ctx->partial_ids[ctx->partial_count] = ctx->ids[index];
+    ctx->partial_online[ctx->partial_count] = online;
+    ctx->partial_count++;
+
+    if (ctx->partial_count >= PORT_CHECK_PARTIAL_BATCH ||
+        port_check_now_ms() - ctx->partial_flushed >= PORT_CHECK_PARTIAL_INTERVAL_MS)
+        port_check_flush(ctx);
+}
+
+/* Sends whatever trickled in since the last batch, so results that arrive
+ * just before a long quiet stretch are not held until the next one. */
+static void port_check_on_tick(void* arg) {
+    port_check_ctx_t* ctx = (port_check_ctx_t*)arg;
+    if (port_check_now_ms() - ctx->partial_flushed >= PORT_CHECK_PARTIAL_INTERVAL_MS)
+        port_check_flush(ctx);
+}
+
 static void* port_check_thread(void* arg) {
     port_check_ctx_t* ctx = (port_check_ctx_t*)arg;
-    bool* results = calloc(ctx->count, sizeof(bool));
-    if (!results) {
+    nexterm_port_target_t* targets = calloc(ctx->count, sizeof(nexterm_port_target_t));
+    ctx->online = calloc(ctx->count, sizeof(bool));
+    if (ctx->stream) {
+        ctx->partial_ids = calloc(PORT_CHECK_PARTIAL_BATCH, sizeof(char*));
+        ctx->partial_online = calloc(PORT_CHECK_PARTIAL_BATCH, sizeof(bool));
+        ctx->partial_flushed = port_check_now_ms();
+        if (!ctx->partial_ids || !ctx->partial_online) ctx->stream = false;
+    }
+    if (!targets || !ctx->online) {
+        free(targets);
         free_port_check_ctx(ctx);
         return NULL;
     }
 
-    for (size_t i = 0; i < ctx->count; i++)
-        results[i] = check_port_open(ctx->hosts[i], ctx->ports[i], ctx->timeout_ms);
+    for (size_t i = 0; i < ctx->count; i++) {
+        targets[i].host = ctx->hosts[i];
+        targets[i].port = ctx->ports[i];
+    }
+
+    if (nexterm_port_scan(targets, ctx->count, ctx->timeout_ms, ctx->concurrency,
+                          port_check_on_result,
+                          ctx->stream ? port_check_on_tick : NULL,
+                          PORT_CHECK_PARTIAL_INTERVAL_MS, ctx) != 0)
+        LOG_ERROR("PortCheck: scanner setup failed for req=%s", ctx->request_id);
+    if (ctx->stream) port_check_flush(ctx);
 
     nexterm_cp_send_port_check_result(ctx->cp, ctx->request_id,
-                                      (const char**)ctx->ids, results, ctx->count);
-    free(results);
+                                      (const char**)ctx->ids, ctx->online, ctx->count, false);
+    free(targets);
     free_port_check_ctx(ctx);
     return NULL;
 }
@@ -544,6 +608,8 @@ static void handle_port_check(nexterm_control_plane_t* cp,
     ctx->request_id = strdup(req_id);
     ctx->count = count;
     ctx->timeout_ms = timeout_ms;
+    ctx->concurrency = Nexterm_ControlPlane_PortCheck_concurrency(pc_msg);
+    ctx->stream = Nexterm_ControlPlane_PortCheck_stream(pc_msg);
     ctx->ids = calloc(count, sizeof(char*));
     ctx->hosts = calloc(count, sizeof(char*));
     ctx->ports = calloc(count, sizeof(uint16_t));
@@ -727,7 +793,8 @@ nexterm_control_plane_t* nexterm_cp_create(const char* server_host,
                                            const char* registration_token,
                                            bool use_tls,
                                            const char* ca_cert_path,
-                                           bool tls_skip_verify) {
+                                           bool tls_skip_verify,
+                                           bool tls_offload) {
     nexterm_control_plane_t* cp = calloc(1, sizeof(nexterm_control_plane_t));
     if (!cp) return NULL;
 
@@ -750,6 +817,8 @@ nexterm_control_plane_t* nexterm_cp_create(const char* server_host,
     cp->use_tls = use_tls;
     cp->ssl_ctx = NULL;
     cp->ssl = NULL;
+    cp->data_ssl_ctx = NULL;
+    atomic_init(&cp->data_offload, false);
 
     if (use_tls) {
         cp->ssl_ctx = nexterm_tls_client_ctx_create(ca_cert_path, tls_skip_verify);
@@ -761,7 +830,45 @@ nexterm_control_plane_t* nexterm_cp_create(const char* server_host,
             return NULL;
         }
         LOG_INFO("TLS enabled for control plane connections");
+
+        /* Opt-in: kernel TLS needs data connections held to TLS 1.2. */
+        if (tls_offload)
+            cp->data_ssl_ctx = nexterm_tls_client_ctx_create(ca_cert_path, tls_skip_verify);
+        if (cp->data_ssl_ctx && nexterm_tls_enable_offload(cp->data_ssl_ctx)) {
+            atomic_store(&cp->data_offload, true);
+            LOG_INFO("Kernel TLS offload enabled for data connections (TLS 1.2)");
+        } else if (cp->data_ssl_ctx) {
+            SSL_CTX_free(cp->data_ssl_ctx);
+            cp->data_ssl_ctx = NULL;
+        }
+    }
+
+    cp->data_pool = calloc(1, sizeof(struct cp_data_pool));
+    if (!cp->data_pool) {
+        if (cp->ssl_ctx) SSL_CTX_free(cp->ssl_ctx);
+        if (cp->data_ssl_ctx) SSL_CTX_free(cp->data_ssl_ctx);
+        free(cp->server_host);
+        free(cp->registration_token);
+        free(cp);
+        return NULL;
+    }
+    pthread_mutex_init(&cp->data_pool->lock, NULL);
+    pthread_cond_init(&cp->data_pool->cond, NULL);
+
+    cp->streams = calloc(1, sizeof(struct cp_streams));
+    if (!cp->streams) {
+        pthread_cond_destroy(&cp->data_pool->cond);
+        pthread_mutex_destroy(&cp->data_pool->lock);
+        free(cp->data_pool);
+        if (cp->ssl_ctx) SSL_CTX_free(cp->ssl_ctx);
+        if (cp->data_ssl_ctx) SSL_CTX_free(cp->data_ssl_ctx);
+        free(cp->server_host);
+        free(cp->registration_token);
+        free(cp);
+        return NULL;
     }
+    pthread_mutex_init(&cp->streams->lock, NULL);
+    pthread_cond_init(&cp->streams->cond, NULL);
 
     pthread_mutex_init(&cp->send_mutex, NULL);
     return cp;
@@ -815,11 +922,51 @@ int nexterm_cp_start(nexterm_control_plane_t* cp) {
         return -1;
     }
 
+    if (cp->data_pool_size > 0) {
+        cp->data_pool->running = true;
+        if (pthread_create(&cp->data_pool->thread, NULL, data_pool_loop, cp) != 0) {
+            LOG_WARN("Failed to start data connection pool, opening connections on demand");
+            cp->data_pool->running = false;
+        }
+    }
+
     LOG_INFO("Control plane client started");
     return 0;
 }
 
+static void cp_data_pool_stop(nexterm_control_plane_t* cp) {
+    struct cp_data_pool* pool = cp->data_pool;
+
+    pthread_mutex_lock(&pool->lock);
+    bool was_running = pool->running;
+    pool->running = false;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+    if (was_running)
+        pthread_join(pool->thread, NULL);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->count > 0)
+        cp_close_raw(&pool->conns[--pool->count]);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/* Queued output is failed rather than sent; producers see the error on
+ * their next write or on close. */
+static void cp_streams_stop(nexterm_control_plane_t* cp) {
+    struct cp_streams* w = cp->streams;
+
+    pthread_mutex_lock(&w->lock);
+    bool was_running = w->running;
+    w->running = false;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+    if (was_running)
+        pthread_join(w->thread, NULL);
+}
+
 void nexterm_cp_stop(nexterm_control_plane_t* cp) {
+    cp_data_pool_stop(cp);
     if (!cp->running) return;
 
     LOG_INFO("Stopping control plane client");
@@ -828,6 +975,8 @@ void nexterm_cp_stop(nexterm_control_plane_t* cp) {
     if (cp->sock_fd >= 0)
         shutdown(cp->sock_fd, SHUT_RDWR);
 
+    cp_streams_stop(cp);
+
     pthread_join(cp->read_thread, NULL);
     pthread_join(cp->keepalive_thread, NULL);
 
@@ -849,6 +998,16 @@ void nexterm_cp_destroy(nexterm_control_plane_t* cp) {
         SSL_CTX_free(cp->ssl_ctx);
         cp->ssl_ctx = NULL;
     }
+    if (cp->data_ssl_ctx) {
+        SSL_CTX_free(cp->data_ssl_ctx);
+        cp->data_ssl_ctx = NULL;
+    }
+    pthread_cond_destroy(&cp->data_pool->cond);
+    pthread_mutex_destroy(&cp->data_pool->lock);
+    free(cp->data_pool);
+    pthread_cond_destroy(&cp->streams->cond);
+    pthread_mutex_destroy(&cp->streams->lock);
+    free(cp->streams);
     pthread_mutex_destroy(&cp->send_mutex);
     free(cp->server_host);
     free(cp->registration_token);
@@ -910,64 +1069,191 @@ int nexterm_cp_send_session_closed(nexterm_control_plane_t* cp,
     return cp_send(cp, &builder);
 }
 
-typedef struct { int fd; SSL* ssl; } cp_raw_conn_t;
-
-static int cp_connect_raw(const nexterm_control_plane_t* cp, cp_raw_conn_t* c) {
+static int cp_connect_raw_ctx(const nexterm_control_plane_t* cp, SSL_CTX* ctx,
+                              cp_raw_conn_t* c) {
     c->fd = nexterm_tcp_connect(cp->server_host, cp->server_port);
     if (c->fd < 0) return -1;
     c->ssl = NULL;
+    c->offload = false;
     if (cp->use_tls) {
-        c->ssl = nexterm_tls_handshake(cp->ssl_ctx, c->fd);
+        c->ssl = nexterm_tls_handshake(ctx, c->fd);
         if (!c->ssl) { close(c->fd); return -1; }
     }
     return 0;
 }
 
+static int cp_connect_raw(const nexterm_control_plane_t* cp, cp_raw_conn_t* c) {
+    return cp_connect_raw_ctx(cp, cp->ssl_ctx, c);
+}
+
 static void cp_close_raw(cp_raw_conn_t* c) {
     if (c->ssl) nexterm_tls_cleanup(c->ssl);
     close(c->fd);
 }
 
-int nexterm_cp_open_data_connection(const nexterm_control_plane_t* cp,
-                                    const char* session_id) {
-    LOG_DEBUG("Opening data connection for session %s%s",
-             session_id, cp->use_tls ? " (TLS)" : "");
-
-    cp_raw_conn_t conn;
-    if (cp_connect_raw(cp, &conn) != 0) {
-        LOG_ERROR("Failed to open data connection for session %s", session_id);
+static int cp_data_connect(nexterm_control_plane_t* cp, cp_raw_conn_t* c) {
+    bool offload = cp->use_tls && atomic_load(&cp->data_offload);
+    if (cp_connect_raw_ctx(cp, offload ? cp->data_ssl_ctx : cp->ssl_ctx, c) != 0)
         return -1;
-    }
+    c->offload = offload;
+    return 0;
+}
 
+static int cp_send_connection_ready(cp_raw_conn_t* c, const char* session_id) {
     flatcc_builder_t builder;
     flatcc_builder_init(&builder);
 
     Nexterm_ControlPlane_Envelope_start_as_root(&builder);
     Nexterm_ControlPlane_Envelope_msg_type_add(&builder, Nexterm_ControlPlane_MessageType_ConnectionReady);
     Nexterm_ControlPlane_Envelope_connection_ready_start(&builder);
-    Nexterm_ControlPlane_ConnectionReady_session_id_create_str(&builder, session_id);
+    if (session_id)
+        Nexterm_ControlPlane_ConnectionReady_session_id_create_str(&builder, session_id);
     Nexterm_ControlPlane_Envelope_connection_ready_end(&builder);
     Nexterm_ControlPlane_Envelope_end_as_root(&builder);
 
-    if (finalize_and_send(&builder, conn.fd, conn.ssl, NULL) != 0) {
-        LOG_ERROR("Failed to send ConnectionReady for session %s", session_id);
-        cp_close_raw(&conn);
-        return -1;
+    return finalize_and_send(&builder, c->fd, c->ssl, NULL);
+}
+
+static int cp_data_finish(nexterm_control_plane_t* cp, cp_raw_conn_t* conn,
+                          const char* session_id) {
+    if (conn->ssl && nexterm_tls_offloaded(conn->ssl)) {
+        nexterm_tls_detach(conn->ssl);
+        LOG_DEBUG("TLS data connection offloaded to kernel for session %s (fd=%d)",
+                  session_id, conn->fd);
+        return conn->fd;
     }
 
-    if (conn.ssl) {
-        int plain_fd = nexterm_tls_proxy_start(conn.ssl, conn.fd);
+    if (conn->ssl && conn->offload && atomic_exchange(&cp->data_offload, false))
+        LOG_WARN("Kernel TLS is unavailable, falling back to proxied TLS data connections");
+
+    if (conn->ssl) {
+        int plain_fd = nexterm_tls_proxy_start(conn->ssl, conn->fd);
         if (plain_fd < 0) {
             LOG_ERROR("Failed to start TLS proxy for session %s", session_id);
-            cp_close_raw(&conn);
+            cp_close_raw(conn);
             return -1;
         }
         LOG_DEBUG("TLS data connection proxied for session %s (plain_fd=%d)", session_id, plain_fd);
         return plain_fd;
     }
 
-    LOG_DEBUG("Data connection established for session %s (fd=%d)", session_id, conn.fd);
-    return conn.fd;
+    LOG_DEBUG("Data connection established for session %s (fd=%d)", session_id, conn->fd);
+    return conn->fd;
+}
+
+static bool cp_data_pool_alive(const cp_raw_conn_t* c) {
+    struct pollfd pfd = { .fd = c->fd, .events = POLLIN };
+    return poll(&pfd, 1, 0) == 0;
+}
+
+/* Drops pre-opened connections the server has closed (it expires idle
+ * ones), so the loop refills them before a session needs one. */
+static void cp_data_pool_sweep(struct cp_data_pool* pool) {
+    for (int i = pool->count - 1; i >= 0; i--) {
+        if (cp_data_pool_alive(&pool->conns[i])) continue;
+        cp_close_raw(&pool->conns[i]);
+        pool->conns[i] = pool->conns[--pool->count];
+    }
+}
+
+static bool cp_data_pool_take(nexterm_control_plane_t* cp, cp_raw_conn_t* out) {
+    struct cp_data_pool* pool = cp->data_pool;
+    bool found = false;
+
+    pthread_mutex_lock(&pool->lock);
+    while (!found && pool->count > 0) {
+        cp_raw_conn_t c = pool->conns[--pool->count];
+        if (cp_data_pool_alive(&c)) {
+            *out = c;
+            found = true;
+        } else {
+            cp_close_raw(&c);
+        }
+    }
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    return found;
+}
+
+static void cp_data_pool_wait(struct cp_data_pool* pool, uint32_t ms) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += ms / 1000;
+    ts.tv_nsec += (long)(ms % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(&pool->cond, &pool->lock, &ts);
+}
+
+static void* data_pool_loop(void* arg) {
+    nexterm_control_plane_t* cp = (nexterm_control_plane_t*)arg;
+    struct cp_data_pool* pool = cp->data_pool;
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->running) {
+        if (pool->count >= cp->data_pool_size || !cp->connected) {
+            cp_data_pool_sweep(pool);
+            cp_data_pool_wait(pool, 1000);
+            continue;
+        }
+        pthread_mutex_unlock(&pool->lock);
+
+        cp_raw_conn_t conn;
+        bool ok = cp_data_connect(cp, &conn) == 0;
+        if (ok && cp_send_connection_ready(&conn, NULL) != 0) {
+            cp_close_raw(&conn);
+            ok = false;
+        }
+        if (ok) {
+            int on = 1;
+            setsockopt(conn.fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        if (ok && pool->running && pool->count < cp->data_pool_size) {
+            pool->conns[pool->count++] = conn;
+        } else if (ok) {
+            cp_close_raw(&conn);
+        } else {
+            LOG_WARN("Failed to pre-open data connection, retrying in %u ms",
+                     CP_DATA_POOL_RETRY_MS);
+            cp_data_pool_wait(pool, CP_DATA_POOL_RETRY_MS);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+int nexterm_cp_open_data_connection(nexterm_control_plane_t* cp,
+                                    const char* session_id) {
+    LOG_DEBUG("Opening data connection for session %s%s",
+             session_id, cp->use_tls ? " (TLS)" : "");
+
+    cp_raw_conn_t conn;
+    while (cp_data_pool_take(cp, &conn)) {
+        if (cp_send_connection_ready(&conn, session_id) == 0) {
+            LOG_DEBUG("Using pre-opened data connection for session %s", session_id);
+            return cp_data_finish(cp, &conn, session_id);
+        }
+        cp_close_raw(&conn);
+    }
+
+    if (cp_data_connect(cp, &conn) != 0) {
+        LOG_ERROR("Failed to open data connection for session %s", session_id);
+        return -1;
+    }
+
+    if (cp_send_connection_ready(&conn, session_id) != 0) {
+        LOG_ERROR("Failed to send ConnectionReady for session %s", session_id);
+        cp_close_raw(&conn);
+        return -1;
+    }
+
+    return cp_data_finish(cp, &conn, session_id);
 }
 
 int nexterm_cp_send_exec_result(nexterm_control_plane_t* cp,
@@ -1002,6 +1288,194 @@ int nexterm_cp_send_exec_result(nexterm_control_plane_t* cp,
     return cp_send(cp, &builder);
 }
 
+static void add_exec_batch_entry(flatcc_builder_t* builder,
+                                 const exec_batch_entry_t* e) {
+    Nexterm_ControlPlane_ExecBatchEntry_id_create_str(builder, e->id ? e->id : "");
+    Nexterm_ControlPlane_ExecBatchEntry_success_add(builder, e->success);
+    if (e->stdout_data)
+        Nexterm_ControlPlane_ExecBatchEntry_stdout_data_create_str(builder, e->stdout_data);
+    if (e->stderr_data)
+        Nexterm_ControlPlane_ExecBatchEntry_stderr_data_create_str(builder, e->stderr_data);
+    Nexterm_ControlPlane_ExecBatchEntry_exit_code_add(builder, e->exit_code);
+    if (e->error_message)
+        Nexterm_ControlPlane_ExecBatchEntry_error_message_create_str(builder, e->error_message);
+}
+
+int nexterm_cp_send_exec_batch_entry(nexterm_control_plane_t* cp,
+                                     const char* request_id,
+                                     const exec_batch_entry_t* entry) {
+    flatcc_builder_t builder;
+    flatcc_builder_init(&builder);
+
+    Nexterm_ControlPlane_Envelope_start_as_root(&builder);
+    Nexterm_ControlPlane_Envelope_msg_type_add(&builder,
+        Nexterm_ControlPlane_MessageType_ExecBatchEntryResult);
+
+    Nexterm_ControlPlane_Envelope_exec_batch_entry_result_start(&builder);
+    Nexterm_ControlPlane_ExecBatchEntryResult_request_id_create_str(&builder, request_id);
+    Nexterm_ControlPlane_ExecBatchEntryResult_entry_start(&builder);
+    add_exec_batch_entry(&builder, entry);
+    Nexterm_ControlPlane_ExecBatchEntryResult_entry_end(&builder);
+    Nexterm_ControlPlane_Envelope_exec_batch_entry_result_end(&builder);
+    Nexterm_ControlPlane_Envelope_end_as_root(&builder);
+
+    return cp_send(cp, &builder);
+}
+
+static int cp_send_exec_output(nexterm_control_plane_t* cp,
+                               const char* request_id,
+                               bool is_stderr,
+                               const uint8_t* data,
+                               size_t len) {
+    flatcc_builder_t builder;
+    flatcc_builder_init(&builder);
+
+    Nexterm_ControlPlane_Envelope_start_as_root(&builder);
+    Nexterm_ControlPlane_Envelope_msg_type_add(&builder,
+        Nexterm_ControlPlane_MessageType_ExecOutputChunk);
+
+    Nexterm_ControlPlane_Envelope_exec_output_chunk_start(&builder);
+    Nexterm_ControlPlane_ExecOutputChunk_request_id_create_str(&builder, request_id);
+    Nexterm_ControlPlane_ExecOutputChunk_is_stderr_add(&builder, is_stderr);
+    Nexterm_ControlPlane_ExecOutputChunk_data_create(&builder, data, len);
+    Nexterm_ControlPlane_Envelope_exec_output_chunk_end(&builder);
+    Nexterm_ControlPlane_Envelope_end_as_root(&builder);
+
+    return cp_send(cp, &builder);
+}
+
+static void stream_drop_queued(nexterm_cp_stream_t* s) {
+    while (s->head) {
+        cp_stream_chunk_t* c = s->head;
+        s->head = c->next;
+        free(c);
+    }
+    s->tail = NULL;
+    s->queued = 0;
+}
+
+/* Sends one chunk per ready stream per turn, so concurrent streams share the
+ * socket and each frame releases send_mutex for other control messages. */
+static void* stream_writer_loop(void* arg) {
+    nexterm_control_plane_t* cp = arg;
+    struct cp_streams* w = cp->streams;
+
+    pthread_mutex_lock(&w->lock);
+    for (;;) {
+        while (w->running && !w->ready_head)
+            pthread_cond_wait(&w->cond, &w->lock);
+        nexterm_cp_stream_t* s = w->ready_head;
+        if (!s) break;
+
+        w->ready_head = s->next_ready;
+        if (!w->ready_head) w->ready_tail = NULL;
+        s->next_ready = NULL;
+
+        cp_stream_chunk_t* c = s->head;
+        s->head = c->next;
+        if (!s->head) s->tail = NULL;
+        bool running = w->running;
+        pthread_mutex_unlock(&w->lock);
+
+        int rc = running
+            ? cp_send_exec_output(cp, s->request_id, c->is_stderr, c->data, c->len)
+            : -1;
+
+        pthread_mutex_lock(&w->lock);
+        s->queued -= c->len;
+        free(c);
+        if (rc != 0) {
+            s->failed = true;
+            stream_drop_queued(s);
+        }
+        if (s->head) {
+            if (w->ready_tail) w->ready_tail->next_ready = s;
+            else w->ready_head = s;
+            w->ready_tail = s;
+        } else {
+            s->scheduled = false;
+        }
+        pthread_cond_broadcast(&s->cond);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+nexterm_cp_stream_t* nexterm_cp_stream_open(nexterm_control_plane_t* cp,
+                                            const char* request_id) {
+    struct cp_streams* w = cp->streams;
+    nexterm_cp_stream_t* s = calloc(1, sizeof(*s));
+    if (!s) return NULL;
+    s->cp = cp;
+    snprintf(s->request_id, sizeof(s->request_id), "%s", request_id);
+    pthread_cond_init(&s->cond, NULL);
+
+    pthread_mutex_lock(&w->lock);
+    if (!w->running && cp->running) {
+        w->running = pthread_create(&w->thread, NULL, stream_writer_loop, cp) == 0;
+        if (!w->running) LOG_ERROR("Failed to start control plane stream writer");
+    }
+    bool ok = w->running;
+    pthread_mutex_unlock(&w->lock);
+
+    if (!ok) {
+        pthread_cond_destroy(&s->cond);
+        free(s);
+        return NULL;
+    }
+    return s;
+}
+
+int nexterm_cp_stream_write(nexterm_cp_stream_t* s, bool is_stderr,
+                            const uint8_t* data, size_t len) {
+    struct cp_streams* w = s->cp->streams;
+    cp_stream_chunk_t* c = malloc(sizeof(*c) + len);
+    if (!c) return -1;
+    c->next = NULL;
+    c->is_stderr = is_stderr;
+    c->len = len;
+    memcpy(c->data, data, len);
+
+    pthread_mutex_lock(&w->lock);
+    while (w->running && !s->failed && s->queued > 0 &&
+           s->queued + len > CP_STREAM_QUEUE_BYTES)
+        pthread_cond_wait(&s->cond, &w->lock);
+    if (!w->running || s->failed) {
+        s->failed = true;
+        pthread_mutex_unlock(&w->lock);
+        free(c);
+        return -1;
+    }
+
+    if (s->tail) s->tail->next = c;
+    else s->head = c;
+    s->tail = c;
+    s->queued += len;
+    if (!s->scheduled) {
+        s->scheduled = true;
+        if (w->ready_tail) w->ready_tail->next_ready = s;
+        else w->ready_head = s;
+        w->ready_tail = s;
+        pthread_cond_signal(&w->cond);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return 0;
+}
+
+int nexterm_cp_stream_close(nexterm_cp_stream_t* s) {
+    struct cp_streams* w = s->cp->streams;
+
+    pthread_mutex_lock(&w->lock);
+    while (s->scheduled)
+        pthread_cond_wait(&s->cond, &w->lock);
+    bool failed = s->failed;
+    pthread_mutex_unlock(&w->lock);
+
+    pthread_cond_destroy(&s->cond);
+    free(s);
+    return failed ? -1 : 0;
+}
+
 int nexterm_cp_send_exec_batch_result(nexterm_control_plane_t* cp,
                                       const char* request_id,
                                       bool success,
@@ -1025,16 +1499,7 @@ int nexterm_cp_send_exec_batch_result(nexterm_control_plane_t* cp,
         Nexterm_ControlPlane_ExecBatchResult_results_start(&builder);
         for (size_t i = 0; i < count; i++) {
             Nexterm_ControlPlane_ExecBatchResult_results_push_start(&builder);
-            Nexterm_ControlPlane_ExecBatchEntry_id_create_str(&builder,
-                entries[i].id ? entries[i].id : "");
-            Nexterm_ControlPlane_ExecBatchEntry_success_add(&builder, entries[i].success);
-            if (entries[i].stdout_data)
-                Nexterm_ControlPlane_ExecBatchEntry_stdout_data_create_str(&builder, entries[i].stdout_data);
-            if (entries[i].stderr_data)
-                Nexterm_ControlPlane_ExecBatchEntry_stderr_data_create_str(&builder, entries[i].stderr_data);
-            Nexterm_ControlPlane_ExecBatchEntry_exit_code_add(&builder, entries[i].exit_code);
-            if (entries[i].error_message)
-                Nexterm_ControlPlane_ExecBatchEntry_error_message_create_str(&builder, entries[i].error_message);
+            add_exec_batch_entry(&builder, &entries[i]);
             Nexterm_ControlPlane_ExecBatchResult_results_push_end(&builder);
         }
         Nexterm_ControlPlane_ExecBatchResult_results_end(&builder);
@@ -1050,7 +1515,8 @@ int nexterm_cp_send_port_check_result(nexterm_control_plane_t* cp,
                                        const char* request_id,
                                        const char** ids,
                                        const bool* online,
-                                       size_t count) {
+                                       size_t count,
+                                       bool partial) {
     flatcc_builder_t builder;
     flatcc_builder_init(&builder);
 
@@ -1069,6 +1535,7 @@ int nexterm_cp_send_port_check_result(nexterm_control_plane_t* cp,
         Nexterm_ControlPlane_PortCheckResult_results_push_end(&builder);
     }
     Nexterm_ControlPlane_PortCheckResult_results_end(&builder);
+    Nexterm_ControlPlane_PortCheckResult_partial_add(&builder, partial);
 
     Nexterm_ControlPlane_Envelope_port_check_result_end(&builder);
     Nexterm_ControlPlane_Envelope_end_as_root(&builder);
@@ -4,10 +4,15 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <openssl/ssl.h>
 
+#define CP_DATA_POOL_MAX 16
+
 #define NEXTERM_ENGINE_VERSION "1.2.2-BETA"
 
+typedef struct nexterm_cp_stream nexterm_cp_stream_t;
+
 typedef struct nexterm_control_plane {
     int sock_fd;
     bool connected;
@@ -28,6 +33,17 @@ typedef struct nexterm_control_plane {
     bool use_tls;
     SSL_CTX* ssl_ctx;
     SSL* ssl;
+
+    SSL_CTX* data_ssl_ctx;
+    atomic_bool data_offload;
+
+    int data_pool_size;
+    struct cp_data_pool* data_pool;
+
+    struct cp_streams* streams;
+
+    bool chained_output;
+    int broadcast_queue_kb;
 } nexterm_control_plane_t;
 
 nexterm_control_plane_t* nexterm_cp_create(const char* server_host,
@@ -35,7 +51,8 @@ nexterm_control_plane_t* nexterm_cp_create(const char* server_host,
                                            const char* registration_token,
                                            bool use_tls,
                                            const char* ca_cert_path,
-                                           bool tls_skip_verify);
+                                           bool tls_skip_verify,
+                                           bool tls_offload);
 
 int nexterm_cp_start(nexterm_control_plane_t* cp);
 
@@ -55,7 +72,7 @@ int nexterm_cp_send_session_closed(nexterm_control_plane_t* cp,
                                     const char* session_id,
                                     const char* reason);
 
-int nexterm_cp_open_data_connection(const nexterm_control_plane_t* cp,
+int nexterm_cp_open_data_connection(nexterm_control_plane_t* cp,
                                     const char* session_id);
 
 int nexterm_cp_send_exec_result(nexterm_control_plane_t* cp,
@@ -66,11 +83,26 @@ int nexterm_cp_send_exec_result(nexterm_control_plane_t* cp,
                                 int32_t exit_code,
                                 const char* error_message);
 
+/* Streamed exec output. Each stream has its own bounded queue and one writer
+ * thread sends the queues round-robin, so a fast producer blocks only itself
+ * and other control messages slot in between its chunks. */
+nexterm_cp_stream_t* nexterm_cp_stream_open(nexterm_control_plane_t* cp,
+                                            const char* request_id);
+
+/* Blocks while the stream's queue is full; -1 once a send has failed. */
+int nexterm_cp_stream_write(nexterm_cp_stream_t* stream, bool is_stderr,
+                            const uint8_t* data, size_t len);
+
+/* Waits until everything queued has gone out, then frees the stream.
+ * Returns -1 if any of it could not be sent. */
+int nexterm_cp_stream_close(nexterm_cp_stream_t* stream);
+
 int nexterm_cp_send_port_check_result(nexterm_control_plane_t* cp,
                                        const char* request_id,
                                        const char** ids,
                                        const bool* online,
-                                       size_t count);
+                                       size_t count,
+                                       bool partial);
 
 typedef struct {
     const char* id;
@@ -88,6 +120,10 @@ int nexterm_cp_send_exec_batch_result(nexterm_control_plane_t* cp,
                                       const exec_batch_entry_t* entries,
                                       size_t count);
 
+int nexterm_cp_send_exec_batch_entry(nexterm_control_plane_t* cp,
+                                     const char* request_id,
+                                     const exec_batch_entry_t* entry);
+
 int nexterm_cp_upload_recording(nexterm_control_plane_t* cp,
                                 const char* session_id,
                                 const char* file_path);
@@ -1,6 +1,8 @@
 const controlPlane = require("../../lib/controlPlane/ControlPlaneServer");
 
-const checkServerStatusBatch = async (entries, timeoutMs = 2000) => {
+const toStatus = (entry) => ({ id: Number(entry.id), status: entry.online ? "online" : "offline" });
+
+const checkServerStatusBatch = async (entries, timeoutMs = 2000, onPartial = null) => {
     if (!controlPlane.hasEngine()) throw new Error("No engine connected");
 
     const targets = [];
@@ -17,7 +19,8 @@ const checkServerStatusBatch = async (entries, timeoutMs = 2000) => {
 
     if (targets.length === 0) return skipped;
 
-    const result = await controlPlane.portCheck(targets, timeoutMs);
+    const options = onPartial ? { onPartial: (partial) => onPartial(partial.map(toStatus)) } : {};
+    const result = await controlPlane.portCheck(targets, timeoutMs, null, options);
     const statusMap = new Map(result.entries.map(e => [e.id, e.online ? "online" : "offline"]));
     return [
         ...targets.map(t => ({ id: Number(t.id), status: statusMap.get(t.id) || "offline" })),
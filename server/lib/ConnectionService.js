@@ -145,6 +145,8 @@ const resolveFileTransferContext = async (entry, identityId, directIdentity, acc
     const { host, port } = getHostPort(entry, FILE_TRANSFER_PORTS[protocol] ?? 22);
     const params = buildSSHParams(identity, credentials);
     if (protocol) params.protocol = protocol;
+    if (accountId) params.accountId = accountId;
+    if (identity.id) params.identityId = identity.id;
     return { identity, credentials, host, port, params };
 };
 
@@ -11,6 +11,7 @@ const { sendFrame, createFrameParser } = require("./controlPlane/frameProtocol")
 const logger = require("../utils/logger");
 
 const WRITE_CHUNK_SIZE = 262144;
+const WRITE_WINDOW = 4 * 1024 * 1024;
 const REQUEST_TIMEOUT = 30000;
 const WRITE_END_TIMEOUT = 120000;
 const EXEC_TIMEOUT = 300000;
@@ -77,6 +78,11 @@ const MESSAGE_HANDLERS = {
         pending.onFileEnd?.();
     },
 
+    [SftpMsgType.WriteAck]: (msg, _rid, pending) => {
+        const res = msg.writeAckRes();
+        pending.onWriteAck?.(Number(res?.committed() ?? 0n), res?.window() || 0);
+    },
+
     [SftpMsgType.ExecResult]: (msg, rid, pending, self) => {
         const res = msg.execRes();
         self._resolvePending(rid, pending, res
@@ -253,37 +259,74 @@ class EngineSftpClient extends EventEmitter {
         return { stream, totalSizePromise, done };
     }
 
-    async writeFile(path, source) {
+    async writeFile(path, source, offset = 0) {
         const rid = this._nextId();
 
         this._buildAndSend(rid, SftpMsgType.WriteBegin, (b) => {
             const pathOff = b.createString(path);
             WriteBeginReq.startWriteBeginReq(b);
             WriteBeginReq.addPath(b, pathOff);
+            if (offset > 0) WriteBeginReq.addOffset(b, BigInt(offset));
             return { writeBeginReq: WriteBeginReq.endWriteBeginReq(b) };
         });
 
         await this._waitResponse(rid);
 
+        let sent = offset;
+        let committed = offset;
+        // Static credit window measured from the committed offset; acks
+        // return credit by advancing `committed`, the size never shrinks.
+        let window = WRITE_WINDOW;
+        let waiter = null;
+        let failure = null;
+
+        const wake = () => {
+            if (!waiter) return;
+            const w = waiter;
+            waiter = null;
+            w();
+        };
+
+        this._pending.set(rid, {
+            onWriteAck: (c, w) => {
+                committed = c;
+                if (w > 0) window = w;
+                wake();
+            },
+            onError: (msg) => {
+                failure = new Error(msg);
+                wake();
+            },
+            reject: (err) => {
+                failure = err;
+                wake();
+            },
+        });
+
+        const send = async (chunk) => {
+            while (!failure && !this._closed && sent - committed + chunk.length > window
+                   && sent > committed) {
+                await new Promise((resolve) => { waiter = resolve; });
+            }
+            if (failure) throw failure;
+            this._sendWriteData(rid, chunk);
+            sent += chunk.length;
+        };
+
         if (Buffer.isBuffer(source)) {
             for (let off = 0; off < source.length; off += WRITE_CHUNK_SIZE) {
-                this._sendWriteData(rid, source.subarray(off, Math.min(off + WRITE_CHUNK_SIZE, source.length)));
+                await send(source.subarray(off, Math.min(off + WRITE_CHUNK_SIZE, source.length)));
             }
         } else {
-            await new Promise((resolve, reject) => {
-                source.on("data", (chunk) => {
-                    const buf = Buffer.isBuffer(chunk) ? chunk : Buffer.from(chunk);
-                    this._sendWriteData(rid, buf);
-                    if (this._socket.writableLength > WRITE_CHUNK_SIZE * 4) {
-                        source.pause();
-                        this._socket.once("drain", () => source.resume());
-                    }
-                });
-                source.on("end", resolve);
-                source.on("error", reject);
-            });
+            for await (const chunk of source) {
+                const buf = Buffer.isBuffer(chunk) ? chunk : Buffer.from(chunk);
+                for (let off = 0; off < buf.length; off += WRITE_CHUNK_SIZE) {
+                    await send(buf.subarray(off, Math.min(off + WRITE_CHUNK_SIZE, buf.length)));
+                }
+            }
         }
 
+        if (failure) throw failure;
         this._buildAndSend(rid, SftpMsgType.WriteEnd, () => ({}));
         return this._waitResponse(rid, WRITE_END_TIMEOUT);
     }
@@ -30,7 +30,21 @@ const { RECORDINGS_DIR, ensureRecordingsDir, compressRecording, getRecordingPath
 const AuditLog = require("../../models/AuditLog");
 
 const SESSION_TIMEOUT = 30000;
+// The engine ends a streamed command after 300 s without output; wait a
+// little longer so its own error reaches the caller first.
+const EXEC_STREAM_IDLE_TIMEOUT = 330000;
 const DATA_CONNECTION_TIMEOUT = 30000;
+const WARM_CONNECTIONS_PER_ENGINE = 16;
+const WARM_CONNECTION_IDLE_TIMEOUT = 300000;
+
+const parseExecBatchEntry = (e) => ({
+    id: e.id(),
+    success: e.success(),
+    stdout: e.stdoutData() || "",
+    stderr: e.stderrData() || "",
+    exitCode: e.exitCode(),
+    errorMessage: e.errorMessage(),
+});
 
 class ControlPlaneServer extends EventEmitter {
     constructor() {
@@ -41,6 +55,7 @@ class ControlPlaneServer extends EventEmitter {
         this.server = null;
         this._engines = new Map();
         this._dataConnections = new Map();
+        this._warmConnections = new Set();
         this._pending = new Map();
         this._sessionEngineMap = new Map();
         this._pingInterval = null;
@@ -78,6 +93,12 @@ class ControlPlaneServer extends EventEmitter {
         }
         this._dataConnections.clear();
 
+        for (const socket of this._warmConnections) {
+            clearTimeout(socket._warmIdleTimer);
+            socket.destroy();
+        }
+        this._warmConnections.clear();
+
         this._rejectAllPending("Server stopping");
 
         for (const [, engine] of this._engines) {
@@ -130,37 +151,74 @@ class ControlPlaneServer extends EventEmitter {
         this._sendFrame(engine.socket, buildSessionResize(sessionId, cols, rows));
     }
 
-    execCommand(host, port, params, command, jumpHosts = [], engineId = null) {
+    execCommand(host, port, params, command, jumpHosts = [], engineId = null, options = {}) {
         const engine = this._resolveEngine(engineId);
         if (!engine) return Promise.reject(new Error("No engine connected"));
 
+        const { onOutput = null } = options;
         const requestId = `exec-${Date.now()}-${Math.random().toString(36).substring(2, 10)}`;
-        return this._createPendingRequest(requestId, null, () => {
-            this._sendFrame(engine.socket, buildExecCommand(requestId, host, port, params, command, jumpHosts));
-        }, null, engine.engineId);
+        const promise = this._createPendingRequest(requestId, null, () => {
+            this._sendFrame(engine.socket, buildExecCommand(requestId, host, port, params, command, jumpHosts,
+                !!onOutput));
+        }, null, engine.engineId, onOutput ? EXEC_STREAM_IDLE_TIMEOUT : SESSION_TIMEOUT);
+
+        const pending = this._pending.get(requestId);
+        if (pending && onOutput) pending.onOutput = onOutput;
+        return promise;
     }
 
-    execCommandBatch(host, port, params, commands, jumpHosts = [], engineId = null) {
+    execCommandBatch(host, port, params, commands, jumpHosts = [], engineId = null, options = {}) {
         const engine = this._resolveEngine(engineId);
         if (!engine) return Promise.reject(new Error("No engine connected"));
         if (!Array.isArray(commands) || commands.length === 0) {
             return Promise.resolve({ success: true, errorMessage: null, results: [] });
         }
 
+        // Entries are always streamed so that the timeout applies between
+        // entries, and so that a timeout only fails the entries still missing.
+        const { parallelism = 0, onEntry = null } = options;
         const requestId = `execbatch-${Date.now()}-${Math.random().toString(36).substring(2, 10)}`;
-        return this._createPendingRequest(requestId, null, () => {
-            this._sendFrame(engine.socket, buildExecBatch(requestId, host, port, params, commands, jumpHosts));
+        const promise = this._createPendingRequest(requestId, null, () => {
+            this._sendFrame(engine.socket, buildExecBatch(requestId, host, port, params, commands, jumpHosts,
+                parallelism, true));
         }, null, engine.engineId);
+
+        const pending = this._pending.get(requestId);
+        if (pending) {
+            pending.streamed = [];
+            pending.onEntry = onEntry;
+            pending.onTimeout = () => this._timeOutBatchEntries(pending, commands);
+        }
+        return promise;
     }
 
-    portCheck(targets, timeoutMs = 2000, engineId = null) {
+    _timeOutBatchEntries(pending, commands) {
+        const done = new Set(pending.streamed.map((e) => e.id));
+        const results = [...pending.streamed];
+        for (const { id } of commands) {
+            if (done.has(String(id))) continue;
+            const entry = { id: String(id), success: false, stdout: "", stderr: "", exitCode: -1, errorMessage: "Request timeout" };
+            results.push(entry);
+            pending.onEntry?.(entry);
+        }
+
+        const anyFinished = pending.streamed.length > 0;
+        return { success: anyFinished, errorMessage: anyFinished ? null : "Request timeout", results };
+    }
+
+    portCheck(targets, timeoutMs = 2000, engineId = null, options = {}) {
         const engine = this._resolveEngine(engineId);
         if (!engine) return Promise.reject(new Error("No engine connected"));
 
+        const { onPartial = null } = options;
         const requestId = `portcheck-${Date.now()}-${Math.random().toString(36).substring(2, 10)}`;
-        return this._createPendingRequest(requestId, null, () => {
-            this._sendFrame(engine.socket, buildPortCheck(requestId, targets, timeoutMs));
+        const promise = this._createPendingRequest(requestId, null, () => {
+            this._sendFrame(engine.socket, buildPortCheck(requestId, targets, timeoutMs, !!onPartial));
         }, null, engine.engineId);
+
+        const pending = this._pending.get(requestId);
+        if (pending && onPartial) pending.onPartial = onPartial;
+        return promise;
     }
 
     httpFetch(method, url, headers = {}, body = null, timeoutMs = 30000, insecure = false, engineId = null) {
@@ -211,18 +269,28 @@ class ControlPlaneServer extends EventEmitter {
         return true;
     }
 
-    _createPendingRequest(key, onResult, onSend, joinSessionId = null, ownerEngineId = null) {
+    _createPendingRequest(key, onResult, onSend, joinSessionId = null, ownerEngineId = null, timeoutMs = SESSION_TIMEOUT) {
         return new Promise((resolve, reject) => {
-            const timeout = setTimeout(() => {
-                this._pending.delete(key);
-                reject(new Error("Request timeout"));
-            }, SESSION_TIMEOUT);
+            const entry = { resolve, reject, timeoutMs, onResult, joinSessionId, ownerEngineId };
+            entry.timeout = setTimeout(() => this._expirePending(key, entry), timeoutMs);
 
-            this._pending.set(key, { resolve, reject, timeout, onResult, joinSessionId, ownerEngineId });
+            this._pending.set(key, entry);
             onSend();
         });
     }
 
+    _refreshPendingTimeout(key, entry) {
+        clearTimeout(entry.timeout);
+        entry.timeout = setTimeout(() => this._expirePending(key, entry), entry.timeoutMs);
+    }
+
+    // Requests that can report a partial outcome resolve with it instead.
+    _expirePending(key, entry) {
+        this._pending.delete(key);
+        if (entry.onTimeout) entry.resolve(entry.onTimeout());
+        else entry.reject(new Error("Request timeout"));
+    }
+
     _pendingOwnedBy(entry, respondingEngineId) {
         if (!entry.ownerEngineId || respondingEngineId == null) return true;
         if (entry.ownerEngineId === respondingEngineId) return true;
@@ -345,6 +413,22 @@ class ControlPlaneServer extends EventEmitter {
                     return;
                 }
 
+                if (this._warmConnections.has(socket) && msgType !== MessageType.ConnectionReady) {
+                    logger.warn(`Control plane: unexpected message type ${msgType} on warm connection from ${remoteAddr}`);
+                    socket.removeListener("data", onData);
+                    socket.destroy();
+                    return;
+                }
+
+                if (msgType === MessageType.ConnectionReady && !envelope.connectionReady()?.sessionId()) {
+                    clearTimeout(handshakeTimer);
+                    if (!this._parkWarmConnection(socket, remoteAddr)) {
+                        socket.removeListener("data", onData);
+                        socket.destroy();
+                    }
+                    return;
+                }
+
                 identified = true;
                 clearTimeout(handshakeTimer);
                 if (msgType === MessageType.EngineHello) {
@@ -428,7 +512,41 @@ class ControlPlaneServer extends EventEmitter {
         this.emit("engineConnected", { engineId: dbEngineId, version, remoteAddr });
     }
 
+    _parkWarmConnection(socket, remoteAddr) {
+        if (this._warmConnections.has(socket) || !this._isKnownEngineAddress(socket.remoteAddress)) {
+            logger.warn(`Control plane: rejecting warm data connection from ${remoteAddr} (no matching engine)`);
+            return false;
+        }
+
+        let parked = 0;
+        for (const warm of this._warmConnections) {
+            if (warm.remoteAddress === socket.remoteAddress) parked++;
+        }
+        if (parked >= WARM_CONNECTIONS_PER_ENGINE) {
+            logger.warn(`Control plane: rejecting warm data connection from ${remoteAddr} (limit of ${WARM_CONNECTIONS_PER_ENGINE} reached)`);
+            return false;
+        }
+
+        this._warmConnections.add(socket);
+        socket.setKeepAlive(true, 30000);
+        socket._warmIdleTimer = setTimeout(() => {
+            logger.debug(`Control plane: closing idle warm data connection from ${remoteAddr}`);
+            socket.destroy();
+        }, WARM_CONNECTION_IDLE_TIMEOUT);
+        socket._warmIdleTimer.unref?.();
+        socket.once("close", () => this._unparkWarmConnection(socket));
+        logger.debug(`Control plane: parked warm data connection from ${remoteAddr}`);
+        return true;
+    }
+
+    _unparkWarmConnection(socket) {
+        clearTimeout(socket._warmIdleTimer);
+        this._warmConnections.delete(socket);
+    }
+
     _handleConnectionReady(socket, envelope, remoteAddr, residualBuf) {
+        this._unparkWarmConnection(socket);
+
         const ready = envelope.connectionReady();
         if (!ready) {
             socket.destroy();
@@ -602,24 +720,50 @@ class ControlPlaneServer extends EventEmitter {
                 break;
             }
 
+            case MessageType.ExecOutputChunk: {
+                const chunk = envelope.execOutputChunk();
+                if (!chunk) break;
+
+                const key = chunk.requestId();
+                const pending = this._pending.get(key);
+                if (!pending?.onOutput || !this._pendingOwnedBy(pending, respondingEngineId)) break;
+
+                this._refreshPendingTimeout(key, pending);
+                const data = chunk.dataArray();
+                pending.onOutput(chunk.isStderr() ? "stderr" : "stdout",
+                    data ? Buffer.from(data.buffer, data.byteOffset, data.byteLength) : Buffer.alloc(0));
+                break;
+            }
+
+            case MessageType.ExecBatchEntryResult: {
+                const result = envelope.execBatchEntryResult();
+                const e = result?.entry();
+                if (!e) break;
+
+                const key = result.requestId();
+                const pending = this._pending.get(key);
+                if (!pending?.streamed || !this._pendingOwnedBy(pending, respondingEngineId)) break;
+
+                this._refreshPendingTimeout(key, pending);
+                const entry = parseExecBatchEntry(e);
+                pending.streamed.push(entry);
+                pending.onEntry?.(entry);
+                break;
+            }
+
             case MessageType.ExecBatchResult: {
                 const result = envelope.execBatchResult();
                 if (!result) break;
 
                 const resultsLen = result.resultsLength();
-                const results = [];
+                let results = [];
                 for (let i = 0; i < resultsLen; i++) {
-                    const e = result.results(i);
-                    results.push({
-                        id: e.id(),
-                        success: e.success(),
-                        stdout: e.stdoutData() || "",
-                        stderr: e.stderrData() || "",
-                        exitCode: e.exitCode(),
-                        errorMessage: e.errorMessage(),
-                    });
+                    results.push(parseExecBatchEntry(result.results(i)));
                 }
 
+                const streamed = this._pending.get(result.requestId())?.streamed;
+                if (resultsLen === 0 && streamed) results = streamed;
+
                 this._resolvePending(result.requestId(), {
                     success: result.success(),
                     errorMessage: result.errorMessage(),
@@ -640,6 +784,14 @@ class ControlPlaneServer extends EventEmitter {
                     entries.push({ id: entry.id(), online: entry.online() });
                 }
 
+                if (result.partial()) {
+                    const pending = this._pending.get(requestId);
+                    if (!pending?.onPartial || !this._pendingOwnedBy(pending, respondingEngineId)) break;
+                    this._refreshPendingTimeout(requestId, pending);
+                    pending.onPartial(entries);
+                    break;
+                }
+
                 this._resolvePending(requestId, { entries }, respondingEngineId);
                 break;
             }
@@ -167,7 +167,7 @@ const buildSessionResize = (sessionId, cols, rows) => {
     return finishEnvelope(builder, Envelope.endEnvelope(builder));
 };
 
-const buildExecCommand = (requestId, host, port, params, command, jumpHosts) => {
+const buildExecCommand = (requestId, host, port, params, command, jumpHosts, stream = false) => {
     const builder = new flatbuffers.Builder(1024);
     const reqIdOff = builder.createString(requestId);
     const hostOff = builder.createString(host);
@@ -182,6 +182,7 @@ const buildExecCommand = (requestId, host, port, params, command, jumpHosts) =>
     if (paramsVecOff) ExecCommand.addParams(builder, paramsVecOff);
     ExecCommand.addCommand(builder, cmdOff);
     if (jumpHostsVecOff) ExecCommand.addJumpHosts(builder, jumpHostsVecOff);
+    if (stream) ExecCommand.addStream(builder, true);
     const execOff = ExecCommand.endExecCommand(builder);
 
     Envelope.startEnvelope(builder);
@@ -190,7 +191,7 @@ const buildExecCommand = (requestId, host, port, params, command, jumpHosts) =>
     return finishEnvelope(builder, Envelope.endEnvelope(builder));
 };
 
-const buildExecBatch = (requestId, host, port, params, commands, jumpHosts) => {
+const buildExecBatch = (requestId, host, port, params, commands, jumpHosts, parallelism = 0, stream = false) => {
     const builder = new flatbuffers.Builder(2048);
     const reqIdOff = builder.createString(requestId);
     const hostOff = builder.createString(host);
@@ -215,6 +216,8 @@ const buildExecBatch = (requestId, host, port, params, commands, jumpHosts) => {
     if (paramsVecOff) ExecBatch.addParams(builder, paramsVecOff);
     ExecBatch.addCommands(builder, cmdsVecOff);
     if (jumpHostsVecOff) ExecBatch.addJumpHosts(builder, jumpHostsVecOff);
+    if (parallelism > 0) ExecBatch.addParallelism(builder, parallelism);
+    if (stream) ExecBatch.addStream(builder, true);
     const batchOff = ExecBatch.endExecBatch(builder);
 
     Envelope.startEnvelope(builder);
@@ -223,7 +226,7 @@ const buildExecBatch = (requestId, host, port, params, commands, jumpHosts) => {
     return finishEnvelope(builder, Envelope.endEnvelope(builder));
 };
 
-const buildPortCheck = (requestId, targets, timeoutMs) => {
+const buildPortCheck = (requestId, targets, timeoutMs, stream = false) => {
     const builder = new flatbuffers.Builder(512);
     const reqIdOff = builder.createString(requestId);
 
@@ -242,6 +245,7 @@ const buildPortCheck = (requestId, targets, timeoutMs) => {
     PortCheck.addRequestId(builder, reqIdOff);
     PortCheck.addTargets(builder, targetsVecOff);
     PortCheck.addTimeoutMs(builder, timeoutMs);
+    PortCheck.addStream(builder, stream);
     const pcOff = PortCheck.endPortCheck(builder);
 
     Envelope.startEnvelope(builder);
@@ -58,11 +58,18 @@ const buildRdpParams = async (cfg, identity, accountId) => {
     if (cfg.enableFullWindowDrag === true) params["enable-full-window-drag"] = "true";
     if (cfg.enableDesktopComposition === true) params["enable-desktop-composition"] = "true";
     if (cfg.enableMenuAnimations === true) params["enable-menu-animations"] = "true";
+    if (cfg.adaptiveEncoding === true) params["adaptive-encoding"] = "true";
+    if (cfg.progressiveEncoding === true) params["progressive-encoding"] = "true";
+    if (cfg.stripeEncoding === true) params["stripe-encoding"] = "true";
+    if (cfg.stripeThreshold) params["stripe-threshold"] = String(cfg.stripeThreshold);
+    if (cfg.stripeHeight) params["stripe-height"] = String(cfg.stripeHeight);
 
     if (accountId !== undefined && accountId !== null) {
         params["enable-drive"] = "true";
         params["drive-name"] = "Shared";
         params["drive-backend"] = "client";
+        if (cfg.drivePipelining === true) params["drive-pipelining"] = "true";
+        if (cfg.driveCacheTtl !== undefined && cfg.driveCacheTtl !== null) params["drive-cache-ttl"] = String(cfg.driveCacheTtl);
     }
 
     return params;
@@ -83,6 +90,11 @@ const buildVncParams = async (cfg, identity) => {
 
     if (cfg.colorDepth) params["color-depth"] = String(cfg.colorDepth);
     if (cfg.resizeMethod && cfg.resizeMethod !== "none") params["resize-method"] = cfg.resizeMethod;
+    if (cfg.adaptiveEncoding === true) params["adaptive-encoding"] = "true";
+    if (cfg.progressiveEncoding === true) params["progressive-encoding"] = "true";
+    if (cfg.stripeEncoding === true) params["stripe-encoding"] = "true";
+    if (cfg.stripeThreshold) params["stripe-threshold"] = String(cfg.stripeThreshold);
+    if (cfg.stripeHeight) params["stripe-height"] = String(cfg.stripeHeight);
 
     return params;
 };
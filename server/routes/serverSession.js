@@ -1,4 +1,5 @@
 const { Router } = require("express");
+const { StringDecoder } = require("node:string_decoder");
 const { createSession, getSessions, getSession, hibernateSession, resumeSession, deleteSession, startSharing, stopSharing, updateSharePermissions, duplicateSession, pasteIdentityPassword } = require("../controllers/serverSession");
 const { execCommand } = require("../controllers/execCommand");
 const { createSessionValidation, sessionIdValidation, resumeSessionValidation, duplicateSessionValidation } = require("../validations/serverSession");
@@ -247,15 +248,25 @@ app.post("/:id/paste-password", async (req, res) => {
 /**
  * POST /connections/{entryId}/exec
  * @summary Execute Command
- * @description Executes a single command on a server entry and returns the output.
+ * @description Executes a single command on a server entry and returns the output. With stream=true the
+ * response is newline-delimited JSON: {type: "stdout"|"stderr", data} lines as output arrives, then one
+ * {type: "exit", ...result} line.
  * @tags Connection
  * @produces application/json
  * @security BearerAuth
  * @param {number} entryId.path.required - Entry ID
+ * @param {boolean} stream.query - Stream output as it arrives
  * @param {object} request.body.required - Command to execute
  * @return {object} 200 - Command result with stdout, stderr, exitCode
  */
 app.post("/:entryId/exec", async (req, res) => {
+    let streaming = false;
+    const startStream = () => {
+        if (streaming) return;
+        streaming = true;
+        res.status(200).set("Content-Type", "application/x-ndjson");
+    };
+
     try {
         const entryId = parseInt(req.params.entryId, 10);
         if (isNaN(entryId)) return res.status(400).json({ error: "Invalid entry ID" });
@@ -265,16 +276,31 @@ app.post("/:entryId/exec", async (req, res) => {
             return res.status(400).json({ error: "Command is required" });
         }
 
+        let onOutput = null;
+        if (req.query.stream === "true") {
+            const decoders = { stdout: new StringDecoder("utf8"), stderr: new StringDecoder("utf8") };
+            onOutput = (type, data) => {
+                const text = decoders[type].write(data);
+                if (!text) return;
+                startStream();
+                res.write(JSON.stringify({ type, data: text }) + "\n");
+            };
+        }
+
         const identityId = req.query.identityId ? parseInt(req.query.identityId, 10) : null;
-        const result = await execCommand(req.user.id, entryId, identityId, command);
+        const result = await execCommand(req.user.id, entryId, identityId, command, onOutput);
 
         if (result?.code) {
             return res.status(result.code).json({ error: result.message });
         }
 
-        res.json(result);
+        if (!onOutput) return res.json(result);
+
+        startStream();
+        res.end(JSON.stringify({ type: "exit", ...result }) + "\n");
     } catch (error) {
         console.error('Error executing command:', error);
+        if (streaming) return res.end(JSON.stringify({ type: "error", error: "Internal server error" }) + "\n");
         res.status(500).json({ error: 'Internal server error' });
     }
 });
@@ -130,6 +130,7 @@ const validateRequest = (query) => {
  * @param {string} sessionToken.query.required - Session authentication token
  * @param {string} sessionId.query.required - Active server session ID
  * @param {string} path.query.required - Remote destination path for the uploaded file
+ * @param {number} offset.query - Byte offset to resume an interrupted upload from
  * @return {object} 200 - Upload successful with file path and size
  * @return {object} 400 - Missing parameters or invalid path
  * @return {object} 401 - Invalid session token
@@ -157,7 +158,8 @@ app.post("/upload", async (req, res) => {
                 audit(ctx, req, AUDIT_ACTIONS.FOLDER_CREATE, RESOURCE_TYPES.FOLDER, { folderPath });
         }
 
-        await ctx.sftpClient.writeFile(remotePath, req);
+        const offset = Math.max(Number.parseInt(req.query.offset) || 0, 0);
+        await ctx.sftpClient.writeFile(remotePath, req, offset);
 
         const totalSize = Number.parseInt(req.headers["content-length"]) || 0;
         res.json({ success: true, path: remotePath, size: totalSize });
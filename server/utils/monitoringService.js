@@ -110,7 +110,7 @@ const collectServerData = async (entry, identity, credentials) => {
 
     try {
         const commands = Object.entries(COMMANDS).map(([id, command]) => ({ id, command }));
-        const batch = await controlPlane.execCommandBatch(host, port, params, commands, jumpHosts);
+        const batch = await controlPlane.execCommandBatch(host, port, params, commands, jumpHosts, null, { parallelism: 8 });
         if (!batch.success) {
             throw new Error(batch.errorMessage || "Failed to connect to SSH host");
         }
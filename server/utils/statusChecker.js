@@ -131,8 +131,12 @@ const runStatusCheck = async () => {
         const allResults = [];
 
         if (serverEntries.length > 0) {
-            const batchResults = await checkServerStatusBatch(serverEntries, batchTimeout);
-            allResults.push(...batchResults);
+            const reported = new Set();
+            const batchResults = await checkServerStatusBatch(serverEntries, batchTimeout, (partial) => {
+                partial.forEach(r => reported.add(r.id));
+                updateStatuses(partial);
+            });
+            allResults.push(...batchResults.filter(r => !reported.has(r.id)));
         }
 
         if (pveEntries.length > 0) {